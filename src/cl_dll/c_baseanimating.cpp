@@ -2361,6 +2361,76 @@ void C_BaseAnimating::InvalidateBoneCaches()
 }
 
 
+static ConVar cl_bonesetup_prepass( "cl_bonesetup_prepass", "1", 0, "Set up bones for all visible animating entities, parents first, before any of them are drawn" );
+
+struct BoneSetupEntry_t
+{
+	C_BaseAnimating	*m_pAnimating;
+	int				m_nDepth;
+};
+
+static int __cdecl BoneSetupDepthCompare( const BoneSetupEntry_t *pLeft, const BoneSetupEntry_t *pRight )
+{
+	return pLeft->m_nDepth - pRight->m_nDepth;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets up bones for a batch of entities that are about to be drawn,
+//			instead of lazily in the middle of rendering. Entities are sorted by
+//			hierarchy depth so a bone merged child always finds its parent's
+//			bones already set up. Each entity asks for the bones it needed last
+//			frame; anything new is still picked up lazily when drawn.
+// (static function)
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::SetupBonesForEntities( C_BaseAnimating **ppEntities, int nCount )
+{
+	if ( !cl_bonesetup_prepass.GetBool() || nCount == 0 )
+		return;
+
+	VPROF_BUDGET( "C_BaseAnimating::SetupBonesForEntities", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
+
+	BoneSetupEntry_t *pEntries = (BoneSetupEntry_t *)stackalloc( nCount * sizeof(BoneSetupEntry_t) );
+	int nEntries = 0;
+	for ( int i = 0; i < nCount; ++i )
+	{
+		C_BaseAnimating *pAnimating = ppEntities[i];
+
+		// Already set up this frame
+		if ( pAnimating->IsBoneCacheValid() )
+			continue;
+
+		// Until SetupBones runs this frame this still holds everything asked for last
+		// frame. Nothing to go on if it wasn't drawn.
+		if ( !pAnimating->m_iAccumulatedBoneMask )
+			continue;
+
+		int nDepth = 0;
+		for ( C_BaseEntity *pParent = pAnimating->GetMoveParent(); pParent; pParent = pParent->GetMoveParent() )
+		{
+			++nDepth;
+		}
+
+		pEntries[nEntries].m_pAnimating = pAnimating;
+		pEntries[nEntries].m_nDepth = nDepth;
+		++nEntries;
+	}
+
+	qsort( pEntries, nEntries, sizeof(BoneSetupEntry_t), (int (__cdecl *)(const void *, const void *))BoneSetupDepthCompare );
+
+	// Entities at the same depth don't depend on each other
+	for ( int i = 0; i < nEntries; ++i )
+	{
+		C_BaseAnimating *pAnimating = pEntries[i].m_pAnimating;
+		pAnimating->SetupBones( NULL, -1, pAnimating->m_iAccumulatedBoneMask, gpGlobals->curtime );
+
+		// Don't count this as a request, so the mask can still shrink next frame
+		pAnimating->m_iAccumulatedBoneMask = 0;
+	}
+
+	stackfree( pEntries );
+}
+
+
 ConVar r_drawothermodels( "r_drawothermodels", "1", FCVAR_CHEAT, "0=Off, 1=Normal, 2=Wireframe" );
 
 //-----------------------------------------------------------------------------
@@ -326,6 +326,9 @@ public:
 	// Invalidate bone caches so all SetupBones() calls force bone transforms to be regenerated.
 	static void						InvalidateBoneCaches();
 
+	// Set up bones for entities about to be drawn, parents before children
+	static void						SetupBonesForEntities( C_BaseAnimating **ppEntities, int nCount );
+
 	// Purpose: My physics object has been updated, react or extract data
 	virtual void					VPhysicsUpdate( IPhysicsObject *pPhysics );
 
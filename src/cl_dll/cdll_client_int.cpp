@@ -58,6 +58,7 @@
 #include "igameevents.h"
 #include "datacache/idatacache.h"
 #include "datacache/imdlcache.h"
+#include "bone_setup.h"
 #include "kbutton.h"
 #include "vstdlib/icommandline.h"
 #include "gamerules_register.h"
@@ -1460,6 +1461,9 @@ void OnRenderStart()
 	// Invalidate any bone information.
 	C_BaseAnimating::InvalidateBoneCaches();
 
+	// Free bone caches retired two or more frames ago
+	Studio_BoneCacheNewFrame();
+
 	C_BaseEntity::SetAbsQueriesValid( true );
 	C_BaseEntity::EnableAbsRecomputations( true );
 
@@ -18,6 +18,7 @@
 #include "DetailObjectSystem.h"
 #include "engine/IStaticPropMgr.h"
 #include "engine/IVDebugOverlay.h"
+#include "iviewrender.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -27,6 +28,8 @@ class VMatrix;  // forward decl
 static ConVar cl_drawleaf("cl_drawleaf", "-1", FCVAR_CHEAT );
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "1", FCVAR_CHEAT, "Clip entities against portal frustums." );
 static ConVar r_portalsopenall( "r_portalsopenall", "1", FCVAR_CHEAT, "Open all portals" );
+static ConVar cl_leafsystem_cullcache( "cl_leafsystem_cullcache", "1", 0, "Reuse bounds and frustum culling results for static props and brush models that haven't moved" );
+static ConVar cl_leafsystem_cullcache_stats( "cl_leafsystem_cullcache_stats", "0", 0, "Show how many renderables were culled versus reused from the cull cache each frame" );
 		    
 //-----------------------------------------------------------------------------
 // The client leaf system
@@ -152,6 +155,15 @@ private:
 	// Adds a shadow to a leaf/removes shadow from leaf
 	void RemoveShadowFromLeaves( ClientLeafShadowHandle_t handle );
 
+	// World space bounds used for culling; cached for renderables that only move through RenderableChanged
+	void GetRenderableCullBounds( ClientRenderHandle_t handle, Vector &absMins, Vector &absMaxs );
+
+	// Returns the key for the current view's frustum, starting a new one if it hasn't been seen lately
+	int FindFrustumKey( const VPlane *pFrustum );
+
+	// Called at the start of each render list build
+	void StartCullCachePass( int nRenderFrame );
+
 	// Methods associated with the various bi-directional sets
 	static unsigned short& FirstRenderableInLeaf( int leaf ) 
 	{ 
@@ -193,6 +205,13 @@ private:
 		RENDER_FLAGS_STUDIO_MODEL	= 0x08,
 		RENDER_FLAGS_HASCHANGED		= 0x10,
 		RENDER_FLAGS_ALTERNATE_SORTING = 0x20,
+		RENDER_FLAGS_BOUNDS_CACHED	= 0x40,		// m_vecCachedMins/Maxs are valid
+		RENDER_FLAGS_FRUSTUM_CULLED	= 0x80,		// The frustum keyed by m_nCullFrustumKey culled it
+	};
+
+	enum
+	{
+		CULL_CACHE_FRUSTUMS = 4,				// Main view, reflection, refraction, skybox...
 	};
 
 	// All the information associated with a particular handle
@@ -208,6 +227,16 @@ private:
 		unsigned char		m_RenderGroup;	// RenderGroup_t type
 		unsigned short		m_FirstShadow;	// The first shadow caster that cast on it
 		short m_Area;	// -1 if the renderable spans multiple areas.
+		int					m_nCullFrustumKey;	// Frustum the cached cull result is for (0 = none)
+		Vector				m_vecCachedMins;	// World space bounds if RENDER_FLAGS_BOUNDS_CACHED
+		Vector				m_vecCachedMaxs;
+	};
+
+	struct CachedFrustum_t
+	{
+		Frustum			m_Planes;
+		int				m_nKey;
+		int				m_nLastUsed;
 	};
 
 	// The leaf contains an index into a list of renderables
@@ -265,6 +294,18 @@ private:
 
 	// A little enumerator to help us when adding shadows to renderables
 	int	m_ShadowEnum;
+
+	// Recently used view frustums, so a renderable can tell if it was
+	// already culled against this one
+	CachedFrustum_t		m_CachedFrustums[CULL_CACHE_FRUSTUMS];
+	int					m_nNextFrustumKey;
+	int					m_nCurrentFrustumKey;
+	int					m_nCullCacheRenderFrame;
+
+	// Cull cache stats for the frame so far
+	int					m_nStatsFrame;
+	int					m_nCullsVisited;
+	int					m_nCullsReused;
 };
 
 
@@ -382,6 +423,14 @@ CClientLeafSystem::CClientLeafSystem() : m_DrawStaticProps(true), m_DrawSmallObj
 	m_RenderablesInLeaf.Init( FirstRenderableInLeaf, FirstLeafInRenderable );
 	m_ShadowsInLeaf.Init( FirstShadowInLeaf, FirstLeafInShadow ); 
 	m_ShadowsOnRenderable.Init( FirstShadowOnRenderable, FirstRenderableInShadow );
+
+	memset( m_CachedFrustums, 0, sizeof( m_CachedFrustums ) );
+	m_nNextFrustumKey = 1;
+	m_nCurrentFrustumKey = 0;
+	m_nCullCacheRenderFrame = -1;
+	m_nStatsFrame = -1;
+	m_nCullsVisited = 0;
+	m_nCullsReused = 0;
 }
 
 CClientLeafSystem::~CClientLeafSystem()
@@ -503,6 +552,7 @@ void CClientLeafSystem::NewRenderable( IClientRenderable* pRenderable, RenderGro
 	info.m_RenderGroup = (unsigned char)type;
 	info.m_EnumCount = 0;
 	info.m_RenderLeaf = 0xFFFF;
+	info.m_nCullFrustumKey = 0;
 	if ( IsViewModelRenderGroup( (RenderGroup_t)info.m_RenderGroup ) )
 	{
 		AddToViewModelList( handle );
@@ -1066,6 +1116,10 @@ void CClientLeafSystem::RenderableChanged( ClientRenderHandle_t handle )
 	if ( !m_Renderables.IsValidIndex( handle ) )
 		return;
 
+	// It may have moved, so its cached bounds and cull results are stale
+	m_Renderables[handle].m_Flags &= ~( RENDER_FLAGS_BOUNDS_CACHED | RENDER_FLAGS_FRUSTUM_CULLED );
+	m_Renderables[handle].m_nCullFrustumKey = 0;
+
 	if ( (m_Renderables[handle].m_Flags & RENDER_FLAGS_HASCHANGED ) == 0 )
 	{
 		m_Renderables[handle].m_Flags |= RENDER_FLAGS_HASCHANGED;
@@ -1249,6 +1303,96 @@ inline void AddRenderableToRenderList( CRenderList &renderList, IClientRenderabl
 }
 
 
+//-----------------------------------------------------------------------------
+// Culling bounds. Static props never move, and brush models only move through
+// RenderableChanged, so their world space bounds are kept until that's called.
+// Anything animated (or following something animated) changes its render
+// bounds without telling us, so it's recomputed every time.
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::GetRenderableCullBounds( ClientRenderHandle_t handle, Vector &absMins, Vector &absMaxs )
+{
+	RenderableInfo_t &renderable = m_Renderables[handle];
+	if ( renderable.m_Flags & RENDER_FLAGS_BOUNDS_CACHED )
+	{
+		absMins = renderable.m_vecCachedMins;
+		absMaxs = renderable.m_vecCachedMaxs;
+		return;
+	}
+
+	CalcRenderableWorldSpaceAABB( renderable.m_pRenderable, absMins, absMaxs );
+
+	if ( !cl_leafsystem_cullcache.GetBool() )
+		return;
+
+	bool bCacheable = ( renderable.m_Flags & RENDER_FLAGS_STATIC_PROP ) != 0;
+	if ( renderable.m_Flags & RENDER_FLAGS_BRUSH_MODEL )
+	{
+		C_BaseEntity *pEnt = renderable.m_pRenderable->GetIClientUnknown()->GetBaseEntity();
+		bCacheable = !pEnt || !pEnt->IsFollowingEntity();
+	}
+
+	if ( bCacheable )
+	{
+		renderable.m_vecCachedMins = absMins;
+		renderable.m_vecCachedMaxs = absMaxs;
+		renderable.m_nCullFrustumKey = 0;
+		renderable.m_Flags |= RENDER_FLAGS_BOUNDS_CACHED;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Each distinct view frustum seen lately gets a key. A renderable that was
+// culled against the same key and hasn't moved since gets the same answer.
+//-----------------------------------------------------------------------------
+int CClientLeafSystem::FindFrustumKey( const VPlane *pFrustum )
+{
+	int iOldest = 0;
+	for ( int i = 0; i < CULL_CACHE_FRUSTUMS; i++ )
+	{
+		CachedFrustum_t &cached = m_CachedFrustums[i];
+		if ( cached.m_nKey != 0 && !memcmp( cached.m_Planes, pFrustum, sizeof( Frustum ) ) )
+		{
+			cached.m_nLastUsed = m_nCullCacheRenderFrame;
+			return cached.m_nKey;
+		}
+
+		if ( cached.m_nLastUsed < m_CachedFrustums[iOldest].m_nLastUsed )
+		{
+			iOldest = i;
+		}
+	}
+
+	CachedFrustum_t &cached = m_CachedFrustums[iOldest];
+	memcpy( cached.m_Planes, pFrustum, sizeof( Frustum ) );
+	cached.m_nLastUsed = m_nCullCacheRenderFrame;
+	cached.m_nKey = m_nNextFrustumKey++;
+	if ( m_nNextFrustumKey == 0 )
+	{
+		m_nNextFrustumKey = 1;
+	}
+	return cached.m_nKey;
+}
+
+void CClientLeafSystem::StartCullCachePass( int nRenderFrame )
+{
+	m_nCullCacheRenderFrame = nRenderFrame;
+
+	if ( gpGlobals->framecount != m_nStatsFrame )
+	{
+		if ( cl_leafsystem_cullcache_stats.GetBool() && m_nStatsFrame >= 0 )
+		{
+			engine->Con_NPrintf( 12, "Leaf system culling: %d renderables visited, %d reused", m_nCullsVisited, m_nCullsReused );
+		}
+		m_nStatsFrame = gpGlobals->framecount;
+		m_nCullsVisited = 0;
+		m_nCullsReused = 0;
+	}
+
+	m_nCurrentFrustumKey = cl_leafsystem_cullcache.GetBool() ? FindFrustumKey( view->GetFrustum() ) : 0;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : renderList - 
@@ -1280,6 +1424,12 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 {
 	bool portalTestEnts = r_PortalTestEnts.GetBool() && !r_portalsopenall.GetBool();
 
+	if ( info.m_nRenderFrame != m_nCullCacheRenderFrame )
+	{
+		StartCullCachePass( info.m_nRenderFrame );
+	}
+	bool bUseCullCache = ( m_nCurrentFrustumKey != 0 );
+
 	// Collate everything.
 	unsigned short idx = m_RenderablesInLeaf.FirstElement(leaf);
 	for ( ;idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement(idx) )
@@ -1327,19 +1477,43 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 		if ( nAlpha == 0 )
 			continue;
 
+		++m_nCullsVisited;
+
 		Vector absMins, absMaxs;
-		CalcRenderableWorldSpaceAABB( renderable.m_pRenderable, absMins, absMaxs );
+		GetRenderableCullBounds( handle, absMins, absMaxs );
 		// If the renderable is inside an area, cull it using the frustum for that area.
+		// Area frustums change as portals open and close, so those results aren't cached.
 		if ( portalTestEnts && renderable.m_Area != -1 )
 		{
 			VPROF( "r_PortalTestEnts" );
 			if ( !engine->DoesBoxTouchAreaFrustum( absMins, absMaxs, renderable.m_Area ) )
 				continue;
 		}
+		else if ( bUseCullCache && ( renderable.m_Flags & RENDER_FLAGS_BOUNDS_CACHED ) && renderable.m_nCullFrustumKey == m_nCurrentFrustumKey )
+		{
+			// Hasn't moved since it was last tested against this frustum
+			++m_nCullsReused;
+			if ( renderable.m_Flags & RENDER_FLAGS_FRUSTUM_CULLED )
+				continue;
+		}
 		else
 		{
 			// cull with main frustum
-			if ( engine->CullBox( absMins, absMaxs ) )
+			bool bCulled = engine->CullBox( absMins, absMaxs );
+			if ( bUseCullCache && ( renderable.m_Flags & RENDER_FLAGS_BOUNDS_CACHED ) )
+			{
+				renderable.m_nCullFrustumKey = m_nCurrentFrustumKey;
+				if ( bCulled )
+				{
+					renderable.m_Flags |= RENDER_FLAGS_FRUSTUM_CULLED;
+				}
+				else
+				{
+					renderable.m_Flags &= ~RENDER_FLAGS_FRUSTUM_CULLED;
+				}
+			}
+
+			if ( bCulled )
 				continue;
 		}
 
@@ -73,6 +73,7 @@
 #include "engine/IVDebugOverlay.h"
 #include "engine/IStaticPropMgr.h"
 #include "datacache/imdlcache.h"
+#include "radixsort.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -80,6 +81,7 @@
 static ConVar r_flashlightdrawfrustum( "r_flashlightdrawfrustum", "0" );
 static ConVar r_flashlightmodels( "r_flashlightmodels", "1" );
 static ConVar r_shadowrendertotexture( "r_shadowrendertotexture", "1" );
+static ConVar r_shadowrepartition( "r_shadowrepartition", "1", 0, "Lets idle shadow texture blocks be carved up into whatever size is running out" );
 
 #ifdef DOSHADOWEDFLASHLIGHT
 static ConVar r_flashlightdepthtexture( "r_flashlightdepthtexture", "0" );
@@ -94,7 +96,11 @@ static ConVar r_flashlightdepthres( "r_flashlightdepthres", "512" );
 //-----------------------------------------------------------------------------
 // A texture allocator used to batch textures together
 // At the moment, the implementation simply allocates blocks of max 256x256
-// and each block stores an array of uniformly-sized textures
+// and each block stores an array of uniformly-sized textures. When every
+// fragment of a size has been used this frame, a block that's been idle for
+// a while is re-split into that size rather than handing out smaller textures.
+// None of this touches the render target until GetTexture(), so the caching
+// decisions can be exercised without a device (see r_shadowallocator_benchmark).
 //-----------------------------------------------------------------------------
 typedef unsigned short TextureHandle_t;
 enum
@@ -105,6 +111,8 @@ enum
 class CTextureAllocator
 {
 public:
+	CTextureAllocator();
+
 	// Initialize the allocator with something that knows how to refresh the bits
 	void			Init();
 	void			Shutdown();
@@ -136,6 +144,22 @@ public:
 
 	void			DebugPrintCache( void );
 
+	// Allows idle blocks to change fragment size
+	void			EnableRepartitioning( bool bEnable );
+
+	struct AllocatorStats_t
+	{
+		int		m_nRequests;		// UseTexture calls
+		int		m_nCacheHits;		// Kept the fragment it already had
+		int		m_nRedraws;			// Moved to a new fragment, so it needs to be re-rendered
+		int		m_nDowngrades;		// Got a smaller fragment than it wanted
+		int		m_nFailures;		// Got no fragment at all
+		int		m_nRepartitions;	// Blocks re-split into a different fragment size
+	};
+
+	const AllocatorStats_t &GetStats() const;
+	void			ClearStats();
+
 private:
 	typedef unsigned short FragmentHandle_t;
 
@@ -156,6 +180,10 @@ private:
 		BLOCK_SIZE			    = MAX_TEXTURE_SIZE,
 		BLOCKS_PER_ROW		    = (TEXTURE_PAGE_SIZE / MAX_TEXTURE_SIZE),
 		BLOCK_COUNT			    = (BLOCKS_PER_ROW * BLOCKS_PER_ROW),
+
+		// A block has to sit unused this long before it can be re-split;
+		// keeps blocks from bouncing between sizes as casters come and go
+		REPARTITION_IDLE_FRAMES	= 16,
 	};
 
 	struct TextureInfo_t
@@ -178,6 +206,7 @@ private:
 	struct BlockInfo_t
 	{
 		unsigned short	m_FragmentPower;
+		unsigned int	m_FrameUsed;		// Last frame any of its fragments were used
 	};
 
 	struct Cache_t
@@ -203,6 +232,9 @@ private:
 	// Returns the size of a particular fragment
 	int	GetFragmentPower( FragmentHandle_t f ) const;
 
+	// Re-splits the longest idle block into fragments of the given power
+	bool RepartitionBlock( int power, int nKeepBlock );
+
 	// Stores the actual texture we're writing into
 	CTextureReference	m_TexturePage;
 
@@ -211,10 +243,22 @@ private:
 
 	Cache_t		m_Cache[MAX_TEXTURE_POWER+1]; 
 	BlockInfo_t	m_Blocks[BLOCK_COUNT];
+	int			m_BlocksOfPower[MAX_TEXTURE_POWER+1];
 	unsigned int m_CurrentFrame;
+	bool		m_bAllowRepartition;
+
+	AllocatorStats_t m_Stats;
 };
 
 
+CTextureAllocator::CTextureAllocator()
+{
+	m_CurrentFrame = 0;
+	m_bAllowRepartition = true;
+	ClearStats();
+}
+
+
 //-----------------------------------------------------------------------------
 // Allocate/deallocate the texture page
 //-----------------------------------------------------------------------------
@@ -297,13 +341,18 @@ void CTextureAllocator::Reset()
 	}
 
 	// Now that the block sizes are allocated, create LRUs for the various block sizes
+	memset( m_BlocksOfPower, 0, sizeof(m_BlocksOfPower) );
 	for ( i = 0; i < BLOCK_COUNT; ++i)
 	{
 		// Initialize LRU
 		AddBlockToLRU( i );
+		m_Blocks[i].m_FrameUsed = 0;
+		++m_BlocksOfPower[ m_Blocks[i].m_FragmentPower ];
 	}
 
 	m_CurrentFrame = 0;
+	m_bAllowRepartition = true;
+	ClearStats();
 }
 
 void CTextureAllocator::DeallocateAllTextures()
@@ -393,6 +442,7 @@ void CTextureAllocator::MarkUsed( FragmentHandle_t fragment )
 	Cache_t& cache = m_Cache[power];
 	m_Fragments.LinkToTail( cache.m_List, fragment );
 	m_Fragments[fragment].m_FrameUsed = m_CurrentFrame;
+	m_Blocks[block].m_FrameUsed = m_CurrentFrame;
 }
 
 
@@ -491,6 +541,7 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 //	DebugPrintCache();
 
 	TextureInfo_t& info = m_Textures[h];
+	++m_Stats.m_nRequests;
 
 	// 4 is the minimum power we have allocated
 	int nDesiredPower = 4;
@@ -520,10 +571,24 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 		{
 			// Move to the back of the LRU
 			MarkUsed( currentFragment );
+			++m_Stats.m_nCacheHits;
 			return false;
 		}
 	}
 
+	// If every fragment of the size we want has been handed out this frame,
+	// try to turn an idle block into more of them before settling for less
+	if ( m_bAllowRepartition )
+	{
+		FragmentHandle_t head = m_Fragments.Head( m_Cache[nDesiredPower].m_List );
+		if ( (head == m_Fragments.InvalidIndex()) || (m_Fragments[head].m_FrameUsed == m_CurrentFrame) )
+		{
+			// Don't re-split the block holding our own fragment; currentFragment must stay valid
+			int nKeepBlock = ( currentFragment != INVALID_FRAGMENT_HANDLE ) ? m_Fragments[currentFragment].m_Block : -1;
+			RepartitionBlock( nDesiredPower, nKeepBlock );
+		}
+	}
+
 //	Warning( "\n\nUseTexture B\n" );
 //	DebugPrintCache();
 
@@ -562,6 +627,7 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 			// Oops... we're not. Let's leave well enough alone
 			// Move to the back of the LRU
 			MarkUsed( currentFragment );
+			++m_Stats.m_nCacheHits;
 			return false;
 		}
 		else
@@ -573,9 +639,16 @@ bool CTextureAllocator::UseTexture( TextureHandle_t h, bool bWillRedraw, float f
 
 	if ( f == INVALID_FRAGMENT_HANDLE )
 	{
+		++m_Stats.m_nFailures;
 		return false;
 	}
 
+	if ( power < nDesiredPower )
+	{
+		++m_Stats.m_nDowngrades;
+	}
+	++m_Stats.m_nRedraws;
+
 	// Disconnect existing texture from this fragment (if necessary)
 	DisconnectTextureFromFragment(f);
 
@@ -600,6 +673,83 @@ int	CTextureAllocator::GetFragmentPower( FragmentHandle_t f ) const
 }
 
 
+//-----------------------------------------------------------------------------
+// Re-splits the longest idle block into fragments of the given power.
+// Every size keeps at least one block so nothing gets starved out entirely.
+// nKeepBlock (-1 for none) is never re-split.
+//-----------------------------------------------------------------------------
+bool CTextureAllocator::RepartitionBlock( int power, int nKeepBlock )
+{
+	if ( power < MIN_TEXTURE_POWER )
+		return false;
+
+	int nBestBlock = -1;
+	for ( int i = 0; i < BLOCK_COUNT; ++i )
+	{
+		BlockInfo_t &block = m_Blocks[i];
+		if ( i == nKeepBlock || block.m_FragmentPower == power || m_BlocksOfPower[block.m_FragmentPower] <= 1 )
+			continue;
+
+		if ( block.m_FrameUsed + REPARTITION_IDLE_FRAMES > m_CurrentFrame )
+			continue;
+
+		if ( (nBestBlock < 0) || (block.m_FrameUsed < m_Blocks[nBestBlock].m_FrameUsed) )
+		{
+			nBestBlock = i;
+		}
+	}
+
+	if ( nBestBlock < 0 )
+		return false;
+
+	// Toss the old fragments; any textures in them will get a new home the next time they're used
+	int nOldPower = m_Blocks[nBestBlock].m_FragmentPower;
+	Cache_t &oldCache = m_Cache[nOldPower];
+	FragmentHandle_t f = m_Fragments.Head( oldCache.m_List );
+	while ( f != m_Fragments.InvalidIndex() )
+	{
+		FragmentHandle_t next = m_Fragments.Next( f );
+		if ( m_Fragments[f].m_Block == nBestBlock )
+		{
+			DisconnectTextureFromFragment( f );
+			m_Fragments.Remove( oldCache.m_List, f );
+		}
+		f = next;
+	}
+
+	--m_BlocksOfPower[nOldPower];
+	++m_BlocksOfPower[power];
+	m_Blocks[nBestBlock].m_FragmentPower = power;
+	AddBlockToLRU( nBestBlock );
+
+	++m_Stats.m_nRepartitions;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Allows idle blocks to change fragment size
+//-----------------------------------------------------------------------------
+void CTextureAllocator::EnableRepartitioning( bool bEnable )
+{
+	m_bAllowRepartition = bEnable;
+}
+
+
+//-----------------------------------------------------------------------------
+// Stats
+//-----------------------------------------------------------------------------
+const CTextureAllocator::AllocatorStats_t &CTextureAllocator::GetStats() const
+{
+	return m_Stats;
+}
+
+void CTextureAllocator::ClearStats()
+{
+	memset( &m_Stats, 0, sizeof(m_Stats) );
+}
+
+
 //-----------------------------------------------------------------------------
 // Advance frame...
 //-----------------------------------------------------------------------------
@@ -771,6 +921,9 @@ public:
 		r_shadows_gamecontrol.SetValue( bDisabled != 1 );
 	}
 
+	// Prints + resets the shadow texture allocator stats
+	void DumpShadowAllocatorStats();
+
 private:
 	enum
 	{
@@ -3436,31 +3589,16 @@ void CVisibleShadowList::EnumShadow( unsigned short clientShadowHandle )
 void CVisibleShadowList::PrioritySort()
 {
 	int nCount = m_ShadowsInView.Count();
-	m_PriorityIndex.EnsureCapacity( nCount );
+	m_PriorityIndex.SetCount( nCount );
 
-	m_PriorityIndex.RemoveAll();
-
-	int i, j;
-	for ( i = 0; i < nCount; ++i )
+	// Largest area first, so the biggest shadows get first pick of the texture fragments
+	float *pKeys = (float*)stackalloc( nCount * sizeof(float) );
+	unsigned int *pScratch = (unsigned int*)stackalloc( RADIXSORT_SCRATCH_SIZE( nCount ) * sizeof(unsigned int) );
+	for ( int i = 0; i < nCount; ++i )
 	{
-		m_PriorityIndex.AddToTail(i);
-	}
-
-	for ( i = 0; i < nCount - 1; ++i )
-	{
-		int nLargestInd = i;
-		float flLargestArea = m_ShadowsInView[m_PriorityIndex[i]].m_flArea;
-		for ( j = i + 1; j < nCount; ++j )
-		{
-			int nIndex = m_PriorityIndex[j];
-			if ( flLargestArea < m_ShadowsInView[nIndex].m_flArea )
-			{
-				nLargestInd = j;
-				flLargestArea = m_ShadowsInView[nIndex].m_flArea;
-			}
-		}
-		swap( m_PriorityIndex[i], m_PriorityIndex[nLargestInd] );
+		pKeys[i] = -m_ShadowsInView[i].m_flArea;
 	}
+	RadixSortFloats( pKeys, nCount, (unsigned int*)m_PriorityIndex.Base(), pScratch );
 }
 
 
@@ -3490,6 +3628,107 @@ void CClientShadowMgr::AdvanceFrame()
 {
 	// We're starting the next frame
 	m_ShadowAllocator.AdvanceFrame();
+	m_ShadowAllocator.EnableRepartitioning( r_shadowrepartition.GetBool() );
+}
+
+
+//-----------------------------------------------------------------------------
+// Shadow texture allocator stats
+//-----------------------------------------------------------------------------
+static void PrintShadowAllocatorStats( const char *pLabel, const CTextureAllocator &allocator )
+{
+	const CTextureAllocator::AllocatorStats_t &stats = allocator.GetStats();
+	int nRequests = max( stats.m_nRequests, 1 );
+	Msg( "%s: %d requests, %d kept (%.1f%%), %d redrawn (%.1f%%), %d downgraded, %d failed, %d blocks re-split\n",
+		pLabel, stats.m_nRequests,
+		stats.m_nCacheHits, 100.0f * stats.m_nCacheHits / nRequests,
+		stats.m_nRedraws, 100.0f * stats.m_nRedraws / nRequests,
+		stats.m_nDowngrades, stats.m_nFailures, stats.m_nRepartitions );
+}
+
+void CClientShadowMgr::DumpShadowAllocatorStats()
+{
+	PrintShadowAllocatorStats( "Shadow texture allocator", m_ShadowAllocator );
+	m_ShadowAllocator.ClearStats();
+}
+
+CON_COMMAND( r_shadowallocator_stats, "Prints (and resets) shadow texture allocator cache stats" )
+{
+	s_ClientShadowMgr.DumpShadowAllocatorStats();
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs the allocator's caching decisions over a synthetic set of casters.
+// Doesn't touch the render target, so it works without a device.
+//-----------------------------------------------------------------------------
+static void BenchmarkShadowAllocator( CTextureAllocator &allocator, bool bRepartition, int nCasters, int nVisible, int nFrames )
+{
+	CUniformRandomStream stream;
+	stream.SetSeed( 1234 );
+
+	allocator.Reset();
+	allocator.EnableRepartitioning( bRepartition );
+
+	CUtlVector< TextureHandle_t > textures;
+	CUtlVector< float > areas;
+	textures.EnsureCount( nCasters );
+	areas.EnsureCount( nCasters );
+	int i;
+	for ( i = 0; i < nCasters; ++i )
+	{
+		int nSize = 1 << stream.RandomInt( 4, 8 );
+		textures[i] = allocator.AllocateTexture( nSize, nSize );
+		areas[i] = stream.RandomFloat( 64.0f, 256.0f * 256.0f );
+	}
+
+	float *pKeys = (float*)stackalloc( nVisible * sizeof(float) );
+	unsigned int *pOrder = (unsigned int*)stackalloc( nVisible * sizeof(unsigned int) );
+	unsigned int *pScratch = (unsigned int*)stackalloc( RADIXSORT_SCRATCH_SIZE( nVisible ) * sizeof(unsigned int) );
+
+	double flStartTime = Plat_FloatTime();
+	for ( int nFrame = 0; nFrame < nFrames; ++nFrame )
+	{
+		allocator.AdvanceFrame();
+
+		// The camera pans slowly across the casters, and their projected size drifts
+		int nFirst = ( nFrame / 4 ) % nCasters;
+		for ( i = 0; i < nVisible; ++i )
+		{
+			int nCaster = ( nFirst + i ) % nCasters;
+			float flArea = areas[nCaster] * stream.RandomFloat( 0.9f, 1.1f );
+			areas[nCaster] = clamp( flArea, 64.0f, 256.0f * 256.0f );
+			pKeys[i] = -areas[nCaster];
+		}
+		RadixSortFloats( pKeys, nVisible, pOrder, pScratch );
+
+		for ( i = 0; i < nVisible; ++i )
+		{
+			int nCaster = ( nFirst + pOrder[i] ) % nCasters;
+			bool bAnimating = ( stream.RandomInt( 0, 9 ) == 0 );
+			allocator.UseTexture( textures[nCaster], bAnimating, areas[nCaster] );
+		}
+	}
+	double flElapsed = Plat_FloatTime() - flStartTime;
+
+	PrintShadowAllocatorStats( bRepartition ? "Re-split on" : "Re-split off", allocator );
+	Msg( "    %.3f ms total, %.3f us per request\n", flElapsed * 1000.0, flElapsed * 1e6 / max( nFrames * nVisible, 1 ) );
+
+	allocator.DeallocateAllTextures();
+}
+
+CON_COMMAND( r_shadowallocator_benchmark, "Benchmarks shadow texture caching. Arguments: [casters] [visible] [frames]" )
+{
+	int nCasters = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv(1) ) : 256;
+	int nVisible = ( engine->Cmd_Argc() > 2 ) ? atoi( engine->Cmd_Argv(2) ) : 64;
+	int nFrames = ( engine->Cmd_Argc() > 3 ) ? atoi( engine->Cmd_Argv(3) ) : 1000;
+	nCasters = clamp( nCasters, 1, 4096 );
+	nVisible = clamp( nVisible, 1, nCasters );
+	nFrames = max( nFrames, 1 );
+
+	CTextureAllocator allocator;
+	BenchmarkShadowAllocator( allocator, false, nCasters, nVisible, nFrames );
+	BenchmarkShadowAllocator( allocator, true, nCasters, nVisible, nFrames );
 }
 
 
@@ -11,6 +11,7 @@
 #endif
 
 #include "tier1/utllinkedlist.h"
+#include "tier1/mempool.h"
 #include "rangecheckedvar.h"
 #include "lerp_functions.h"
 #include "animationlayer.h"
@@ -172,6 +173,53 @@ public:
 };
 
 
+// -------------------------------------------------------------------------------------------------------------- //
+// CInterpolatedVarHistoryPool - history samples for every CInterpolatedVarArrayBase<Type> with the same array
+// size come from one pool, so the samples for all entities' origins (say) sit together in a few large blobs
+// instead of each NoteChanged() making its own small heap allocation.
+// -------------------------------------------------------------------------------------------------------------- //
+
+template< typename Type >
+class CInterpolatedVarHistoryPool
+{
+public:
+	static Type *Alloc( int nCount )
+	{
+		return (Type *)GetPool( nCount )->Alloc();
+	}
+
+	static void Free( Type *pValue, int nCount )
+	{
+		if ( pValue )
+		{
+			GetPool( nCount )->Free( pValue );
+		}
+	}
+
+private:
+	// Pools live as long as the DLL does; entities with interpolated vars can
+	// outlive any static we'd use to clean them up.
+	static CMemoryPool *GetPool( int nCount )
+	{
+		static CMemoryPool *s_pPools[256];
+		Assert( nCount >= 0 && nCount < 256 );
+
+		// Models with no pose parameters or flex controllers still keep (empty) samples
+		if ( nCount < 1 )
+		{
+			nCount = 1;
+		}
+
+		if ( !s_pPools[nCount] )
+		{
+			MEM_ALLOC_CREDIT_( "CInterpolatedVarHistoryPool" );
+			s_pPools[nCount] = new CMemoryPool( sizeof( Type ) * nCount, 256, CMemoryPool::GROW_SLOW, "CInterpolatedVarHistoryPool" );
+		}
+		return s_pPools[nCount];
+	}
+};
+
+
 // -------------------------------------------------------------------------------------------------------------- //
 // CInterpolatedVarArrayBase - the main implementation of IInterpolatedVar.
 // -------------------------------------------------------------------------------------------------------------- //
@@ -248,6 +296,7 @@ protected:
 	};
 
 	typedef CUtlPtrLinkedList< CInterpolatedVarEntry > CVarHistory;
+	typedef CInterpolatedVarHistoryPool< Type > CHistoryPool;
 	friend class CInterpolationInfo;
 
 	class CInterpolationInfo
@@ -414,7 +463,7 @@ inline void CInterpolatedVarArrayBase<Type>::ClearHistory()
 	CVarHistory::IndexType_t i = m_VarHistory.Head();
 	while ( i != CVarHistory::InvalidIndex() )
 	{
-		delete [] m_VarHistory[i].value;
+		CHistoryPool::Free( m_VarHistory[i].value, m_nMaxCount );
 		i = m_VarHistory.Next( i );
 	}
 	m_VarHistory.RemoveAll();
@@ -438,7 +487,7 @@ inline void CInterpolatedVarArrayBase<Type>::AddToHead( float changeTime, const
 			CInterpolatedVarEntry *check = &m_VarHistory[ insertSpot ];
 			if ( (check->changetime+0.0001f) >= changeTime )
 			{
-				delete [] m_VarHistory[insertSpot].value;
+				CHistoryPool::Free( m_VarHistory[insertSpot].value, m_nMaxCount );
 				m_VarHistory.Remove( insertSpot );
 			}
 			else
@@ -474,7 +523,7 @@ inline void CInterpolatedVarArrayBase<Type>::AddToHead( float changeTime, const
 
 	CInterpolatedVarEntry *e = &m_VarHistory[ newslot ];
 	e->changetime	= changeTime;
-	e->value = new Type[m_nMaxCount];
+	e->value = CHistoryPool::Alloc( m_nMaxCount );
 	memcpy( e->value, values, m_nMaxCount*sizeof(Type) );
 }
 
@@ -526,7 +575,7 @@ inline void CInterpolatedVarArrayBase<Type>::RemoveOldEntries( float oldesttime
 			continue;
 
 		// Unlink rest of chain
-		delete [] m_VarHistory[i].value;
+		CHistoryPool::Free( m_VarHistory[i].value, m_nMaxCount );
 		m_VarHistory.Remove( i );
 	}
 }
@@ -567,7 +616,7 @@ inline void CInterpolatedVarArrayBase<Type>::RemoveEntriesPreviousTo( float flTi
 	for ( ; i != CVarHistory::InvalidIndex(); i=next )
 	{
 		next = m_VarHistory.Next( i );
-		delete [] m_VarHistory[i].value;
+		CHistoryPool::Free( m_VarHistory[i].value, m_nMaxCount );
 		m_VarHistory.Remove( i );
 	}
 }
@@ -891,7 +940,7 @@ inline void CInterpolatedVarArrayBase<Type>::Copy( IInterpolatedVar *pInSrc )
 	m_LastNetworkedTime = pSrc->m_LastNetworkedTime;
 
 	// Copy the entries.
-	m_VarHistory.RemoveAll();
+	ClearHistory();
 
 	CVarHistory::IndexType_t newslot;
 	for ( CVarHistory::IndexType_t srcCur=pSrc->m_VarHistory.Head(); srcCur != CVarHistory::InvalidIndex(); srcCur = pSrc->m_VarHistory.Next( srcCur ) )
@@ -901,7 +950,7 @@ inline void CInterpolatedVarArrayBase<Type>::Copy( IInterpolatedVar *pInSrc )
 		CInterpolatedVarEntry *dest = &m_VarHistory[newslot];
 		CInterpolatedVarEntry *src	= &pSrc->m_VarHistory[srcCur];
 		dest->changetime = src->changetime;
-		dest->value = new Type[m_nMaxCount];
+		dest->value = CHistoryPool::Alloc( m_nMaxCount );
 		memcpy( dest->value, src->value, m_nMaxCount*sizeof(Type) );
 	}
 }
@@ -1016,6 +1065,13 @@ template< typename Type >
 inline void	CInterpolatedVarArrayBase<Type>::SetMaxCount( int newmax )
 {
 	bool changed = ( newmax != m_nMaxCount ) ? true : false;
+
+	// History samples are sized by the old count, so free them before it changes
+	if ( changed )
+	{
+		ClearHistory();
+	}
+
 	m_nMaxCount = newmax;
 	// Wipe everything any time this changes!!!
 	if ( changed )
@@ -68,8 +68,6 @@ private:
 	bool m_bBucketSort;
 	
 	// Output after rendering.
-	float m_MinZ;
-	float m_MaxZ;
 	float m_zCoords[MAX_TOTAL_PARTICLES];
 	int m_nZCoords;
 	
@@ -105,6 +103,10 @@ public:
 	void RemoveParticle( Particle *pParticle );
 	void RemoveAllParticles();
 
+private:
+	// Adds the last particle handed out to the bbox, now that the effect is done with it.
+	void GrowBBoxFromPending();
+
 private:
 	CParticleEffectBinding *m_pEffectBinding;
 	CEffectMaterial *m_pMaterial;
@@ -112,6 +114,17 @@ private:
 
 	bool m_bGotFirst;
 	Particle *m_pNextParticle;
+
+	// Set by CParticleEffectBinding when this pass should also compute the bbox.
+	bool m_bGrowBBox;
+
+	// Output after simulating.
+	bool m_bIteratedAll;		// The effect walked every particle, so m_BBoxMin/Max cover them all
+	bool m_bBBoxSet;
+	Vector m_BBoxMin;
+	Vector m_BBoxMax;
+
+	Particle *m_pPendingBBox;
 };
 
 
@@ -125,8 +138,6 @@ inline CParticleRenderIterator::CParticleRenderIterator()
 	m_bGotFirst = false;
 	m_flPrevZ = 0;
 	m_nParticlesInCurrentBatch = 0;
-	m_MinZ = 1e24;
-	m_MaxZ = -1e24;
 	m_nZCoords = 0;
 }
 
@@ -167,9 +178,6 @@ inline const Particle* CParticleRenderIterator::GetNext( float sortKey )
 	// Update the incremental sort.
 	if( m_bBucketSort )
 	{
-		m_MinZ = min( sortKey, m_MinZ );
-		m_MaxZ = max( sortKey, m_MaxZ );
-		
 		m_zCoords[m_nZCoords] = sortKey;
 		++m_nZCoords;
 	}
@@ -207,6 +215,10 @@ inline ParticleDraw* CParticleRenderIterator::GetParticleDraw() const
 inline CParticleSimulateIterator::CParticleSimulateIterator()
 {
 	m_pNextParticle = NULL;
+	m_bGrowBBox = false;
+	m_bIteratedAll = false;
+	m_bBBoxSet = false;
+	m_pPendingBBox = NULL;
 #ifdef _DEBUG
 	m_bGotFirst = false;
 #endif
@@ -222,31 +234,68 @@ inline Particle* CParticleSimulateIterator::GetFirst()
 	}
 #endif
 
+	// Starting over, so the bbox starts over too.
+	m_bIteratedAll = false;
+	m_bBBoxSet = false;
+	m_pPendingBBox = NULL;
+
 	Particle *pRet = m_pMaterial->m_Particles.m_pNext;
 	if ( pRet == &m_pMaterial->m_Particles )
+	{
+		m_bIteratedAll = true;
 		return NULL;
+	}
 
 #ifdef _DEBUG
 	m_bGotFirst = true;
 #endif
 
 	m_pNextParticle = pRet->m_pNext;
+	m_pPendingBBox = pRet;
 	return pRet;
 }
 
 inline Particle* CParticleSimulateIterator::GetNext()
 {
+	GrowBBoxFromPending();
+
 	Particle *pRet = m_pNextParticle;
 
 	if ( pRet == &m_pMaterial->m_Particles )
+	{
+		m_bIteratedAll = true;
 		return NULL;
+	}
 	
 	m_pNextParticle = pRet->m_pNext;
+	m_pPendingBBox = pRet;
 	return pRet;
 }
 
+inline void CParticleSimulateIterator::GrowBBoxFromPending()
+{
+	if ( !m_bGrowBBox || !m_pPendingBBox )
+		return;
+
+	if ( m_bBBoxSet )
+	{
+		VectorMin( m_BBoxMin, m_pPendingBBox->m_Pos, m_BBoxMin );
+		VectorMax( m_BBoxMax, m_pPendingBBox->m_Pos, m_BBoxMax );
+	}
+	else
+	{
+		m_BBoxMin = m_BBoxMax = m_pPendingBBox->m_Pos;
+		m_bBBoxSet = true;
+	}
+	m_pPendingBBox = NULL;
+}
+
 inline void CParticleSimulateIterator::RemoveParticle( Particle *pParticle )
 {
+	if ( pParticle == m_pPendingBBox )
+	{
+		m_pPendingBBox = NULL;
+	}
 	m_pEffectBinding->RemoveParticle( pParticle );
 }
 
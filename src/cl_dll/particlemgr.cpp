@@ -13,6 +13,7 @@
 #include "materialsystem/imesh.h"
 #include "materialsystem/imaterialvar.h"
 #include "mempool.h"
+#include "radixsort.h"
 #include "IClientMode.h"
 #include "view_scene.h"
 #include "tier0/vprof.h"
@@ -130,6 +131,7 @@ CParticleEffectBinding::CParticleEffectBinding()
 
 	SetParticleCullRadius( 0.0f );
 	m_nActiveParticles = 0;
+	m_bAddedParticlesDuringSimulate = false;
 
 	m_FrameCode = 0;
 	m_ListIndex = 0xFFFF; 
@@ -443,6 +445,7 @@ Particle* CParticleEffectBinding::AddParticle( int sizeInBytes, PMaterialHandle
 		pParticle->m_pSubTexture = &m_pParticleMgr->m_DefaultInvalidSubTexture;
 
 	++m_nActiveParticles;
+	m_bAddedParticlesDuringSimulate = true;
 	return pParticle;
 }
 
@@ -594,11 +597,26 @@ void CParticleEffectBinding::SimulateParticles( float flTimeDelta )
 		simulateIterator.m_pEffectBinding = this;
 		simulateIterator.m_pMaterial = pMaterial;
 		simulateIterator.m_flTimeDelta = flTimeDelta;
+		simulateIterator.m_bGrowBBox = bFullBBoxUpdate && GetAutoUpdateBBox();
 
+		m_bAddedParticlesDuringSimulate = false;
 		m_pSim->SimulateParticles( &simulateIterator );
 
-		// Update the bbox.
-		GrowBBoxFromParticlePositions( pMaterial, bFullBBoxUpdate, bboxSet, bbMin, bbMax );
+		// Update the bbox. The iterator grows it as each particle is finished with, so
+		// only walk the list again if the effect skipped some or added new ones.
+		if ( simulateIterator.m_bGrowBBox && simulateIterator.m_bIteratedAll && !m_bAddedParticlesDuringSimulate )
+		{
+			if ( simulateIterator.m_bBBoxSet )
+			{
+				VectorMin( bbMin, simulateIterator.m_BBoxMin, bbMin );
+				VectorMax( bbMax, simulateIterator.m_BBoxMax, bbMax );
+				bboxSet = true;
+			}
+		}
+		else
+		{
+			GrowBBoxFromParticlePositions( pMaterial, bFullBBoxUpdate, bboxSet, bbMin, bbMax );
+		}
 	}
 
 	BBoxCalcEnd( bFullBBoxUpdate, bboxSet, bbMin, bbMax );
@@ -685,7 +703,7 @@ int CParticleEffectBinding::DrawMaterialParticles(
 
 	if( bBucketSort )
 	{
-		DoBucketSort( pMaterial, renderIterator.m_zCoords, renderIterator.m_nZCoords, renderIterator.m_MinZ, renderIterator.m_MaxZ );
+		DoDepthSort( pMaterial, renderIterator.m_zCoords, renderIterator.m_nZCoords );
 	}
 
 	// Flush out any remaining particles.
@@ -753,57 +771,39 @@ void CParticleEffectBinding::RenderEnd( VMatrix &tempModel, VMatrix &tempView )
 }
 
 
-void CParticleEffectBinding::DoBucketSort( CEffectMaterial *pMaterial, float *zCoords, int nZCoords, float minZ, float maxZ )
+void CParticleEffectBinding::DoDepthSort( CEffectMaterial *pMaterial, float *zCoords, int nZCoords )
 {
-	// Do an O(N) bucket sort. This helps the sort when there are lots of particles.
-	#define NUM_BUCKETS	32
-	Particle buckets[NUM_BUCKETS];
-	for( int iBucket=0; iBucket < NUM_BUCKETS; iBucket++ )
-	{
-		buckets[iBucket].m_pPrev = buckets[iBucket].m_pNext = &buckets[iBucket];
-	}
-	
-	// Sort into buckets.
-	int iCurParticle = 0;
+	if ( nZCoords <= 1 )
+		return;
+
+	Particle **ppParticles = (Particle **)stackalloc( nZCoords * sizeof( Particle * ) );
+	unsigned int *pOrder = (unsigned int *)stackalloc( nZCoords * sizeof( unsigned int ) );
+	unsigned int *pScratch = (unsigned int *)stackalloc( RADIXSORT_SCRATCH_SIZE( nZCoords ) * sizeof( unsigned int ) );
+
+	// Pull out the particles that were rendered, in the order they were rendered.
+	int nParticles = 0;
 	Particle *pNext, *pCur;
 	for( pCur=pMaterial->m_Particles.m_pNext; pCur != &pMaterial->m_Particles; pCur=pNext )
 	{
 		pNext = pCur->m_pNext;
-		if( iCurParticle >= nZCoords )
+		if( nParticles >= nZCoords )
 			break;
 
-		// Remove it..
 		UnlinkParticle( pCur );
-
-		// Add it to the appropriate bucket.
-		float flPercent;
-		if (maxZ == minZ)
-			flPercent = 0;
-		else
-			flPercent = (zCoords[iCurParticle] - minZ) / (maxZ - minZ);
-
-		int iAddBucket = (int)( flPercent * (NUM_BUCKETS - 0.0001f) );
-		iAddBucket = NUM_BUCKETS - iAddBucket - 1;
-		Assert( iAddBucket >= 0 && iAddBucket < NUM_BUCKETS );
-
-		InsertParticleAfter( pCur, &buckets[iAddBucket] );
-
-		++iCurParticle;
+		ppParticles[nParticles] = pCur;
+		pOrder[nParticles] = nParticles;
+		++nParticles;
 	}
 
-	// Put the buckets back into the main list.
-	for( int iReAddBucket=0; iReAddBucket < NUM_BUCKETS; iReAddBucket++ )
+	// That's the order from the last sort plus this frame's incremental swaps, so
+	// it's usually close and an insertion sort fixes it up.
+	SortFloatsCoherent( zCoords, nParticles, pOrder, pScratch );
+
+	// Put them back at the front of the list, nearest z first.
+	for( int i=nParticles-1; i >= 0; i-- )
 	{
-		Particle *pListHead = &buckets[iReAddBucket];
-		for( pCur=pListHead->m_pNext; pCur != pListHead; pCur=pNext )
-		{
-			pNext = pCur->m_pNext;
-			InsertParticleAfter( pCur, &pMaterial->m_Particles );
-			--iCurParticle;
-		}
+		InsertParticleAfter( ppParticles[ pOrder[i] ], &pMaterial->m_Particles );
 	}
-
-	Assert(iCurParticle==0);
 }
 
 
@@ -938,12 +938,19 @@ CParticleMgr::CParticleMgr()
 	
 	m_nCurrentParticlesAllocated = 0;
 
+	// Every particle comes out of one fixed block, so simulating an effect walks
+	// nearby memory instead of whatever the heap handed back
+	m_pParticlePool = new CMemoryPool( PARTICLE_SIZE, MAX_TOTAL_PARTICLES, CMemoryPool::GROW_NONE, "CParticleMgr" );
+
 	SetDefLessFunc( m_effectFactories );
 }
 
 CParticleMgr::~CParticleMgr()
 {
 	Term();
+
+	delete m_pParticlePool;
+	m_pParticlePool = NULL;
 }
 
 
@@ -988,7 +995,7 @@ Particle *CParticleMgr::AllocParticle( int size )
 	if ( m_nCurrentParticlesAllocated >= MAX_TOTAL_PARTICLES )
 		return NULL;
 		
-	Particle *pRet = (Particle *)malloc( size );
+	Particle *pRet = (Particle *)m_pParticlePool->Alloc( size );
 	if ( pRet )
 		++m_nCurrentParticlesAllocated;
 
@@ -999,9 +1006,10 @@ void CParticleMgr::FreeParticle( Particle *pParticle )
 {
 	Assert( m_nCurrentParticlesAllocated > 0 );
 	if ( pParticle )
+	{
 		--m_nCurrentParticlesAllocated;
-	
-	free( pParticle );
+		m_pParticlePool->Free( pParticle );
+	}
 }
 
 
@@ -1397,6 +1405,59 @@ CON_COMMAND( cl_particles_dump_effects, "" )
 {
 	ParticleMgr()->SpewInfo( true );
 }
+
+//-----------------------------------------------------------------------------
+// Times the depth sort on a scene of N particle depths (default 10000): a full
+// radix sort, then the per-frame fix-up after the depths move a little.
+//-----------------------------------------------------------------------------
+CON_COMMAND( cl_particles_sort_benchmark, "Time the particle depth sort. Usage: cl_particles_sort_benchmark [count]" )
+{
+	int nCount = ( engine->Cmd_Argc() >= 2 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10000;
+	if ( nCount <= 0 )
+		return;
+
+	const int nIterations = 100;
+
+	CUtlVector<float> keys;
+	CUtlVector<unsigned int> order, frameOrder, scratch;
+	keys.SetCount( nCount );
+	order.SetCount( nCount );
+	frameOrder.SetCount( nCount );
+	scratch.SetCount( RADIXSORT_SCRATCH_SIZE( nCount ) );
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		keys[i] = random->RandomFloat( 0.0f, 4096.0f );
+	}
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		RadixSortFloats( keys.Base(), nCount, order.Base(), scratch.Base() );
+	}
+	double flRadix = ( Plat_FloatTime() - flStart ) / nIterations;
+
+	// Move every particle a little, as between two frames
+	for ( int i = 0; i < nCount; i++ )
+	{
+		keys[i] += random->RandomFloat( -2.0f, 2.0f );
+	}
+
+	int nFixedUp = 0;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		memcpy( frameOrder.Base(), order.Base(), nCount * sizeof( unsigned int ) );
+		if ( SortFloatsCoherent( keys.Base(), nCount, frameOrder.Base(), scratch.Base() ) )
+		{
+			++nFixedUp;
+		}
+	}
+	double flCoherent = ( Plat_FloatTime() - flStart ) / nIterations;
+
+	Msg( "%d particles: radix sort %.3f ms, next frame fix-up %.3f ms (%d of %d by insertion sort)\n",
+		nCount, flRadix * 1000.0, flCoherent * 1000.0, nFixedUp, nIterations );
+}
 #endif
 
 // ------------------------------------------------------------------------------------ //
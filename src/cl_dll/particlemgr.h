@@ -468,12 +468,10 @@ private:
 	void			BBoxCalcStart( bool bFullBBoxUpdate, Vector &bbMin, Vector &bbMax );
 	void			BBoxCalcEnd( bool bFullBBoxUpdate, bool bboxSet, Vector &bbMin, Vector &bbMax );
 	
-	void			DoBucketSort( 
+	void			DoDepthSort( 
 						CEffectMaterial *pMaterial, 
 						float *zCoords, 
-						int nZCoords,
-						float minZ,
-						float maxZ );
+						int nZCoords );
 
 	int				GetRemovalInProgressFlag()					{ return GetFlag( FLAGS_REMOVALINPROGRESS ); }
 	void			SetRemovalInProgressFlag()					{ SetFlag( FLAGS_REMOVALINPROGRESS, 1 ); }
@@ -548,6 +546,9 @@ private:
 	// Number of active particles.
 	unsigned short					m_nActiveParticles;
 
+	// Set by AddParticle so SimulateParticles knows the simulate iterator's bbox missed some.
+	bool							m_bAddedParticlesDuringSimulate;
+
 	// See CParticleMgr::m_FrameCode.
 	unsigned short					m_FrameCode;
 
@@ -662,6 +663,7 @@ private:
 private:
 
 	int m_nCurrentParticlesAllocated;
+	CMemoryPool *m_pParticlePool;
 
 	// Directional lighting info.
 	CParticleLightInfo m_DirectionalLight;
@@ -46,6 +46,7 @@
 #include "ienginevgui.h"
 #include "datacache/imdlcache.h"
 #include "ScreenSpaceEffects.h"
+#include "radixsort.h"
 
 #if defined( HL2_CLIENT_DLL ) || defined( CSTRIKE_DLL )
 #define USE_MONITORS
@@ -498,30 +499,22 @@ void SortEntities( CRenderList::CEntry *pEntities, int nEntities )
 		dists[i] = DotProduct( delta, vecRenderForward );
 	}
 
-	// H-sort.
-	int stepSize = 4;
-	while( stepSize )
+	// Leaf lists keep their order from frame to frame, so start from the order the
+	// entities came in; that's usually close to sorted already.
+	unsigned int *pOrder = (unsigned int *)stackalloc( nEntities * sizeof( unsigned int ) );
+	unsigned int *pScratch = (unsigned int *)stackalloc( RADIXSORT_SCRATCH_SIZE( nEntities ) * sizeof( unsigned int ) );
+	for( i=0; i < nEntities; i++ )
 	{
-		int end = nEntities - stepSize;
-		for( i=0; i < end; i += stepSize )
-		{
-			if( dists[i] > dists[i+stepSize] )
-			{
-				swap( pEntities[i], pEntities[i+stepSize] );
-				swap( dists[i], dists[i+stepSize] );
+		pOrder[i] = i;
+	}
 
-				if( i == 0 )
-				{
-					i = -stepSize;
-				}
-				else
-				{
-					i -= stepSize << 1;
-				}
-			}
-		}
+	SortFloatsCoherent( dists, nEntities, pOrder, pScratch );
 
-		stepSize >>= 1;
+	CRenderList::CEntry *pUnsorted = (CRenderList::CEntry *)stackalloc( nEntities * sizeof( CRenderList::CEntry ) );
+	memcpy( pUnsorted, pEntities, nEntities * sizeof( CRenderList::CEntry ) );
+	for( i=0; i < nEntities; i++ )
+	{
+		pEntities[i] = pUnsorted[ pOrder[i] ];
 	}
 }
 
@@ -901,6 +894,45 @@ void CViewRender::BuildRenderableRenderLists( const CViewSetup *pView, ClientWor
 	}
 	
 	SetupRenderList( pView, info, renderList );
+
+	if( ShouldDrawEntities() )
+	{
+		SetupBonesForRenderList( renderList );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Sets up bones for every animating entity in the list before any of them draw
+//-----------------------------------------------------------------------------
+static void GatherAnimatingInRenderGroup( CRenderList &renderList, RenderGroup_t group, C_BaseAnimating **ppAnimating, int &nCount )
+{
+	CRenderList::CEntry *pEntities = renderList.m_RenderGroups[group];
+	int nEntities = renderList.m_RenderGroupCounts[group];
+	for( int i=0; i < nEntities; ++i )
+	{
+		C_BaseEntity *pEntity = pEntities[i].m_pRenderable->GetIClientUnknown()->GetBaseEntity();
+		C_BaseAnimating *pAnimating = pEntity ? pEntity->GetBaseAnimating() : NULL;
+		if ( pAnimating )
+		{
+			ppAnimating[nCount++] = pAnimating;
+		}
+	}
+}
+
+void CViewRender::SetupBonesForRenderList( CRenderList &renderList )
+{
+	int nMaxCount = renderList.m_RenderGroupCounts[RENDER_GROUP_OPAQUE_ENTITY] + renderList.m_RenderGroupCounts[RENDER_GROUP_TRANSLUCENT_ENTITY];
+	if ( !nMaxCount )
+		return;
+
+	C_BaseAnimating **ppAnimating = (C_BaseAnimating **)stackalloc( nMaxCount * sizeof(C_BaseAnimating *) );
+	int nCount = 0;
+	GatherAnimatingInRenderGroup( renderList, RENDER_GROUP_OPAQUE_ENTITY, ppAnimating, nCount );
+	GatherAnimatingInRenderGroup( renderList, RENDER_GROUP_TRANSLUCENT_ENTITY, ppAnimating, nCount );
+
+	C_BaseAnimating::SetupBonesForEntities( ppAnimating, nCount );
+	stackfree( ppAnimating );
 }
 
 
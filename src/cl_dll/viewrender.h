@@ -190,6 +190,7 @@ private:
 	float			CalcRoll (const QAngle& angles, const Vector& velocity, float rollangle, float rollspeed);
 
 	void			SetupRenderList( const CViewSetup *pView, ClientWorldListInfo_t& info, CRenderList &renderList );
+	void			SetupBonesForRenderList( CRenderList &renderList );
 
 	// General draw methods
 	// baseDrawFlags is a combination of DF_ defines. DF_MONITOR is passed into here while drawing a monitor.
@@ -91,6 +91,7 @@
 
 #include "env_debughistory.h"
 #include "collisionutils.h"
+#include "trigger_broadphase.h"
 
 extern ConVar sk_healthkit;
 
@@ -1293,6 +1294,9 @@ void CBaseEntity::TraceAttackToTriggers( const CTakeDamageInfo &info, const Vect
 
 	CTriggerTraceEnum triggerTraceEnum( &ray, info, dir, MASK_SHOT );
 	enginetrace->EnumerateEntities( ray, true, &triggerTraceEnum );
+
+	// Static triggers aren't in the engine's trigger list
+	g_TriggerBroadphase.EnumerateAlongRay( ray, &triggerTraceEnum );
 }
 
 //-----------------------------------------------------------------------------
@@ -11115,6 +11119,7 @@ CAI_BaseNPC::CAI_BaseNPC(void)
 CAI_BaseNPC::~CAI_BaseNPC(void)
 {
 	g_AI_Manager.RemoveAI( this );
+	g_AI_RouteRequestQueue.RemoveNPC( this );
 
 	delete m_pLockedBestSound;
 
@@ -23,6 +23,7 @@
 #include "ai_hint.h"
 #include "ai_memory.h"
 #include "ai_navigator.h"
+#include "ai_pathfinder.h"
 #include "ai_tacticalservices.h"
 #include "ai_moveprobe.h"
 #include "ai_squadslot.h"
@@ -594,6 +595,13 @@ void CAI_BaseNPC::MaintainSchedule ( void )
 			return;
 		}
 		
+		// If this tick's route budget is spent, leave the task pending and start it on a later think
+		bool bRouteTask = ( GetTaskStatus() == TASKSTATUS_NEW && CAI_RouteRequestQueue::IsRouteTask( GetTask()->iTask ) );
+		if ( bRouteTask && !g_AI_RouteRequestQueue.BeginRequest( this ) )
+		{
+			break;
+		}
+
 		AI_PROFILE_SCOPE_BEGIN_( CAI_BaseNPC::GetSchedulingSymbols()->ScheduleIdToSymbol( GetCurSchedule()->GetId() ) );
 
 		if ( GetTaskStatus() == TASKSTATUS_NEW )
@@ -626,8 +634,18 @@ void CAI_BaseNPC::MaintainSchedule ( void )
 			AI_PROFILE_SCOPE_BEGIN_( pszTaskName );
 			AI_PROFILE_SCOPE_BEGIN(CAI_BaseNPC_StartTask);
 
+			CFastTimer routeTimer;
+			if ( bRouteTask )
+				routeTimer.Start();
+
 			StartTask( pTask );
 
+			if ( bRouteTask )
+			{
+				routeTimer.End();
+				g_AI_RouteRequestQueue.EndRequest( routeTimer.GetDuration().GetMicrosecondsF() );
+			}
+
 			AI_PROFILE_SCOPE_END();
 			AI_PROFILE_SCOPE_END();
 
@@ -14,33 +14,127 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
 
+// Criteria names have always matched case insensitively
+static CUtlSymbolTable g_CriteriaSymbols( 0, 128, true );
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
-AI_CriteriaSet::AI_CriteriaSet() : m_Lookup( 0, 0, CritEntry_t::LessFunc )
+AI_CriteriaSet::AI_CriteriaSet()
 {
+	m_pEntries = m_InlineEntries;
+	m_nEntries = 0;
+	m_nMaxEntries = NUM_INLINE_CRITERIA;
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : src - 
 //-----------------------------------------------------------------------------
-AI_CriteriaSet::AI_CriteriaSet( const AI_CriteriaSet& src ) : m_Lookup( 0, 0, CritEntry_t::LessFunc )
+AI_CriteriaSet::AI_CriteriaSet( const AI_CriteriaSet& src )
 {
-	m_Lookup.Purge();
-	for ( short i = src.m_Lookup.FirstInorder(); 
-		i != src.m_Lookup.InvalidIndex(); 
-		i = src.m_Lookup.NextInorder( i ) )
+	m_pEntries = m_InlineEntries;
+	m_nEntries = 0;
+	m_nMaxEntries = NUM_INLINE_CRITERIA;
+
+	*this = src;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+AI_CriteriaSet::~AI_CriteriaSet()
+{
+	if ( m_pEntries != m_InlineEntries )
 	{
-		m_Lookup.Insert( src.m_Lookup[ i ] );
+		delete[] m_pEntries;
 	}
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
-AI_CriteriaSet::~AI_CriteriaSet()
+AI_CriteriaSet& AI_CriteriaSet::operator=( const AI_CriteriaSet& src )
+{
+	if ( this == &src )
+		return *this;
+
+	EnsureCapacity( src.m_nEntries );
+	memcpy( m_pEntries, src.m_pEntries, src.m_nEntries * sizeof( CritEntry_t ) );
+	m_nEntries = src.m_nEntries;
+	return *this;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+UtlSymId_t AI_CriteriaSet::ComputeCriteriaSymbol( const char *criteria )
+{
+	return g_CriteriaSymbols.AddString( criteria );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Grows the entry storage off the inline buffer if it needs to
+//-----------------------------------------------------------------------------
+void AI_CriteriaSet::EnsureCapacity( int count )
+{
+	if ( count <= m_nMaxEntries )
+		return;
+
+	int nNewMax = m_nMaxEntries * 2;
+	while ( nNewMax < count )
+	{
+		nNewMax *= 2;
+	}
+
+	MEM_ALLOC_CREDIT();
+	CritEntry_t *pNewEntries = new CritEntry_t[ nNewMax ];
+	memcpy( pNewEntries, m_pEntries, m_nEntries * sizeof( CritEntry_t ) );
+	if ( m_pEntries != m_InlineEntries )
+	{
+		delete[] m_pEntries;
+	}
+
+	m_pEntries = pNewEntries;
+	m_nMaxEntries = nNewMax;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the first entry whose symbol is >= name
+//-----------------------------------------------------------------------------
+int AI_CriteriaSet::FindInsertionIndex( UtlSymId_t name ) const
+{
+	int lo = 0;
+	int hi = m_nEntries;
+	while ( lo < hi )
+	{
+		int mid = ( lo + hi ) >> 1;
+		if ( m_pEntries[ mid ].criterianame < name )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+AI_CriteriaSet::CritEntry_t *AI_CriteriaSet::InsertEntry( int index, UtlSymId_t name )
 {
+	EnsureCapacity( m_nEntries + 1 );
+
+	memmove( &m_pEntries[ index + 1 ], &m_pEntries[ index ], ( m_nEntries - index ) * sizeof( CritEntry_t ) );
+	++m_nEntries;
+
+	CritEntry_t *entry = &m_pEntries[ index ];
+	entry->criterianame = name;
+	return entry;
 }
 
 //-----------------------------------------------------------------------------
@@ -51,16 +145,22 @@ AI_CriteriaSet::~AI_CriteriaSet()
 //-----------------------------------------------------------------------------
 void AI_CriteriaSet::AppendCriteria( const char *criteria, const char *value /*= ""*/, float weight /*= 1.0f*/ )
 {
-	int idx = FindCriterionIndex( criteria );
-	if ( idx == -1 )
+	AppendCriteria( ComputeCriteriaSymbol( criteria ), value, weight );
+}
+
+void AI_CriteriaSet::AppendCriteria( UtlSymId_t criteria, const char *value /*= ""*/, float weight /*= 1.0f*/ )
+{
+	int idx = FindInsertionIndex( criteria );
+
+	CritEntry_t *entry;
+	if ( idx < m_nEntries && m_pEntries[ idx ].criterianame == criteria )
 	{
-		CritEntry_t entry;
-		entry.criterianame = criteria;
-		MEM_ALLOC_CREDIT();
-		idx = m_Lookup.Insert( entry );
+		entry = &m_pEntries[ idx ];
+	}
+	else
+	{
+		entry = InsertEntry( idx, criteria );
 	}
-
-	CritEntry_t *entry = &m_Lookup[ idx ];
 
 	entry->SetValue( value );
 	entry->weight = weight;
@@ -76,7 +176,73 @@ void AI_CriteriaSet::RemoveCriteria( const char *criteria )
 	if ( idx == -1 )
 		return;
 
-	m_Lookup.RemoveAt( idx );
+	memmove( &m_pEntries[ idx ], &m_pEntries[ idx + 1 ], ( m_nEntries - idx - 1 ) * sizeof( CritEntry_t ) );
+	--m_nEntries;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Both sets are sorted, so this is a single merge pass. Entries in src
+//  override ones already here, just as if they'd been appended one at a time.
+//-----------------------------------------------------------------------------
+void AI_CriteriaSet::Merge( const AI_CriteriaSet& src )
+{
+	if ( !src.m_nEntries )
+		return;
+
+	// Count what's new so everything only moves once
+	int nNew = 0;
+	int i = 0;
+	int j = 0;
+	while ( j < src.m_nEntries )
+	{
+		if ( i >= m_nEntries || src.m_pEntries[ j ].criterianame < m_pEntries[ i ].criterianame )
+		{
+			++nNew;
+			++j;
+		}
+		else if ( m_pEntries[ i ].criterianame < src.m_pEntries[ j ].criterianame )
+		{
+			++i;
+		}
+		else
+		{
+			++i;
+			++j;
+		}
+	}
+
+	EnsureCapacity( m_nEntries + nNew );
+
+	// Merge from the back so nothing is overwritten before it's moved
+	int nDest = m_nEntries + nNew;
+	i = m_nEntries - 1;
+	j = src.m_nEntries - 1;
+	while ( j >= 0 )
+	{
+		--nDest;
+		if ( i >= 0 && m_pEntries[ i ].criterianame > src.m_pEntries[ j ].criterianame )
+		{
+			m_pEntries[ nDest ] = m_pEntries[ i-- ];
+		}
+		else
+		{
+			if ( i >= 0 && m_pEntries[ i ].criterianame == src.m_pEntries[ j ].criterianame )
+			{
+				--i;
+			}
+			m_pEntries[ nDest ] = src.m_pEntries[ j-- ];
+		}
+	}
+
+	m_nEntries += nNew;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void AI_CriteriaSet::RemoveAll()
+{
+	m_nEntries = 0;
 }
 
 
@@ -86,7 +252,7 @@ void AI_CriteriaSet::RemoveCriteria( const char *criteria )
 //-----------------------------------------------------------------------------
 int AI_CriteriaSet::GetCount() const
 {
-	return m_Lookup.Count();
+	return m_nEntries;
 }
 
 //-----------------------------------------------------------------------------
@@ -96,10 +262,18 @@ int AI_CriteriaSet::GetCount() const
 //-----------------------------------------------------------------------------
 int AI_CriteriaSet::FindCriterionIndex( const char *name ) const
 {
-	CritEntry_t search;
-	search.criterianame = name;
-	int idx = m_Lookup.Find( search );
-	if ( idx == m_Lookup.InvalidIndex() )
+	// Don't intern names nobody has ever set
+	CUtlSymbol sym = g_CriteriaSymbols.Find( name );
+	if ( !sym.IsValid() )
+		return -1;
+
+	return FindCriterionIndex( (UtlSymId_t)sym );
+}
+
+int AI_CriteriaSet::FindCriterionIndex( UtlSymId_t name ) const
+{
+	int idx = FindInsertionIndex( name );
+	if ( idx >= m_nEntries || m_pEntries[ idx ].criterianame != name )
 		return -1;
 
 	return idx;
@@ -112,13 +286,10 @@ int AI_CriteriaSet::FindCriterionIndex( const char *name ) const
 //-----------------------------------------------------------------------------
 const char *AI_CriteriaSet::GetName( int index ) const
 {
-	static char namebuf[ 128 ];
-	if ( index < 0 || index >= (int)m_Lookup.Count() )
+	if ( index < 0 || index >= m_nEntries )
 		return "";
 
-	const CritEntry_t *entry = &m_Lookup[ index ];
-	Q_strncpy( namebuf, entry->criterianame.String(), sizeof( namebuf ) );
-	return namebuf;
+	return g_CriteriaSymbols.String( m_pEntries[ index ].criterianame );
 }
 
 //-----------------------------------------------------------------------------
@@ -128,11 +299,10 @@ const char *AI_CriteriaSet::GetName( int index ) const
 //-----------------------------------------------------------------------------
 const char *AI_CriteriaSet::GetValue( int index ) const
 {
-	if ( index < 0 || index >= (int)m_Lookup.Count() )
+	if ( index < 0 || index >= m_nEntries )
 		return "";
 
-	const CritEntry_t *entry = &m_Lookup[ index ];
-	return entry->value ? entry->value : "";
+	return m_pEntries[ index ].value;
 }
 
 //-----------------------------------------------------------------------------
@@ -142,11 +312,10 @@ const char *AI_CriteriaSet::GetValue( int index ) const
 //-----------------------------------------------------------------------------
 float AI_CriteriaSet::GetWeight( int index ) const
 {
-	if ( index < 0 || index >= (int)m_Lookup.Count() )
+	if ( index < 0 || index >= m_nEntries )
 		return 1.0f;
 
-	const CritEntry_t *entry = &m_Lookup[ index ];
-	return entry->weight;
+	return m_pEntries[ index ].weight;
 }
 
 //-----------------------------------------------------------------------------
@@ -154,18 +323,17 @@ float AI_CriteriaSet::GetWeight( int index ) const
 //-----------------------------------------------------------------------------
 void AI_CriteriaSet::Describe()
 {
-	for ( short i = m_Lookup.FirstInorder(); i != m_Lookup.InvalidIndex(); i = m_Lookup.NextInorder( i ) )
+	for ( int i = 0; i < m_nEntries; i++ )
 	{
-
-		CritEntry_t *entry = &m_Lookup[ i ];
+		CritEntry_t *entry = &m_pEntries[ i ];
 
 		if ( entry->weight != 1.0f )
 		{
-			DevMsg( "  %20s = '%s' (weight %f)\n", entry->criterianame.String(), entry->value ? entry->value : "", entry->weight );
+			DevMsg( "  %20s = '%s' (weight %f)\n", GetName( i ), entry->value, entry->weight );
 		}
 		else
 		{
-			DevMsg( "  %20s = '%s'\n", entry->criterianame.String(), entry->value ? entry->value : "" );
+			DevMsg( "  %20s = '%s'\n", GetName( i ), entry->value );
 		}
 	}
 }
@@ -18,6 +18,12 @@
 extern const char *SplitContext( const char *raw, char *key, int keylen, char *value, int valuelen, float *duration );
 
 
+//-----------------------------------------------------------------------------
+// Purpose: The criteria a speaker hands the response system. Names are interned
+//  (case insensitively) and entries are kept sorted by symbol, so lookups are a
+//  binary search over integers. The first few entries live inside the set itself,
+//  so building one on the stack doesn't touch the heap.
+//-----------------------------------------------------------------------------
 class AI_CriteriaSet
 {
 public:
@@ -25,13 +31,25 @@ public:
 	AI_CriteriaSet( const AI_CriteriaSet& src );
 	~AI_CriteriaSet();
 
+	AI_CriteriaSet& operator=( const AI_CriteriaSet& src );
+
+	// Callers that look the same name up repeatedly can intern it once
+	static UtlSymId_t ComputeCriteriaSymbol( const char *criteria );
+
 	void AppendCriteria( const char *criteria, const char *value = "", float weight = 1.0f );
+	void AppendCriteria( UtlSymId_t criteria, const char *value = "", float weight = 1.0f );
 	void RemoveCriteria( const char *criteria );
+
+	// Appends (or overrides with) every criterion in src
+	void Merge( const AI_CriteriaSet& src );
+
+	void RemoveAll();
 	
 	void Describe();
 
 	int GetCount() const;
 	int			FindCriterionIndex( const char *name ) const;
+	int			FindCriterionIndex( UtlSymId_t name ) const;
 
 	const char *GetName( int index ) const;
 	const char *GetValue( int index ) const;
@@ -41,38 +59,6 @@ private:
 
 	struct CritEntry_t
 	{
-		CritEntry_t() :
-				criterianame( UTL_INVAL_SYMBOL ),
-				weight( 0.0f )
-		{
-			value[ 0 ] = 0;
-		}
-
-		CritEntry_t( const CritEntry_t& src )
-		{
-			criterianame = src.criterianame;
-			value[ 0 ] = 0;
-			weight = src.weight;
-			SetValue( src.value );
-		}
-
-		CritEntry_t& operator=( const CritEntry_t& src )
-		{
-			if ( this == &src )
-				return *this;
-
-			criterianame = src.criterianame;
-			weight = src.weight;
-			SetValue( src.value );
-
-			return *this;
-		}
-
-		static bool LessFunc( const CritEntry_t& lhs, const CritEntry_t& rhs )
-		{
-			return Q_stricmp( lhs.criterianame.String(), rhs.criterianame.String() ) < 0 ? true : false;
-		}
-
 		void SetValue( char const *str )
 		{
 			if ( !str )
@@ -85,12 +71,24 @@ private:
 			}
 		}
 				
-		CUtlSymbol criterianame;
-		char		value[ 64 ];
+		UtlSymId_t	criterianame;
 		float		weight;
+		char		value[ 64 ];
+	};
+
+	enum
+	{
+		NUM_INLINE_CRITERIA = 32,
 	};
 
-	CUtlRBTree< CritEntry_t, short > m_Lookup;
+	int			FindInsertionIndex( UtlSymId_t name ) const;
+	CritEntry_t	*InsertEntry( int index, UtlSymId_t name );
+	void		EnsureCapacity( int count );
+
+	CritEntry_t	*m_pEntries;		// Sorted by symbol, points at m_InlineEntries until it overflows
+	int			m_nEntries;
+	int			m_nMaxEntries;
+	CritEntry_t	m_InlineEntries[ NUM_INLINE_CRITERIA ];
 };
 
 #pragma pack(1)
@@ -273,6 +273,8 @@ void CAI_DynamicLink::InitDynamicLinks(void)
 
 	if ( bUpdateZones )
 	{
+		// Accepted move types changed, so the grid's per-node hull masks are stale
+		g_pBigAINet->InvalidateNodeGrid();
 		g_AINetworkBuilder.InitZones( g_pBigAINet );
 	}
 }
@@ -21,6 +21,7 @@
 #include "tier0/memdbgon.h"
 
 ConVar ai_no_node_cache( "ai_no_node_cache", "0" );
+ConVar ai_node_grid( "ai_node_grid", "1", 0, "Use the node grid to find nearby nodes instead of scanning the whole network" );
 
 extern float MOVE_HEIGHT_EPSILON;
 
@@ -38,6 +39,7 @@ abstract_class INodeListFilter
 public:
 	virtual bool	NodeIsValid( CAI_Node &node ) = 0;
 	virtual float	NodeDistanceSqr( CAI_Node &node ) = 0;
+	virtual int		NodeHull() = 0;
 };
 
 //-------------------------------------
@@ -47,13 +49,16 @@ public:
 class CNodeFilter : public INodeListFilter
 {
 public:
-	CNodeFilter( CAI_BaseNPC *pNPC, const Vector &pos ) : m_pNPC(pNPC), m_pos(pos) 
+	CNodeFilter( CAI_BaseNPC *pNPC, const Vector &pos ) : m_pNPC(pNPC), m_pos(pos), m_hull(HULL_NONE)
 	{
 		if ( m_pNPC )
+		{
 			m_capabilities = m_pNPC->CapabilitiesGet();
+			m_hull = m_pNPC->GetHullType();
+		}
 	}
 
-	CNodeFilter( const Vector &pos ) : m_pNPC(NULL), m_pos(pos) 
+	CNodeFilter( const Vector &pos, int hull = HULL_NONE ) : m_pNPC(NULL), m_pos(pos), m_hull(hull)
 	{
 	}
 
@@ -89,9 +94,15 @@ public:
 			return (node.GetOrigin() - m_pos).LengthSqr();
 	}
 
+	virtual int		NodeHull()
+	{
+		return m_hull;
+	}
+
 	const Vector &m_pos;
 	CAI_BaseNPC	*m_pNPC;
 	int			m_capabilities;	// cache this
+	int			m_hull;
 };
 
 //-----------------------------------------------------------------------------
@@ -117,6 +128,13 @@ CAI_Network::CAI_Network()
 		m_NearestCache[node].expiration	= FLT_MIN;
 	}
 
+	m_bNodeGridDirty			= true;
+	m_vNodeGridMins.Init();
+	m_flNodeGridCellSize		= NODE_GRID_CELL_SIZE;
+	m_nNodeGridDimX				= 0;
+	m_nNodeGridDimY				= 0;
+	m_flNodeGridMaxPosOffset	= 0;
+
 #ifdef AI_NODE_TREE
 	m_pNodeTree = NULL;
 #endif
@@ -190,6 +208,28 @@ int	CAI_Network::FindBSSmallest(CBitString *bitString, float *float_array, int a
 	return winIndex;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Hulls accepted by at least one of the node's links (0 if it has none)
+//-----------------------------------------------------------------------------
+
+static unsigned short NodeLinkHullMask( CAI_Node *pNode )
+{
+	unsigned short hullMask = 0;
+	for ( int link = 0; link < pNode->NumLinks(); link++ )
+	{
+		CAI_Link *pLink = pNode->GetLinkByIndex( link );
+		if ( !pLink )
+			continue;
+
+		for ( int hull = HULL_HUMAN; hull < NUM_HULLS; hull++ )
+		{
+			if ( pLink->m_iAcceptedMoveTypes[hull] )
+				hullMask |= ( 1 << hull );
+		}
+	}
+	return hullMask;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a list of nearby nodes sorted by distance
 // Input  : &list - 
@@ -198,7 +238,7 @@ int	CAI_Network::FindBSSmallest(CBitString *bitString, float *float_array, int a
 // Output : int - count of list
 //-----------------------------------------------------------------------------
 
-int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector &mins, const Vector &maxs, INodeListFilter *pFilter )
+int CAI_Network::ListNodesInBoxLinear( CNodeList &list, int maxListCount, const Vector &mins, const Vector &maxs, INodeListFilter *pFilter )
 {
 	CNodeList result;
 	
@@ -209,6 +249,9 @@ int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector
 	float flClosest = 1000000.0 * 1000000;
 	int closest = 0;
 
+	int hull = pFilter->NodeHull();
+	unsigned short hullBit = ( hull >= 0 && hull < NUM_HULLS ) ? ( 1 << hull ) : 0;
+
 // UNDONE: Store the nodes in a tree and query the tree instead of the entire list!!!
 	for ( int node = 0; node < m_iNumNodes; node++ )
 	{
@@ -220,6 +263,14 @@ int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector
 			 origin.z < mins.z || origin.z > maxs.z )
 			continue;
 
+		// Skip nodes whose links can't be used by this hull (same test as the node grid)
+		if ( hullBit )
+		{
+			unsigned short hullMask = NodeLinkHullMask( pNode );
+			if ( hullMask && !( hullMask & hullBit ) )
+				continue;
+		}
+
 		if ( !pFilter->NodeIsValid(*pNode) )
 			continue;
 
@@ -252,6 +303,300 @@ int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector
 	return list.Count();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Build the grid used to find nodes near a point. Nodes are bucketed
+//			by the XY cell containing their origin (counting sort, so the
+//			entries of a cell are contiguous).
+//-----------------------------------------------------------------------------
+
+void CAI_Network::BuildNodeGrid()
+{
+	m_bNodeGridDirty = false;
+
+	m_NodeGridCellStart.RemoveAll();
+	m_NodeGridEntries.RemoveAll();
+	m_nNodeGridDimX = m_nNodeGridDimY = 0;
+	m_flNodeGridMaxPosOffset = 0;
+
+	if ( !m_iNumNodes )
+		return;
+
+	Vector2D vecMins( FLT_MAX, FLT_MAX );
+	Vector2D vecMaxs( -FLT_MAX, -FLT_MAX );
+
+	int node;
+	for ( node = 0; node < m_iNumNodes; node++ )
+	{
+		CAI_Node *pNode = m_pAInode[node];
+		const Vector &origin = pNode->GetOrigin();
+
+		vecMins.x = min( vecMins.x, origin.x );
+		vecMins.y = min( vecMins.y, origin.y );
+		vecMaxs.x = max( vecMaxs.x, origin.x );
+		vecMaxs.y = max( vecMaxs.y, origin.y );
+
+		// Distances are measured to the hull position, which may be offset from the origin
+		for ( int hull = HULL_HUMAN; hull < NUM_HULLS; hull++ )
+		{
+			float flOffset = ( pNode->GetPosition( hull ) - origin ).Length();
+			m_flNodeGridMaxPosOffset = max( m_flNodeGridMaxPosOffset, flOffset );
+		}
+	}
+
+	// Grow the cells on very large maps so the grid stays small
+	float flExtent = max( vecMaxs.x - vecMins.x, vecMaxs.y - vecMins.y );
+	m_flNodeGridCellSize = max( (float)NODE_GRID_CELL_SIZE, flExtent / ( NODE_GRID_MAX_DIM - 1 ) );
+	m_vNodeGridMins = vecMins;
+	m_nNodeGridDimX = (int)( ( vecMaxs.x - vecMins.x ) / m_flNodeGridCellSize ) + 1;
+	m_nNodeGridDimY = (int)( ( vecMaxs.y - vecMins.y ) / m_flNodeGridCellSize ) + 1;
+
+	int nCells = m_nNodeGridDimX * m_nNodeGridDimY;
+	m_NodeGridCellStart.SetCount( nCells + 1 );
+	memset( m_NodeGridCellStart.Base(), 0, sizeof(int) * ( nCells + 1 ) );
+
+	CUtlVector<int> nodeCell;
+	nodeCell.SetCount( m_iNumNodes );
+	for ( node = 0; node < m_iNumNodes; node++ )
+	{
+		const Vector &origin = m_pAInode[node]->GetOrigin();
+		nodeCell[node] = NodeGridCellY( origin.y ) * m_nNodeGridDimX + NodeGridCellX( origin.x );
+		m_NodeGridCellStart[ nodeCell[node] + 1 ]++;
+	}
+
+	int cell;
+	for ( cell = 0; cell < nCells; cell++ )
+	{
+		m_NodeGridCellStart[cell + 1] += m_NodeGridCellStart[cell];
+	}
+
+	CUtlVector<int> cellFill;
+	cellFill.CopyArray( m_NodeGridCellStart.Base(), nCells );
+
+	m_NodeGridEntries.SetCount( m_iNumNodes );
+	for ( node = 0; node < m_iNumNodes; node++ )
+	{
+		CAI_Node *pNode = m_pAInode[node];
+
+		NodeGridEntry_t &entry = m_NodeGridEntries[ cellFill[ nodeCell[node] ]++ ];
+		entry.origin	= pNode->GetOrigin();
+		entry.nodeIndex	= node;
+		entry.hullMask	= NodeLinkHullMask( pNode );
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+int CAI_Network::NodeGridCellX( float x ) const
+{
+	int cell = (int)( ( x - m_vNodeGridMins.x ) / m_flNodeGridCellSize );
+	return clamp( cell, 0, m_nNodeGridDimX - 1 );
+}
+
+int CAI_Network::NodeGridCellY( float y ) const
+{
+	int cell = (int)( ( y - m_vNodeGridMins.y ) / m_flNodeGridCellSize );
+	return clamp( cell, 0, m_nNodeGridDimY - 1 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Build a list of nearby nodes sorted by distance, using the node grid.
+//			Cells are visited in rings around the center of the box, and the
+//			search stops as soon as no unvisited ring can hold a node closer
+//			than the ones already found.
+//-----------------------------------------------------------------------------
+
+int CAI_Network::ListNodesInBox( CNodeList &list, int maxListCount, const Vector &mins, const Vector &maxs, INodeListFilter *pFilter )
+{
+	if ( !ai_node_grid.GetBool() )
+		return ListNodesInBoxLinear( list, maxListCount, mins, maxs, pFilter );
+
+	if ( m_bNodeGridDirty )
+		BuildNodeGrid();
+
+	list.RemoveAll();
+	if ( !m_NodeGridEntries.Count() )
+		return 0;
+
+	CNodeList result;
+	result.SetLessFunc( CNodeList::RevIsLowerPriority );
+
+	// NOTE: maxListCount must be > 0 or this will crash
+	bool full = false;
+
+	int hull = pFilter->NodeHull();
+	unsigned short hullBit = ( hull >= 0 && hull < NUM_HULLS ) ? ( 1 << hull ) : 0;
+
+	Vector center = ( mins + maxs ) * 0.5;
+	int cx = NodeGridCellX( center.x );
+	int cy = NodeGridCellY( center.y );
+	int x0 = NodeGridCellX( mins.x );
+	int x1 = NodeGridCellX( maxs.x );
+	int y0 = NodeGridCellY( mins.y );
+	int y1 = NodeGridCellY( maxs.y );
+
+	// Distance from the center to the edge of its own cell, the start of ring 1
+	float cellMinX = m_vNodeGridMins.x + cx * m_flNodeGridCellSize;
+	float cellMinY = m_vNodeGridMins.y + cy * m_flNodeGridCellSize;
+	float flEdgeDist = min( min( center.x - cellMinX, cellMinX + m_flNodeGridCellSize - center.x ),
+							min( center.y - cellMinY, cellMinY + m_flNodeGridCellSize - center.y ) );
+
+	int maxRing = max( max( cx - x0, x1 - cx ), max( cy - y0, y1 - cy ) );
+
+	for ( int ring = 0; ring <= maxRing; ring++ )
+	{
+		if ( full && ring > 0 )
+		{
+			float flRingDist = flEdgeDist + ( ring - 1 ) * m_flNodeGridCellSize - m_flNodeGridMaxPosOffset;
+			if ( flRingDist > 0 && Square( flRingDist ) > result.ElementAtHead().dist )
+				break;
+		}
+
+		for ( int iy = cy - ring; iy <= cy + ring; iy++ )
+		{
+			if ( iy < y0 || iy > y1 )
+				continue;
+
+			// Interior rows of the ring only contribute their two end cells
+			bool bEdgeRow = ( iy == cy - ring || iy == cy + ring );
+			int step = ( bEdgeRow || ring == 0 ) ? 1 : 2 * ring;
+
+			for ( int ix = cx - ring; ix <= cx + ring; ix += step )
+			{
+				if ( ix < x0 || ix > x1 )
+					continue;
+
+				int cell = iy * m_nNodeGridDimX + ix;
+				for ( int i = m_NodeGridCellStart[cell]; i < m_NodeGridCellStart[cell + 1]; i++ )
+				{
+					const NodeGridEntry_t &entry = m_NodeGridEntries[i];
+					const Vector &origin = entry.origin;
+
+					// in box?
+					if ( origin.x < mins.x || origin.x > maxs.x ||
+						 origin.y < mins.y || origin.y > maxs.y ||
+						 origin.z < mins.z || origin.z > maxs.z )
+						continue;
+
+					// Skip nodes whose links can't be used by this hull
+					if ( hullBit && entry.hullMask && !( entry.hullMask & hullBit ) )
+						continue;
+
+					CAI_Node *pNode = m_pAInode[entry.nodeIndex];
+					if ( !pFilter->NodeIsValid(*pNode) )
+						continue;
+
+					float flDist = pFilter->NodeDistanceSqr(*pNode);
+
+					if ( !full || (flDist < result.ElementAtHead().dist) )
+					{
+						if ( full )
+							result.RemoveAtHead();
+
+						result.Insert( AI_NearNode_t(entry.nodeIndex, flDist) );
+
+						full = (result.Count() == maxListCount);
+					}
+				}
+			}
+		}
+	}
+
+	while ( result.Count() )
+	{
+		list.Insert( result.ElementAtHead() );
+		result.RemoveAtHead();
+	}
+
+	return list.Count();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compare the node grid against a scan of the whole network
+//-----------------------------------------------------------------------------
+
+void CAI_Network::BenchmarkNearestNode( int nQueries, int hull )
+{
+	if ( !m_iNumNodes )
+	{
+		Msg( "No nodes in network\n" );
+		return;
+	}
+
+	if ( m_bNodeGridDirty )
+		BuildNodeGrid();
+
+	Vector vecMins( FLT_MAX, FLT_MAX, FLT_MAX );
+	Vector vecMaxs( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	for ( int node = 0; node < m_iNumNodes; node++ )
+	{
+		VectorMin( vecMins, m_pAInode[node]->GetOrigin(), vecMins );
+		VectorMax( vecMaxs, m_pAInode[node]->GetOrigin(), vecMaxs );
+	}
+
+	Vector *pPoints = new Vector[nQueries];
+	int i;
+	for ( i = 0; i < nQueries; i++ )
+	{
+		pPoints[i].Init( random->RandomFloat( vecMins.x, vecMaxs.x ),
+						 random->RandomFloat( vecMins.y, vecMaxs.y ),
+						 random->RandomFloat( vecMins.z, vecMaxs.z ) );
+	}
+
+	Vector ext( MAX_NODE_LINK_DIST, MAX_NODE_LINK_DIST, MAX_NODE_LINK_DIST );
+	AI_NearNode_t *pBuffer = (AI_NearNode_t *)stackalloc( sizeof(AI_NearNode_t) * MAX_NEAR_NODES );
+	CNodeList list( pBuffer, MAX_NEAR_NODES );
+
+	int *pLinearResult = new int[nQueries];
+	CFastTimer timer;
+
+	timer.Start();
+	for ( i = 0; i < nQueries; i++ )
+	{
+		CNodeFilter filter( pPoints[i], hull );
+		ListNodesInBoxLinear( list, MAX_NEAR_NODES, pPoints[i] - ext, pPoints[i] + ext, &filter );
+		pLinearResult[i] = ( list.Count() ) ? list.ElementAtHead().nodeIndex : NO_NODE;
+	}
+	timer.End();
+	float flLinearMs = timer.GetDuration().GetMillisecondsF();
+
+	int nMismatches = 0;
+	timer.Start();
+	for ( i = 0; i < nQueries; i++ )
+	{
+		CNodeFilter filter( pPoints[i], hull );
+		ListNodesInBox( list, MAX_NEAR_NODES, pPoints[i] - ext, pPoints[i] + ext, &filter );
+		int nearest = ( list.Count() ) ? list.ElementAtHead().nodeIndex : NO_NODE;
+		if ( nearest != pLinearResult[i] )
+			nMismatches++;
+	}
+	timer.End();
+	float flGridMs = timer.GetDuration().GetMillisecondsF();
+
+	Msg( "%d nodes, %dx%d grid (%.0f unit cells), %d queries, hull %d\n", m_iNumNodes, m_nNodeGridDimX, m_nNodeGridDimY, m_flNodeGridCellSize, nQueries, hull );
+	Msg( "  linear: %.3f ms (%.2f us/query)\n", flLinearMs, flLinearMs * 1000.0 / nQueries );
+	Msg( "  grid:   %.3f ms (%.2f us/query)\n", flGridMs, flGridMs * 1000.0 / nQueries );
+	Msg( "  %d mismatched nearest nodes\n", nMismatches );
+
+	delete [] pLinearResult;
+	delete [] pPoints;
+}
+
+CON_COMMAND( ai_nearest_node_benchmark, "Time nearest node searches with and without the node grid.  Arguments: [queries] [hull]" )
+{
+	if ( !g_pBigAINet )
+		return;
+
+	int nQueries = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10000;
+	int hull = ( engine->Cmd_Argc() > 2 ) ? atoi( engine->Cmd_Argv( 2 ) ) : HULL_HUMAN;
+	if ( hull < HULL_HUMAN || hull >= NUM_HULLS )
+	{
+		Msg( "Hull must be between %d and %d\n", HULL_HUMAN, NUM_HULLS - 1 );
+		return;
+	}
+
+	g_pBigAINet->BenchmarkNearestNode( max( nQueries, 1 ), hull );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Return ID of node nearest of vecOrigin for pNPC with the given
 //			tolerance distance.  If a route is required to get to the node
@@ -533,6 +878,7 @@ CAI_Node *CAI_Network::AddNode( const Vector &origin, float yaw )
 	}
 
 	m_pAInode[m_iNumNodes] = new CAI_Node( m_iNumNodes, origin, yaw );
+	m_bNodeGridDirty = true;
 
 #ifdef AI_NODE_TREE
 	if ( !m_pNodeTree )
@@ -593,6 +939,8 @@ CAI_Link *CAI_Network::CreateLink( int srcID, int destID, CAI_DynamicLink *pDyna
 	pSrcNode->AddLink(pLink);
 	pDestNode->AddLink(pLink);
 
+	m_bNodeGridDirty = true;
+
 	return pLink;
 }
 
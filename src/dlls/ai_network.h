@@ -33,7 +33,7 @@ class CAI_NetworkManager;
 //-----------------------------------------------------------------------------
 
 #define	AI_MAX_NODE_LINKS 30
-#define MAX_NODES 1500
+#define MAX_NODES 4096
 
 //-----------------------------------------------------------------------------
 // 
@@ -127,6 +127,9 @@ public:
 	}
 	
 	CAI_Node**		AccessNodes() const	{ return m_pAInode; }
+
+	void			InvalidateNodeGrid()	{ m_bNodeGridDirty = true; }	// Call after node positions or links change
+	void			BenchmarkNearestNode( int nQueries, int hull );
 	
 private:
 	friend class CAI_NetworkManager;
@@ -138,6 +141,11 @@ private:
 	int				GetCachedNode(const Vector &checkPos, Hull_t nHull, int *pCachePos);
 
 	int				ListNodesInBox( CNodeList &list, int maxListCount, const Vector &mins, const Vector &maxs, INodeListFilter *pFilter );
+	int				ListNodesInBoxLinear( CNodeList &list, int maxListCount, const Vector &mins, const Vector &maxs, INodeListFilter *pFilter );
+
+	void			BuildNodeGrid();
+	int				NodeGridCellX( float x ) const;
+	int				NodeGridCellY( float y ) const;
 
 	//---------------------------------
 
@@ -167,6 +175,32 @@ private:
 	NearNodeCache_T		m_NearestCache[NEARNODE_CACHE_SIZE];	// Cache of nearest nodes
 	int					m_iNearestCacheNext;					// Oldest record in the cache
 
+	//---------------------------------
+	// Uniform XY grid over node origins, rebuilt lazily when nodes or links change.
+	// Nodes are stored bucketed by cell so a query only touches the cells around it.
+
+	enum
+	{
+		NODE_GRID_CELL_SIZE = 256,
+		NODE_GRID_MAX_DIM	= 128,
+	};
+
+	struct NodeGridEntry_t
+	{
+		Vector			origin;
+		int				nodeIndex;
+		unsigned short	hullMask;				// Hulls accepted by at least one link (0 if node has no links)
+	};
+
+	bool						m_bNodeGridDirty;
+	Vector2D					m_vNodeGridMins;
+	float						m_flNodeGridCellSize;
+	int							m_nNodeGridDimX;
+	int							m_nNodeGridDimY;
+	float						m_flNodeGridMaxPosOffset;	// Largest distance between a node origin and any hull position
+	CUtlVector<int>				m_NodeGridCellStart;		// First entry for each cell, plus one sentinel
+	CUtlVector<NodeGridEntry_t>	m_NodeGridEntries;
+
 #ifdef AI_NODE_TREE
 	ISpatialPartition * m_pNodeTree;
 	CUtlVector<int>		m_GatheredNodes;
@@ -623,6 +623,8 @@ void CAI_NetworkManager::LoadNetworkGraph( void )
 		DevMsg( "\n** Should run \"Check For Problems\" on the VMF then verify dynamic links\n" );
 #endif
 
+	m_pNetwork->InvalidateNodeGrid();
+
 	gm_fNetworksLoaded = true;
 	CAI_DynamicLink::gm_bInitialized = false;
 }
@@ -2029,6 +2031,7 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 		}
 	}
 	nNodes = pNetwork->NumNodes(); // InitNodePosition can create nodes
+	pNetwork->InvalidateNodeGrid();
 
 	// ---------------------------
 	// Initialize node neighbors
@@ -2072,6 +2075,8 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 		}
 	}
 
+	pNetwork->InvalidateNodeGrid();
+
 	g_pAINetworkManager->FixupHints();
 
 	EndBuild();
@@ -2132,6 +2137,7 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 			pHelper->PostInitNodePosition( pNetwork, ppNodes[i] );
 	}
 	nNodes = pNetwork->NumNodes(); // InitNodePosition can create nodes
+	pNetwork->InvalidateNodeGrid();
 	timer.End();
 	DevMsg( "...done initializing node positions. %f seconds\n", timer.GetDuration().GetSeconds() );
 
@@ -2192,6 +2198,9 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 	DevMsg( "...done determining zones. %f seconds\n", timer.GetDuration().GetSeconds() );
 	DevMsg( "...done building AI node graph, %f seconds\n", masterTimer.GetDuration().GetSeconds() );
 
+	// Link move types have been filled in since the links were created
+	pNetwork->InvalidateNodeGrid();
+
 	g_pAINetworkManager->FixupHints();
 
 	EndBuild();
@@ -1846,3 +1846,184 @@ void CAI_Pathfinder::CTriDebugOverlay::AddTriOverlayLine(const Vector &origin, c
 }
 
 //-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+// CAI_RouteRequestQueue
+//-----------------------------------------------------------------------------
+
+ConVar ai_route_budget( "ai_route_budget", "3000", 0, "Microseconds per tick NPCs may spend starting route building tasks before they are deferred (0 disables)" );
+ConVar ai_route_max_wait( "ai_route_max_wait", "10", 0, "Ticks an NPC waits for route budget before it is let through anyway" );
+
+CAI_RouteRequestQueue g_AI_RouteRequestQueue;
+
+//-------------------------------------
+
+CAI_RouteRequestQueue::CAI_RouteRequestQueue()
+{
+	m_iCurTick = -1;
+	m_flTickMicroseconds = 0;
+	ResetStats();
+}
+
+//-------------------------------------
+
+bool CAI_RouteRequestQueue::IsRouteTask( int iTask )
+{
+	switch ( iTask )
+	{
+	case TASK_GET_PATH_AWAY_FROM_BEST_SOUND:
+	case TASK_GET_PATH_TO_GOAL:
+	case TASK_GET_PATH_TO_ENEMY:
+	case TASK_GET_PATH_TO_ENEMY_LKP:
+	case TASK_GET_CHASE_PATH_TO_ENEMY:
+	case TASK_GET_PATH_TO_ENEMY_LKP_LOS:
+	case TASK_GET_PATH_TO_ENEMY_CORPSE:
+	case TASK_GET_PATH_TO_PLAYER:
+	case TASK_GET_PATH_TO_ENEMY_LOS:
+	case TASK_GET_PATH_TO_RANGE_ENEMY_LKP_LOS:
+	case TASK_GET_PATH_TO_TARGET:
+	case TASK_GET_PATH_TO_TARGET_WEAPON:
+	case TASK_GET_PATH_TO_HINTNODE:
+	case TASK_GET_PATH_TO_COMMAND_GOAL:
+	case TASK_GET_PATH_TO_LASTPOSITION:
+	case TASK_GET_PATH_TO_SAVEPOSITION:
+	case TASK_GET_PATH_TO_SAVEPOSITION_LOS:
+	case TASK_GET_PATH_TO_RANDOM_NODE:
+	case TASK_GET_PATH_TO_BESTSOUND:
+	case TASK_GET_PATH_TO_BESTSCENT:
+	case TASK_FIND_COVER_FROM_BEST_SOUND:
+	case TASK_FIND_COVER_FROM_ENEMY:
+	case TASK_FIND_LATERAL_COVER_FROM_ENEMY:
+	case TASK_FIND_BACKAWAY_FROM_SAVEPOSITION:
+	case TASK_FIND_NODE_COVER_FROM_ENEMY:
+	case TASK_FIND_NEAR_NODE_COVER_FROM_ENEMY:
+	case TASK_FIND_FAR_NODE_COVER_FROM_ENEMY:
+	case TASK_FIND_COVER_FROM_ORIGIN:
+		return true;
+	}
+	return false;
+}
+
+//-------------------------------------
+
+void CAI_RouteRequestQueue::UpdateTick()
+{
+	if ( m_iCurTick == gpGlobals->tickcount )
+		return;
+
+	m_iCurTick = gpGlobals->tickcount;
+	m_flTickMicroseconds = 0;
+
+	// NPCs that changed schedule while waiting never come back for their slot
+	int maxWait = max( ai_route_max_wait.GetInt(), 1 ) * 4;
+	for ( int i = m_Waiting.Count() - 1; i >= 0; i-- )
+	{
+		if ( m_iCurTick - m_Waiting[i].tickQueued > maxWait )
+			m_Waiting.Remove( i );
+	}
+}
+
+//-------------------------------------
+
+int CAI_RouteRequestQueue::FindWaiter( CAI_BaseNPC *pNPC )
+{
+	for ( int i = 0; i < m_Waiting.Count(); i++ )
+	{
+		if ( m_Waiting[i].pNPC == pNPC )
+			return i;
+	}
+	return -1;
+}
+
+//-------------------------------------
+
+bool CAI_RouteRequestQueue::BeginRequest( CAI_BaseNPC *pNPC )
+{
+	// Keep the per-tick accounting current even with the budget off, EndRequest still adds to it
+	UpdateTick();
+
+	if ( ai_route_budget.GetInt() <= 0 )
+		return true;
+
+	int iWaiter = FindWaiter( pNPC );
+	int ticksWaited = ( iWaiter != -1 ) ? m_iCurTick - m_Waiting[iWaiter].tickQueued : 0;
+
+	bool bOverBudget = ( m_flTickMicroseconds >= ai_route_budget.GetFloat() );
+	if ( bOverBudget && ticksWaited < ai_route_max_wait.GetInt() )
+	{
+		if ( iWaiter == -1 )
+		{
+			Waiter_t waiter = { pNPC, m_iCurTick };
+			m_Waiting.AddToTail( waiter );
+			m_nDeferred++;
+			m_nMaxQueueDepth = max( m_nMaxQueueDepth, m_Waiting.Count() );
+		}
+		return false;
+	}
+
+	if ( iWaiter != -1 )
+	{
+		m_Waiting.Remove( iWaiter );
+		m_nWaited++;
+		m_nWaitTicksTotal += ticksWaited;
+		m_nWaitTicksMax = max( m_nWaitTicksMax, ticksWaited );
+		if ( bOverBudget )
+			m_nForced++;
+	}
+
+	return true;
+}
+
+//-------------------------------------
+
+void CAI_RouteRequestQueue::EndRequest( float flMicroseconds )
+{
+	m_nRequests++;
+	m_flTickMicroseconds += flMicroseconds;
+	m_flTotalMicroseconds += flMicroseconds;
+	m_flMaxTickMicroseconds = max( m_flMaxTickMicroseconds, m_flTickMicroseconds );
+}
+
+//-------------------------------------
+
+void CAI_RouteRequestQueue::RemoveNPC( CAI_BaseNPC *pNPC )
+{
+	int iWaiter = FindWaiter( pNPC );
+	if ( iWaiter != -1 )
+		m_Waiting.Remove( iWaiter );
+}
+
+//-------------------------------------
+
+void CAI_RouteRequestQueue::ReportStats()
+{
+	Msg( "Route requests: %d started, %d deferred, %d forced over budget\n", m_nRequests, m_nDeferred, m_nForced );
+	Msg( "  queue depth: %d now, %d max\n", m_Waiting.Count(), m_nMaxQueueDepth );
+	Msg( "  wait: %.2f ticks avg, %d ticks max\n", ( m_nWaited ) ? (float)m_nWaitTicksTotal / m_nWaited : 0.0f, m_nWaitTicksMax );
+	Msg( "  time: %.1f us avg per request, %.1f us max per tick\n", ( m_nRequests ) ? m_flTotalMicroseconds / m_nRequests : 0.0f, m_flMaxTickMicroseconds );
+}
+
+//-------------------------------------
+
+void CAI_RouteRequestQueue::ResetStats()
+{
+	m_nRequests = 0;
+	m_nDeferred = 0;
+	m_nForced = 0;
+	m_nWaited = 0;
+	m_nWaitTicksTotal = 0;
+	m_nWaitTicksMax = 0;
+	m_nMaxQueueDepth = 0;
+	m_flTotalMicroseconds = 0;
+	m_flMaxTickMicroseconds = 0;
+}
+
+//-------------------------------------
+
+CON_COMMAND( ai_route_queue_stats, "Report route request queue stats. Pass \"reset\" to clear them" )
+{
+	g_AI_RouteRequestQueue.ReportStats();
+
+	if ( engine->Cmd_Argc() > 1 && !Q_stricmp( engine->Cmd_Argv( 1 ), "reset" ) )
+		g_AI_RouteRequestQueue.ResetStats();
+}
@@ -190,6 +190,61 @@ public:
 	DECLARE_SIMPLE_DATADESC();
 };
 
+//-----------------------------------------------------------------------------
+// CAI_RouteRequestQueue
+//
+// Purpose: Spreads route building across ticks. Tasks that build routes only
+//			start while the per-tick pathfinding budget lasts. NPCs that miss
+//			out keep the task pending and retry on their next think, and are
+//			let through regardless once they have waited too long.
+//
+//-----------------------------------------------------------------------------
+
+class CAI_RouteRequestQueue
+{
+public:
+	CAI_RouteRequestQueue();
+
+	static bool		IsRouteTask( int iTask );
+
+	bool			BeginRequest( CAI_BaseNPC *pNPC );			// Returns false if the NPC should wait
+	void			EndRequest( float flMicroseconds );
+	void			RemoveNPC( CAI_BaseNPC *pNPC );
+
+	int				NumWaiting() const	{ return m_Waiting.Count(); }
+
+	void			ReportStats();
+	void			ResetStats();
+
+private:
+	void			UpdateTick();
+	int				FindWaiter( CAI_BaseNPC *pNPC );
+
+	struct Waiter_t
+	{
+		CAI_BaseNPC *	pNPC;
+		int				tickQueued;
+	};
+
+	CUtlVector<Waiter_t> m_Waiting;
+
+	int		m_iCurTick;
+	float	m_flTickMicroseconds;		// Time spent building routes this tick
+
+	// Stats
+	int		m_nRequests;
+	int		m_nDeferred;
+	int		m_nForced;					// Requests let through over budget after waiting too long
+	int		m_nWaited;					// Requests that started after waiting
+	int		m_nWaitTicksTotal;
+	int		m_nWaitTicksMax;
+	int		m_nMaxQueueDepth;
+	float	m_flTotalMicroseconds;
+	float	m_flMaxTickMicroseconds;
+};
+
+extern CAI_RouteRequestQueue g_AI_RouteRequestQueue;
+
 //-----------------------------------------------------------------------------
 
 #endif // AI_PATHFINDER_H
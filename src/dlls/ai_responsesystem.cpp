@@ -20,6 +20,8 @@
 #include "isaverestore.h"
 #include "utlbuffer.h"
 #include "stringpool.h"
+#include "utlmap.h"
+#include "checksum_crc.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -27,6 +29,9 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_ruleindex( "rr_ruleindex", "1", FCVAR_NONE, "Only score rules that can match the concept being spoken." );
+ConVar rr_ruleindex_verify( "rr_ruleindex_verify", "0", FCVAR_NONE, "Score every rule as well as the indexed ones and warn if they pick differently." );
+ConVar rr_usecompiled( "rr_usecompiled", "1", FCVAR_NONE, "Load response rules from their compiled image (see rr_compileresponses) when it's up to date with the scripts." );
 
 static CUtlSymbolTable g_RS;
 
@@ -57,6 +62,7 @@ public:
 		maxequals = false;
 		maxval = 0.0f;
 		minval = 0.0f;
+		tokenval = 0.0f;
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -108,6 +114,7 @@ public:
 
 	float	maxval;
 	float	minval;
+	float	tokenval;		// atof( GetToken() ), for numeric compares
 
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
@@ -120,6 +127,7 @@ public:
 	void	SetToken( char const *s )
 	{
 		token = g_RS.AddString( s );
+		tokenval = (float)atof( s );
 	}
 
 	char const *GetToken()
@@ -392,6 +400,7 @@ struct Criteria
 	{
 		name = NULL;
 		value = NULL;
+		nameSym = UTL_INVAL_SYMBOL;
 		weight.SetFloat( 1.0f );
 		required = false;
 	}
@@ -402,6 +411,7 @@ struct Criteria
 
 		name = CopyString( src.name );
 		value = CopyString( src.value );
+		nameSym = src.nameSym;
 		weight = src.weight;
 		required = src.required;
 
@@ -419,6 +429,7 @@ struct Criteria
 	{
 		name = CopyString( src.name );
 		value = CopyString( src.value );
+		nameSym = src.nameSym;
 		weight = src.weight;
 		required = src.required;
 
@@ -443,6 +454,7 @@ struct Criteria
 
 	char						*name;
 	char						*value;
+	UtlSymId_t					nameSym;	// name, interned for AI_CriteriaSet lookups
 	float16						weight;
 	bool						required;
 
@@ -565,6 +577,8 @@ public:
 	
 	void		Clear();
 
+	bool		SaveRuleSetImage( const char *basescript );
+
 protected:
 
 	virtual const char *GetScriptFile( void ) = 0;
@@ -667,6 +681,11 @@ private:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	void		UpdateBestRules( const AI_CriteriaSet& set, int irule, bool verbose, float& bestscore, CUtlVector< int >& bestrules );
+	void		FindMatchingRulesIndexed( const AI_CriteriaSet& set, float& bestscore, CUtlVector< int >& bestrules );
+	void		VerifyRuleIndex( const AI_CriteriaSet& set, float bestscore, const CUtlVector< int >& bestrules );
+	void		BuildRuleIndex();
+	const char	*GetRequiredConcept( Rule *rule );
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -678,6 +697,8 @@ private:
 	void		DebugPrint( int depth, const char *fmt, ... );
 
 	void		LoadFromBuffer( const char *scriptfile, const char *buffer, CStringPool &includedFiles );
+	bool		LoadRuleSetImage( const char *basescript );
+	bool		RestoreFromImage( CUtlBuffer &buf );
 
 //	void		TouchReferencedScenes();
 
@@ -696,6 +717,13 @@ private:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Rules that require a concept, bucketed by that concept (in rule order),
+	// plus the ones that don't and always have to be scored
+	CUtlDict< int, short >	m_RulesByConcept;
+	CUtlVector< CUtlVector< unsigned short > >	m_ConceptBuckets;
+	CUtlVector< unsigned short >	m_UnindexedRules;
+	bool		m_bRuleIndexDirty;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -711,6 +739,9 @@ private:
 
 	CUtlVector< ScriptEntry >		m_ScriptStack;
 
+	// Every script the rules came from, so a compiled image can tell when it's stale
+	CUtlVector< FileNameHandle_t >	m_ScriptFiles;
+
 	friend class CDefaultResponseSystemSaveRestoreBlockHandler;
 	friend class CResponseSystemSaveRestoreOps;
 };
@@ -745,6 +776,7 @@ CResponseSystem::CResponseSystem()
 	token[0] = 0;
 	m_bUnget = false;
 	m_bPrecache = true;
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -800,6 +832,8 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+	m_ScriptFiles.RemoveAll();
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -1030,7 +1064,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.tokenval )
 				return false;
 		}
 		else
@@ -1049,7 +1083,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.tokenval;
 	}
 
 	return !Q_stricmp( setValue, m.GetToken() ) ? true : false;
@@ -1115,7 +1149,7 @@ float CResponseSystem::ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& s
 
 	const char *actualValue = "";
 
-	int found = set.FindCriterionIndex( c->name );
+	int found = set.FindCriterionIndex( c->nameSym );
 	if ( found != -1 )
 	{
 		actualValue = set.GetValue( found );
@@ -1627,6 +1661,161 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 	return bret;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Scores a rule and keeps track of all the rules tied for the best score
+//-----------------------------------------------------------------------------
+void CResponseSystem::UpdateBestRules( const AI_CriteriaSet& set, int irule, bool verbose, float& bestscore, CUtlVector< int >& bestrules )
+{
+	float score = ScoreCriteriaAgainstRule( set, irule, verbose );
+	// Check equals so that we keep track of all matching rules
+	if ( score >= bestscore )
+	{
+		// Reset bucket
+		if( score != bestscore )
+		{
+			bestscore = score;
+			bestrules.RemoveAll();
+		}
+
+		// Add to bucket
+		bestrules.AddToTail( irule );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the concept a rule requires, if it requires a plain (case
+//  insensitive string) match on one; such a rule can't score unless the
+//  criteria set has that concept.
+//-----------------------------------------------------------------------------
+const char *CResponseSystem::GetRequiredConcept( Rule *rule )
+{
+	int c = rule->m_Criteria.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		Criteria *crit = &m_Criteria[ rule->m_Criteria[ i ] ];
+		if ( !crit->required || crit->IsSubCriteriaType() || !crit->name || Q_stricmp( crit->name, "concept" ) )
+			continue;
+
+		Matcher &m = crit->matcher;
+		if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+			continue;
+
+		return m.GetToken();
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Buckets the rules by the concept they require, for
+//  FindMatchingRulesIndexed. Rules that don't require a plain concept match go
+//  in m_UnindexedRules. Rebuilt on the next lookup after rules are parsed,
+//  restored from a compiled image or cleared.
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RulesByConcept.Purge();
+	m_ConceptBuckets.Purge();
+	m_UnindexedRules.Purge();
+
+	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		const char *pszConcept = GetRequiredConcept( &m_Rules[ i ] );
+		if ( !pszConcept )
+		{
+			m_UnindexedRules.AddToTail( i );
+			continue;
+		}
+
+		int idx = m_RulesByConcept.Find( pszConcept );
+		if ( idx == m_RulesByConcept.InvalidIndex() )
+		{
+			idx = m_RulesByConcept.Insert( pszConcept, m_ConceptBuckets.AddToTail() );
+		}
+		m_ConceptBuckets[ m_RulesByConcept[ idx ] ].AddToTail( i );
+	}
+
+	m_bRuleIndexDirty = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Scores only the rules for the set's concept plus the rules that
+//  don't require one. They're visited in rule order, so ties (and the random
+//  pick between them) come out the same as scoring everything.
+//-----------------------------------------------------------------------------
+void CResponseSystem::FindMatchingRulesIndexed( const AI_CriteriaSet& set, float& bestscore, CUtlVector< int >& bestrules )
+{
+	if ( m_bRuleIndexDirty )
+	{
+		BuildRuleIndex();
+	}
+
+	// No concept at all compares the same as an empty one
+	static UtlSymId_t conceptSym = AI_CriteriaSet::ComputeCriteriaSymbol( "concept" );
+	const char *pszConcept = "";
+	int found = set.FindCriterionIndex( conceptSym );
+	if ( found != -1 )
+	{
+		pszConcept = set.GetValue( found );
+	}
+
+	const CUtlVector< unsigned short > *pBucket = NULL;
+	int idx = m_RulesByConcept.Find( pszConcept );
+	if ( idx != m_RulesByConcept.InvalidIndex() )
+	{
+		pBucket = &m_ConceptBuckets[ m_RulesByConcept[ idx ] ];
+	}
+
+	int nBucket = pBucket ? pBucket->Count() : 0;
+	int nUnindexed = m_UnindexedRules.Count();
+	int b = 0;
+	int u = 0;
+	while ( b < nBucket || u < nUnindexed )
+	{
+		int irule;
+		if ( u >= nUnindexed || ( b < nBucket && (*pBucket)[ b ] < m_UnindexedRules[ u ] ) )
+		{
+			irule = (*pBucket)[ b++ ];
+		}
+		else
+		{
+			irule = m_UnindexedRules[ u++ ];
+		}
+
+		UpdateBestRules( set, irule, false, bestscore, bestrules );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Scores every rule and complains if the index found anything different
+//-----------------------------------------------------------------------------
+void CResponseSystem::VerifyRuleIndex( const AI_CriteriaSet& set, float bestscore, const CUtlVector< int >& bestrules )
+{
+	CUtlVector< int > allrules;
+	float allscore = 0.001f;
+
+	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		UpdateBestRules( set, i, false, allscore, allrules );
+	}
+
+	bool bSame = ( allscore == bestscore ) && ( allrules.Count() == bestrules.Count() );
+	for ( int i = 0; bSame && i < allrules.Count(); i++ )
+	{
+		bSame = ( allrules[ i ] == bestrules[ i ] );
+	}
+
+	if ( !bSame )
+	{
+		Warning( "Response rule index mismatch: indexed found %i rules (score %.3f, first '%s'), full scan found %i (score %.3f, first '%s')\n",
+			bestrules.Count(), bestscore, bestrules.Count() ? m_Rules.GetElementName( bestrules[ 0 ] ) : "none",
+			allrules.Count(), allscore, allrules.Count() ? m_Rules.GetElementName( allrules[ 0 ] ) : "none" );
+		const_cast< AI_CriteriaSet & >( set ).Describe();
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
@@ -1638,23 +1827,24 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	CUtlVector< int >	bestrules;
 	float bestscore = 0.001f;
 
-	int c = m_Rules.Count();
-	int i;
-	for ( i = 0; i < c; i++ )
+	// Verbose scoring and rr_debugrule want to see every rule scored
+	const char *pszDebugRule = rr_debugrule.GetString();
+	bool bUseIndex = rr_ruleindex.GetBool() && !verbose && !( pszDebugRule && pszDebugRule[0] );
+	if ( bUseIndex )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
-		// Check equals so that we keep track of all matching rules
-		if ( score >= bestscore )
-		{
-			// Reset bucket
-			if( score != bestscore )
-			{
-				bestscore = score;
-				bestrules.RemoveAll();
-			}
+		FindMatchingRulesIndexed( set, bestscore, bestrules );
 
-			// Add to bucket
-			bestrules.AddToTail( i );
+		if ( rr_ruleindex_verify.GetBool() )
+		{
+			VerifyRuleIndex( set, bestscore, bestrules );
+		}
+	}
+	else
+	{
+		int c = m_Rules.Count();
+		for ( int i = 0; i < c; i++ )
+		{
+			UpdateBestRules( set, i, verbose, bestscore, bestrules );
 		}
 	}
 
@@ -1904,6 +2094,7 @@ void CResponseSystem::ParseInclude( CStringPool &includedFiles )
 void CResponseSystem::LoadFromBuffer( const char *scriptfile, const char *buffer, CStringPool &includedFiles )
 {
 	includedFiles.Allocate( scriptfile );
+	m_ScriptFiles.AddToTail( filesystem->FindOrAddFileName( scriptfile ) );
 	PushScript( scriptfile, (unsigned char * )buffer );
 
 	if( rr_dumpresponses.GetBool() )
@@ -1971,6 +2162,9 @@ void CResponseSystem::LoadFromBuffer( const char *scriptfile, const char *buffer
 //-----------------------------------------------------------------------------
 void CResponseSystem::LoadRuleSet( const char *basescript )
 {
+	if ( rr_usecompiled.GetBool() && LoadRuleSetImage( basescript ) )
+		return;
+
 	int length = 0;
 	unsigned char *buffer = (unsigned char *)UTIL_LoadFileForMe( basescript, &length );
 	if ( length <= 0 || !buffer )
@@ -1990,6 +2184,388 @@ void CResponseSystem::LoadRuleSet( const char *basescript )
 	//TouchReferencedScenes();
 }
 
+//-----------------------------------------------------------------------------
+// Compiled response rules images
+//
+// An image holds everything the scripts parse into: every string once in a
+// shared pool, then flat tables of enumerations, response groups, criteria and
+// rules that refer to the pool and to each other by index. It also lists the
+// scripts it was built from and a CRC of each, and it's ignored as soon as
+// any of them changes. File times aren't used since they don't survive
+// copying or installing the scripts, and miss edits within the same second.
+//-----------------------------------------------------------------------------
+#define RESPONSE_RULES_IMAGE_TAG		MAKEID( 'r', 'r', 'i', 'm' )
+#define RESPONSE_RULES_IMAGE_VERSION	2
+
+static void GetRuleSetImageName( const char *basescript, char *imagename, int maxlen )
+{
+	Q_strncpy( imagename, basescript, maxlen );
+	Q_SetExtension( imagename, ".rrc", maxlen );
+}
+
+static bool GetScriptCRC( const char *filename, CRC32_t &crc )
+{
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( filename, "GAME", buf ) )
+		return false;
+
+	crc = CRC32_ProcessSingleBuffer( buf.Base(), buf.TellPut() );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the strings an image refers to, each stored once
+//-----------------------------------------------------------------------------
+class CResponseImageStrings
+{
+public:
+	CResponseImageStrings() : m_Offsets( 0, 0, DefLessFunc( UtlSymId_t ) )
+	{
+	}
+
+	int Add( const char *psz )
+	{
+		if ( !psz )
+			return -1;
+
+		UtlSymId_t sym = m_Symbols.AddString( psz );
+		unsigned short idx = m_Offsets.Find( sym );
+		if ( idx != m_Offsets.InvalidIndex() )
+			return m_Offsets[ idx ];
+
+		int offset = m_Pool.TellPut();
+		m_Pool.PutString( psz );
+		m_Offsets.Insert( sym, offset );
+		return offset;
+	}
+
+	CUtlBuffer &GetPool() { return m_Pool; }
+
+private:
+	CUtlBuffer m_Pool;
+	CUtlSymbolTable m_Symbols;
+	CUtlMap< UtlSymId_t, int > m_Offsets;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the currently loaded rules out as a compiled image
+//-----------------------------------------------------------------------------
+bool CResponseSystem::SaveRuleSetImage( const char *basescript )
+{
+	if ( !m_ScriptFiles.Count() )
+		return false;
+
+	CResponseImageStrings strings;
+	CUtlBuffer tables;
+	char filename[ MAX_PATH ];
+	int i, j;
+
+	tables.PutInt( m_ScriptFiles.Count() );
+	for ( i = 0; i < m_ScriptFiles.Count(); i++ )
+	{
+		CRC32_t crc;
+		if ( !filesystem->String( m_ScriptFiles[ i ], filename, sizeof( filename ) ) ||
+			 !GetScriptCRC( filename, crc ) )
+		{
+			return false;
+		}
+
+		tables.PutInt( strings.Add( filename ) );
+		tables.PutUnsignedInt( crc );
+	}
+
+	tables.PutInt( m_Enumerations.Count() );
+	for ( i = 0; i < m_Enumerations.Count(); i++ )
+	{
+		tables.PutInt( strings.Add( m_Enumerations.GetElementName( i ) ) );
+		tables.PutFloat( m_Enumerations[ i ].value );
+	}
+
+	tables.PutInt( m_Responses.Count() );
+	for ( i = 0; i < m_Responses.Count(); i++ )
+	{
+		ResponseGroup &group = m_Responses[ i ];
+
+		tables.PutInt( strings.Add( m_Responses.GetElementName( i ) ) );
+		tables.Put( &group.rp, sizeof( group.rp ) );
+		tables.PutUnsignedChar( group.m_bDepleteBeforeRepeat );
+		tables.PutUnsignedChar( group.m_bSequential );
+		tables.PutUnsignedChar( group.m_bNoRepeat );
+		tables.PutUnsignedChar( group.m_bHasFirst );
+		tables.PutUnsignedChar( group.m_bHasLast );
+
+		tables.PutInt( group.group.Count() );
+		for ( j = 0; j < group.group.Count(); j++ )
+		{
+			Response &response = group.group[ j ];
+
+			tables.PutInt( strings.Add( response.value ) );
+			tables.PutFloat( response.weight.GetFloat() );
+			tables.PutUnsignedChar( response.type );
+			tables.PutUnsignedChar( response.first );
+			tables.PutUnsignedChar( response.last );
+		}
+	}
+
+	tables.PutInt( m_Criteria.Count() );
+	for ( i = 0; i < m_Criteria.Count(); i++ )
+	{
+		Criteria &crit = m_Criteria[ i ];
+
+		tables.PutInt( strings.Add( m_Criteria.GetElementName( i ) ) );
+		tables.PutInt( strings.Add( crit.name ) );
+		tables.PutInt( strings.Add( crit.value ) );
+		tables.PutFloat( crit.weight.GetFloat() );
+		tables.PutUnsignedChar( crit.required );
+
+		tables.PutInt( crit.subcriteria.Count() );
+		for ( j = 0; j < crit.subcriteria.Count(); j++ )
+		{
+			tables.PutUnsignedShort( crit.subcriteria[ j ] );
+		}
+	}
+
+	tables.PutInt( m_Rules.Count() );
+	for ( i = 0; i < m_Rules.Count(); i++ )
+	{
+		Rule &rule = m_Rules[ i ];
+
+		tables.PutInt( strings.Add( m_Rules.GetElementName( i ) ) );
+		tables.PutInt( strings.Add( rule.GetContext() ) );
+		// Not m_bEnabled, matchonce rules that have fired are disabled at runtime
+		tables.PutUnsignedChar( rule.m_bMatchOnce );
+
+		tables.PutInt( rule.m_Criteria.Count() );
+		for ( j = 0; j < rule.m_Criteria.Count(); j++ )
+		{
+			tables.PutUnsignedShort( rule.m_Criteria[ j ] );
+		}
+
+		tables.PutInt( rule.m_Responses.Count() );
+		for ( j = 0; j < rule.m_Responses.Count(); j++ )
+		{
+			tables.PutUnsignedShort( rule.m_Responses[ j ] );
+		}
+	}
+
+	CUtlBuffer &pool = strings.GetPool();
+
+	CUtlBuffer buf;
+	buf.PutInt( RESPONSE_RULES_IMAGE_TAG );
+	buf.PutInt( RESPONSE_RULES_IMAGE_VERSION );
+	buf.PutInt( sizeof( AI_ResponseParams ) );
+	buf.PutInt( pool.TellPut() );
+	buf.Put( pool.Base(), pool.TellPut() );
+	buf.Put( tables.Base(), tables.TellPut() );
+
+	char imagename[ MAX_PATH ];
+	GetRuleSetImageName( basescript, imagename, sizeof( imagename ) );
+	if ( !filesystem->WriteFile( imagename, "MOD", buf ) )
+	{
+		Warning( "Unable to write response rules image '%s'\n", imagename );
+		return false;
+	}
+
+	Msg( "Wrote '%s' (%i rules, %i criteria, %i responses, %i bytes)\n", imagename, 
+		m_Rules.Count(), m_Criteria.Count(), m_Responses.Count(), buf.TellPut() );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads the compiled image for basescript if it's there and up to date
+//-----------------------------------------------------------------------------
+bool CResponseSystem::LoadRuleSetImage( const char *basescript )
+{
+	char imagename[ MAX_PATH ];
+	GetRuleSetImageName( basescript, imagename, sizeof( imagename ) );
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( imagename, "GAME", buf ) )
+		return false;
+
+	if ( RestoreFromImage( buf ) )
+	{
+		DevMsg( 1, "CResponseSystem:  %s (%i rules, %i criteria, and %i responses)\n",
+			imagename, m_Rules.Count(), m_Criteria.Count(), m_Responses.Count() );
+		return true;
+	}
+
+	// Stale or damaged, start over from the scripts
+	DevMsg( 1, "CResponseSystem:  ignoring out of date image %s\n", imagename );
+	Clear();
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+bool CResponseSystem::RestoreFromImage( CUtlBuffer &buf )
+{
+	if ( buf.GetInt() != RESPONSE_RULES_IMAGE_TAG ||
+		 buf.GetInt() != RESPONSE_RULES_IMAGE_VERSION ||
+		 buf.GetInt() != sizeof( AI_ResponseParams ) )
+	{
+		return false;
+	}
+
+	// The pool points into buf, so anything that's kept gets copied out of it
+	int poolsize = buf.GetInt();
+	if ( !buf.IsValid() || poolsize < 0 || poolsize > buf.GetBytesRemaining() )
+		return false;
+
+	const char *pool = (const char *)buf.PeekGet();
+	buf.SeekGet( CUtlBuffer::SEEK_CURRENT, poolsize );
+
+#define IMAGE_STRING( offset )	( ( (offset) >= 0 && (offset) < poolsize ) ? pool + (offset) : NULL )
+
+	int i, j, c;
+
+	c = buf.GetInt();
+	for ( i = 0; i < c; i++ )
+	{
+		const char *filename = IMAGE_STRING( buf.GetInt() );
+		CRC32_t imagecrc = buf.GetUnsignedInt();
+		CRC32_t crc;
+		if ( !filename || !GetScriptCRC( filename, crc ) || crc != imagecrc )
+			return false;
+
+		m_ScriptFiles.AddToTail( filesystem->FindOrAddFileName( filename ) );
+	}
+
+	c = buf.GetInt();
+	for ( i = 0; i < c; i++ )
+	{
+		const char *name = IMAGE_STRING( buf.GetInt() );
+
+		Enumeration newEnum;
+		newEnum.value = buf.GetFloat();
+
+		if ( !name || m_Enumerations.Insert( name, newEnum ) != i )
+			return false;
+	}
+
+	c = buf.GetInt();
+	for ( i = 0; i < c; i++ )
+	{
+		const char *name = IMAGE_STRING( buf.GetInt() );
+		if ( !name )
+			return false;
+
+		ResponseGroup newGroup;
+		buf.Get( &newGroup.rp, sizeof( newGroup.rp ) );
+		newGroup.m_bDepleteBeforeRepeat = buf.GetUnsignedChar() != 0;
+		newGroup.SetSequential( buf.GetUnsignedChar() != 0 );
+		newGroup.SetNoRepeat( buf.GetUnsignedChar() != 0 );
+		newGroup.m_bHasFirst = buf.GetUnsignedChar() != 0;
+		newGroup.m_bHasLast = buf.GetUnsignedChar() != 0;
+
+		int nResponses = buf.GetInt();
+		if ( !buf.IsValid() || nResponses < 0 )
+			return false;
+
+		newGroup.group.EnsureCapacity( nResponses );
+		for ( j = 0; j < nResponses; j++ )
+		{
+			Response newResponse;
+			newResponse.value = CopyString( IMAGE_STRING( buf.GetInt() ) );
+			newResponse.weight.SetFloat( buf.GetFloat() );
+			newResponse.type = buf.GetUnsignedChar();
+			newResponse.first = buf.GetUnsignedChar() != 0;
+			newResponse.last = buf.GetUnsignedChar() != 0;
+
+			newGroup.group.AddToTail( newResponse );
+		}
+
+		if ( m_Responses.Insert( name, newGroup ) != i )
+			return false;
+	}
+
+	c = buf.GetInt();
+	for ( i = 0; i < c; i++ )
+	{
+		const char *name = IMAGE_STRING( buf.GetInt() );
+		const char *critname = IMAGE_STRING( buf.GetInt() );
+		const char *critvalue = IMAGE_STRING( buf.GetInt() );
+		if ( !name )
+			return false;
+
+		Criteria newCriterion;
+		newCriterion.name = CopyString( critname );
+		newCriterion.value = CopyString( critvalue );
+		if ( critname )
+		{
+			newCriterion.nameSym = AI_CriteriaSet::ComputeCriteriaSymbol( critname );
+		}
+		newCriterion.weight.SetFloat( buf.GetFloat() );
+		newCriterion.required = buf.GetUnsignedChar() != 0;
+
+		int nSubcriteria = buf.GetInt();
+		if ( !buf.IsValid() || nSubcriteria < 0 )
+			return false;
+
+		for ( j = 0; j < nSubcriteria; j++ )
+		{
+			// Subcriteria can only refer to criteria defined before them
+			int idx = buf.GetUnsignedShort();
+			if ( idx >= i )
+				return false;
+			newCriterion.subcriteria.AddToTail( idx );
+		}
+
+		if ( !newCriterion.IsSubCriteriaType() )
+		{
+			ComputeMatcher( &newCriterion, newCriterion.matcher );
+		}
+
+		if ( m_Criteria.Insert( name, newCriterion ) != i )
+			return false;
+	}
+
+	c = buf.GetInt();
+	for ( i = 0; i < c; i++ )
+	{
+		const char *name = IMAGE_STRING( buf.GetInt() );
+		if ( !name )
+			return false;
+
+		Rule newRule;
+		newRule.SetContext( IMAGE_STRING( buf.GetInt() ) );
+		newRule.m_bMatchOnce = buf.GetUnsignedChar() != 0;
+
+		int nCriteria = buf.GetInt();
+		if ( !buf.IsValid() || nCriteria < 0 )
+			return false;
+
+		for ( j = 0; j < nCriteria; j++ )
+		{
+			int idx = buf.GetUnsignedShort();
+			if ( idx >= m_Criteria.Count() )
+				return false;
+			newRule.m_Criteria.AddToTail( idx );
+		}
+
+		int nResponses = buf.GetInt();
+		if ( !buf.IsValid() || nResponses < 0 )
+			return false;
+
+		for ( j = 0; j < nResponses; j++ )
+		{
+			int idx = buf.GetUnsignedShort();
+			if ( idx >= m_Responses.Count() )
+				return false;
+			newRule.m_Responses.AddToTail( idx );
+		}
+
+		if ( m_Rules.Insert( name, newRule ) != i )
+			return false;
+	}
+
+#undef IMAGE_STRING
+
+	m_bRuleIndexDirty = true;
+	return buf.IsValid();
+}
+
 static ResponseType_t ComputeResponseType( const char *s )
 {
 	if ( !Q_stricmp( s, "scene" ) )
@@ -2361,6 +2937,7 @@ int CResponseSystem::ParseOneCriterion( const char *criterionName )
 
 			newCriterion.name = CopyString( key );
 			newCriterion.value = CopyString( value );
+			newCriterion.nameSym = AI_CriteriaSet::ComputeCriteriaSymbol( key );
 
 			gotbody = true;
 		}
@@ -2565,6 +3142,7 @@ void CResponseSystem::ParseRule( void )
 	if ( validRule )
 	{
 		m_Rules.Insert( ruleName, newRule );
+		m_bRuleIndexDirty = true;
 	}
 	else
 	{
@@ -2736,6 +3314,18 @@ public:
 		ResetResponseGroups();
 	}
 
+	void CompileAllResponseSystems()
+	{
+		SaveRuleSetImage( GetScriptFile() );
+
+		int c = m_InstancedSystems.Count();
+		for ( int i = 0; i < c; i++ )
+		{
+			CInstancedResponseSystem *sys = m_InstancedSystems[ i ];
+			sys->SaveRuleSetImage( sys->GetScriptFile() );
+		}
+	}
+
 	void ReloadAllResponseSystems()
 	{
 		Clear();
@@ -2775,6 +3365,11 @@ CON_COMMAND( rr_reloadresponsesystems, "Reload all response system scripts." )
 	defaultresponsesytem.ReloadAllResponseSystems();
 }
 
+CON_COMMAND( rr_compileresponses, "Write compiled images of all loaded response system scripts." )
+{
+	defaultresponsesytem.CompileAllResponseSystems();
+}
+
 static short RESPONSESYSTEM_SAVE_RESTORE_VERSION = 1;
 
 // note:  this won't save/restore settings from instanced response systems.  Could add that with a CDefSaveRestoreOps implementation if needed
@@ -59,6 +59,7 @@
 #include "datacache/imdlcache.h"
 #include "ModelSoundsCache.h"
 #include "env_debughistory.h"
+#include "trigger_broadphase.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -955,6 +956,9 @@ void CBaseEntity::SetParent( CBaseEntity *pParentEntity, int iAttachment )
 		}
 	}
 	CollisionRulesChanged();
+
+	// A parented trigger can move, so it can't stay in the static trigger broadphase
+	g_TriggerBroadphase.TriggerMoved( this );
 }
 
 //-----------------------------------------------------------------------------
@@ -2264,9 +2268,11 @@ void CBaseEntity::PhysicsTouchTriggers( const Vector *pPrevAbsOrigin )
 		if ( isSolidCheckTriggers )
 		{
 			engine->SolidMoved( pEdict, CollisionProp(), pPrevAbsOrigin );
+			g_TriggerBroadphase.SolidMoved( this, pPrevAbsOrigin );
 		}
 		if ( isTriggerCheckSolids )
 		{
+			g_TriggerBroadphase.TriggerMoved( this );
 			engine->TriggerMoved( pEdict );
 		}
 	}
@@ -2825,6 +2831,30 @@ void CBaseEntity::OnSave( IEntitySaveUtils *pUtils )
 	CalcAbsoluteVelocity();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns the soonest tick any of our think functions are set for,
+//			used by the think scheduler to bucket this entity
+//-----------------------------------------------------------------------------
+int CBaseEntity::GetEarliestThinkTick()
+{
+	int nEarliest = TICK_NEVER_THINK;
+	if ( m_nNextThinkTick > 0 )
+	{
+		nEarliest = m_nNextThinkTick;
+	}
+
+	for ( int i = 0; i < m_aThinkFunctions.Count(); i++ )
+	{
+		int nTick = m_aThinkFunctions[i].m_nNextThinkTick;
+		if ( nTick > 0 && ( nEarliest == TICK_NEVER_THINK || nTick < nEarliest ) )
+		{
+			nEarliest = nTick;
+		}
+	}
+
+	return nEarliest;
+}
+
 //-----------------------------------------------------------------------------
 // handler to do stuff after you are restored
 //-----------------------------------------------------------------------------
@@ -3007,6 +3037,9 @@ void CBaseEntity::SetMoveType( MoveType_t val, MoveCollide_t moveCollide )
 
 	CollisionRulesChanged();
 
+	// Only MOVETYPE_NONE triggers stay in the static trigger broadphase
+	g_TriggerBroadphase.TriggerMoved( this );
+
 	switch( m_MoveType )
 	{
 	case MOVETYPE_WALK:
@@ -5508,24 +5541,62 @@ void CBaseEntity::RemoveAllDecals( void )
 	MessageEnd();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The map name and global states are the same for every speaker, so
+//  they're only rebuilt when one of them changes instead of on every query.
+//-----------------------------------------------------------------------------
+static void AppendWorldStateCriteria( AI_CriteriaSet& set )
+{
+	static AI_CriteriaSet s_WorldCriteria;
+	static int s_nGlobalChangeCount = -1;
+	static char s_szMapName[MAX_PATH] = "";
+
+	// Compare the text, not the string_t; its pointer isn't guaranteed to change between maps
+	const char *pszMapName = STRING( gpGlobals->mapname );
+	if ( s_nGlobalChangeCount != GlobalEntity_GetChangeCount() || Q_stricmp( s_szMapName, pszMapName ) )
+	{
+		s_nGlobalChangeCount = GlobalEntity_GetChangeCount();
+		Q_strncpy( s_szMapName, pszMapName, sizeof( s_szMapName ) );
+
+		s_WorldCriteria.RemoveAll();
+
+		// Append map name
+		s_WorldCriteria.AppendCriteria( "map", pszMapName );
+
+		// Go through all the global states and append them
+		for ( int i = 0; i < GlobalEntity_GetNumGlobals(); i++ ) 
+		{
+			const char *szGlobalName = GlobalEntity_GetName(i);
+			int iGlobalState = (int)GlobalEntity_GetStateByIndex(i);
+			s_WorldCriteria.AppendCriteria( szGlobalName, UTIL_VarArgs( "%i", iGlobalState ) );
+		}
+	}
+
+	set.Merge( s_WorldCriteria );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
 //-----------------------------------------------------------------------------
 void CBaseEntity::ModifyOrAppendCriteria( AI_CriteriaSet& set )
 {
+	static UtlSymId_t randomnumSym = AI_CriteriaSet::ComputeCriteriaSymbol( "randomnum" );
+	static UtlSymId_t classnameSym = AI_CriteriaSet::ComputeCriteriaSymbol( "classname" );
+	static UtlSymId_t nameSym = AI_CriteriaSet::ComputeCriteriaSymbol( "name" );
+	static UtlSymId_t healthSym = AI_CriteriaSet::ComputeCriteriaSymbol( "health" );
+	static UtlSymId_t healthfracSym = AI_CriteriaSet::ComputeCriteriaSymbol( "healthfrac" );
+
 	// TODO
 	// Append chapter/day?
 
-	set.AppendCriteria( "randomnum", UTIL_VarArgs("%d", RandomInt(0,100)) );
-	// Append map name
-	set.AppendCriteria( "map", gpGlobals->mapname.ToCStr() );
+	set.AppendCriteria( randomnumSym, UTIL_VarArgs("%d", RandomInt(0,100)) );
 	// Append our classname and game name
-	set.AppendCriteria( "classname", GetClassname() );
-	set.AppendCriteria( "name", GetEntityName().ToCStr() );
+	set.AppendCriteria( classnameSym, GetClassname() );
+	set.AppendCriteria( nameSym, GetEntityName().ToCStr() );
 
 	// Append our health
-	set.AppendCriteria( "health", UTIL_VarArgs( "%i", GetHealth() ) );
+	set.AppendCriteria( healthSym, UTIL_VarArgs( "%i", GetHealth() ) );
 
 	float healthfrac = 0.0f;
 	if ( GetMaxHealth() > 0 )
@@ -5533,16 +5604,10 @@ void CBaseEntity::ModifyOrAppendCriteria( AI_CriteriaSet& set )
 		healthfrac = (float)GetHealth() / (float)GetMaxHealth();
 	}
 
-	set.AppendCriteria( "healthfrac", UTIL_VarArgs( "%.3f", healthfrac ) );
-
-	// Go through all the global states and append them
+	set.AppendCriteria( healthfracSym, UTIL_VarArgs( "%.3f", healthfrac ) );
 
-	for ( int i = 0; i < GlobalEntity_GetNumGlobals(); i++ ) 
-	{
-		const char *szGlobalName = GlobalEntity_GetName(i);
-		int iGlobalState = (int)GlobalEntity_GetStateByIndex(i);
-		set.AppendCriteria( szGlobalName, UTIL_VarArgs( "%i", iGlobalState ) );
-	}
+	// Map name and global states
+	AppendWorldStateCriteria( set );
 
 	// Append anything from I/O or keyvalues pairs
 	AppendContextToCriteria( set );
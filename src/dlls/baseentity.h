@@ -705,6 +705,7 @@ public:
 	float	GetLastThink( const char *szContext = NULL );
 	int		GetNextThinkTick( const char *szContext = NULL );
 	int		GetLastThinkTick( const char *szContext = NULL );
+	int		GetEarliestThinkTick();	// Soonest tick of any think function, or TICK_NEVER_THINK
 
 	float				GetAnimTime() const;
 	void				SetAnimTime( float at );
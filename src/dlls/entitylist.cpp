@@ -136,20 +136,46 @@ int __cdecl CompareEntityThinkTimes( const unsigned short *pIndex0, const unsign
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+// Entities that simulate are visited every frame. Entities that only think are
+// kept in a calendar queue bucketed by the tick of their next think, so a frame
+// only visits the thinkers that are due.
+static void ThinkSchedulerChanged( ConVar *var, char const *pOldString );
+ConVar sv_think_scheduler( "sv_think_scheduler", "1", 0, "Only visit entities that don't simulate on the ticks they're due to think", ThinkSchedulerChanged );
+
+#define THINK_BUCKET_COUNT		256		// Must be a power of two
+#define THINK_BUCKET_MASK		( THINK_BUCKET_COUNT - 1 )
+#define THINK_NOT_SCHEDULED		0x7FFFFFFF
+
 class CSimThinkManager : public IEntityListener
 {
 public:
 	CSimThinkManager()
 	{
 		Clear();
+		ResetStats();
 	}
 	void Clear()
 	{
 		m_simThinkList.Purge();
+		m_thinkList.Purge();
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_thinkIndex[i] = 0xFFFF;
+			m_scheduledTick[i] = THINK_NOT_SCHEDULED;
+			m_visitedTick[i] = -1;
+		}
+		ClearSchedule();
+	}
+	void ClearSchedule()
+	{
+		for ( int i = 0; i < THINK_BUCKET_COUNT; i++ )
+		{
+			m_thinkBuckets[i].Purge();
 		}
+		m_thoughtThisTick.Purge();
+		m_nServicedTick = -1;
+		m_bRunningThinks = false;
 	}
 	void LevelInitPreEntity()
 	{
@@ -165,10 +191,12 @@ public:
 	void OnEntityCreated( CBaseEntity *pEntity )
 	{
 		Assert( m_entinfoIndex[pEntity->GetRefEHandle().GetEntryIndex()] == 0xFFFF );
+		Assert( m_thinkIndex[pEntity->GetRefEHandle().GetEntryIndex()] == 0xFFFF );
 	}
 	void OnEntityDeleted( CBaseEntity *pEntity )
 	{
 		RemoveEntinfoIndex( pEntity->GetRefEHandle().GetEntryIndex() );
+		RemoveThinker( pEntity->GetRefEHandle().GetEntryIndex() );
 	}
 
 	void RemoveEntinfoIndex( int index )
@@ -188,25 +216,188 @@ public:
 			}
 		}
 	}
+	void RemoveThinker( int index )
+	{
+		// Any bucket entries left behind are stale now and get dropped when their tick comes up
+		m_scheduledTick[index] = THINK_NOT_SCHEDULED;
+
+		int listHandle = m_thinkIndex[index];
+		if ( listHandle != 0xFFFF )
+		{
+			Assert(m_thinkList[listHandle] == index);
+			m_thinkList.FastRemove( listHandle );
+			m_thinkIndex[index] = 0xFFFF;
+
+			if ( listHandle < m_thinkList.Count() )
+			{
+				m_thinkIndex[m_thinkList[listHandle]] = listHandle;
+			}
+		}
+	}
 	int ListCount()
 	{
-		return m_simThinkList.Count();
+		return m_simThinkList.Count() + m_thinkList.Count();
 	}
 
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
-		int count = min(listMax, ListCount());
-		for ( int i = 0; i < count; i++ )
+		int count = 0;
+		for ( int i = 0; i < m_simThinkList.Count() && count < listMax; i++ )
+		{
+			pList[count++] = GetEntity( m_simThinkList[i] );
+		}
+		for ( int i = 0; i < m_thinkList.Count() && count < listMax; i++ )
+		{
+			pList[count++] = GetEntity( m_thinkList[i] );
+		}
+
+		return count;
+	}
+
+	// Copies out the entities to run this frame: everything that simulates,
+	// plus the thinkers whose bucket comes up this tick, in think time order
+	int ListCopyDue( CBaseEntity *pList[], int listMax )
+	{
+		int tick = gpGlobals->tickcount;
+		int count = 0;
+
+		m_thoughtThisTick.RemoveAll();
+
+		for ( int i = 0; i < m_simThinkList.Count() && count < listMax; i++ )
+		{
+			m_visitedTick[ m_simThinkList[i] ] = tick;
+			pList[count++] = GetEntity( m_simThinkList[i] );
+		}
+		m_nScanned += m_simThinkList.Count();
+
+		if ( !sv_think_scheduler.GetBool() )
+		{
+			for ( int i = 0; i < m_thinkList.Count() && count < listMax; i++ )
+			{
+				pList[count++] = GetEntity( m_thinkList[i] );
+			}
+			m_nScanned += m_thinkList.Count();
+			m_nThought += m_thinkList.Count();
+			m_nFrames++;
+			return count;
+		}
+
+		// Drain every bucket between the last serviced tick and now
+		int firstTick = m_nServicedTick + 1;
+		if ( tick - firstTick >= THINK_BUCKET_COUNT )
 		{
-			int entinfoIndex = m_simThinkList[i];
-			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
-			pList[i] = (CBaseEntity *)pInfo->m_pEntity;
-			Assert( gEntList.IsEntityPtr( pList[i] ) );
+			firstTick = tick - THINK_BUCKET_COUNT + 1;
 		}
+		m_nServicedTick = tick;
+		m_bRunningThinks = true;
 
+		int firstThinker = count;
+		for ( int t = firstTick; t <= tick; t++ )
+		{
+			count = DrainBucket( m_thinkBuckets[ t & THINK_BUCKET_MASK ], tick, pList, count, listMax );
+		}
+
+		// The old think list ran thinkers lowest think time first
+		SortByThinkTick( pList + firstThinker, count - firstThinker );
+
+		m_nFrames++;
 		return count;
 	}
 
+	// Copies out thinkers that entities which already ran this frame scheduled for
+	// this same tick. Each entity still runs at most once a tick; call until it returns 0.
+	int ListCopyLate( CBaseEntity *pList[], int listMax )
+	{
+		if ( !m_bRunningThinks )
+			return 0;
+
+		int count = DrainBucket( m_thinkBuckets[ m_nServicedTick & THINK_BUCKET_MASK ], m_nServicedTick, pList, 0, listMax );
+		SortByThinkTick( pList, count );
+		return count;
+	}
+
+	// Puts everything that ran this frame back in the calendar at its next think
+	void RescheduleThinkers()
+	{
+		m_bRunningThinks = false;
+
+		for ( int i = 0; i < m_thoughtThisTick.Count(); i++ )
+		{
+			int index = m_thoughtThisTick[i];
+			if ( m_thinkIndex[index] == 0xFFFF )
+				continue;
+
+			CBaseEntity *pEntity = GetEntity( index );
+			if ( pEntity )
+			{
+				ScheduleThink( index, pEntity->GetEarliestThinkTick() );
+			}
+		}
+		m_thoughtThisTick.RemoveAll();
+	}
+
+	// Called whenever an entity sets a think time
+	void ThinkScheduled( CBaseEntity *pEntity, int thinkTick )
+	{
+		const CBaseHandle &eh = pEntity->GetRefEHandle();
+		if ( !eh.IsValid() )
+			return;
+
+		ScheduleThink( eh.GetEntryIndex(), thinkTick );
+	}
+
+	void ScheduleThink( int index, int thinkTick )
+	{
+		// Simulating entities are visited every frame anyway
+		if ( thinkTick <= 0 || m_thinkIndex[index] == 0xFFFF )
+			return;
+
+		// Rebuilt from scratch when the scheduler is turned back on
+		if ( !sv_think_scheduler.GetBool() )
+			return;
+
+		// This tick's list has already gone out. Entities that haven't run yet this tick
+		// are picked up by ListCopyLate; the rest only run once a tick, so anything due
+		// now waits for the next one (same as the old per-frame polling)
+		int earliestTick = m_nServicedTick + 1;
+		if ( m_bRunningThinks && m_visitedTick[index] != m_nServicedTick )
+		{
+			earliestTick = m_nServicedTick;
+		}
+		thinkTick = max( thinkTick, earliestTick );
+
+		// Already scheduled no later than this. If the think has since been pushed
+		// back, we'll find that out when the earlier entry comes up.
+		if ( thinkTick >= m_scheduledTick[index] )
+			return;
+
+		MEM_ALLOC_CREDIT();
+		m_scheduledTick[index] = thinkTick;
+
+		ThinkBucketEntry_t entry;
+		entry.index = (unsigned short)index;
+		entry.tick = thinkTick;
+		m_thinkBuckets[ thinkTick & THINK_BUCKET_MASK ].AddToTail( entry );
+	}
+
+	// Rebuilds the calendar from scratch, used when the scheduler is turned back on
+	void RescheduleAll()
+	{
+		ClearSchedule();
+		m_nServicedTick = gpGlobals->tickcount;
+		for ( int i = 0; i < m_thinkList.Count(); i++ )
+		{
+			int index = m_thinkList[i];
+			m_scheduledTick[index] = THINK_NOT_SCHEDULED;
+
+			CBaseEntity *pEntity = GetEntity( index );
+			if ( pEntity )
+			{
+				ScheduleThink( index, pEntity->GetEarliestThinkTick() );
+			}
+		}
+	}
+
 	void EntityChanged( CBaseEntity *pEntity )
 	{
 		// might change after deletion, don't put back into the list
@@ -218,16 +409,11 @@ public:
 			return;
 
 		int index = eh.GetEntryIndex();
-		// UNDONE: Maintain separate lists for "no think/no sim" and just "no sim"
-		// UNDONE: Keep "no sim" list sorted by thinktime
-		// UNDONE: Add query for "no sim" list that includes a time and just get ents that will think by that time
-		if ( pEntity->IsEFlagSet( EFL_NO_THINK_FUNCTION ) && pEntity->IsEFlagSet( EFL_NO_GAME_PHYSICS_SIMULATION ) )
-		{
-			Assert( !pEntity->IsPlayer() );
-			RemoveEntinfoIndex( index );
-		}
-		else
+		if ( !pEntity->IsEFlagSet( EFL_NO_GAME_PHYSICS_SIMULATION ) )
 		{
+			// Simulates every frame, which also runs its thinks
+			RemoveThinker( index );
+
 			// already in the list? (had think or sim last time, now has both - or had both last time, now just one)
 			if ( m_entinfoIndex[index] == 0xFFFF )
 			{
@@ -235,6 +421,25 @@ public:
 				m_entinfoIndex[index] = m_simThinkList.AddToTail( (unsigned short)index );
 			}
 		}
+		else if ( !pEntity->IsEFlagSet( EFL_NO_THINK_FUNCTION ) )
+		{
+			// Only thinks, so only needs visiting when a think is due
+			RemoveEntinfoIndex( index );
+
+			if ( m_thinkIndex[index] == 0xFFFF )
+			{
+				MEM_ALLOC_CREDIT();
+				m_thinkIndex[index] = m_thinkList.AddToTail( (unsigned short)index );
+			}
+
+			ScheduleThink( index, pEntity->GetEarliestThinkTick() );
+		}
+		else
+		{
+			Assert( !pEntity->IsPlayer() );
+			RemoveEntinfoIndex( index );
+			RemoveThinker( index );
+		}
 	}
 
 	void ListSort()
@@ -253,9 +458,119 @@ public:
 			m_entinfoIndex[m_simThinkList[i]] = i;
 		}
 	}
+
+	void ReportStats()
+	{
+		Msg( "Think scheduler: %d simulating, %d thinking only\n", m_simThinkList.Count(), m_thinkList.Count() );
+		if ( m_nFrames )
+		{
+			Msg( "  %d frames, %.1f entities scanned and %.1f thought per frame\n",
+				m_nFrames, (float)m_nScanned / m_nFrames, (float)m_nThought / m_nFrames );
+		}
+	}
+
+	void ResetStats()
+	{
+		m_nFrames = 0;
+		m_nScanned = 0;
+		m_nThought = 0;
+	}
+
 private:
+	CBaseEntity *GetEntity( int index )
+	{
+		const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( index );
+		CBaseEntity *pEntity = (CBaseEntity *)pInfo->m_pEntity;
+		Assert( gEntList.IsEntityPtr( pEntity ) );
+		return pEntity;
+	}
+
+	struct ThinkBucketEntry_t
+	{
+		unsigned short	index;
+		int				tick;
+	};
+
+	// Pulls the entries due by tick out of a bucket, in the order they were queued
+	int DrainBucket( CUtlVector<ThinkBucketEntry_t> &bucket, int tick, CBaseEntity *pList[], int count, int listMax )
+	{
+		m_nScanned += bucket.Count();
+
+		int nKept = 0;
+		for ( int i = 0; i < bucket.Count(); i++ )
+		{
+			ThinkBucketEntry_t entry = bucket[i];
+			int index = entry.index;
+
+			// Rescheduled or removed since this was queued
+			if ( m_scheduledTick[index] != entry.tick )
+				continue;
+
+			// Due on a later lap around the calendar
+			if ( entry.tick > tick )
+			{
+				bucket[nKept++] = entry;
+				continue;
+			}
+
+			m_scheduledTick[index] = THINK_NOT_SCHEDULED;
+			m_visitedTick[index] = tick;
+			m_thoughtThisTick.AddToTail( index );
+			m_nThought++;
+			if ( count < listMax )
+			{
+				pList[count++] = GetEntity( index );
+			}
+		}
+		bucket.RemoveMultiple( nKept, bucket.Count() - nKept );
+
+		return count;
+	}
+
+	// Stable insertion sort by earliest think tick; only a handful are due at once
+	void SortByThinkTick( CBaseEntity *pList[], int count )
+	{
+		m_sortKeys.SetCount( count );
+		for ( int i = 0; i < count; i++ )
+		{
+			m_sortKeys[i] = pList[i] ? pList[i]->GetEarliestThinkTick() : 0;
+		}
+
+		for ( int i = 1; i < count; i++ )
+		{
+			CBaseEntity *pEntity = pList[i];
+			int key = m_sortKeys[i];
+			int j;
+			for ( j = i; j > 0 && m_sortKeys[j-1] > key; j-- )
+			{
+				pList[j] = pList[j-1];
+				m_sortKeys[j] = m_sortKeys[j-1];
+			}
+			pList[j] = pEntity;
+			m_sortKeys[j] = key;
+		}
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<unsigned short>	m_simThinkList;
+
+	// Entities that think but don't simulate
+	unsigned short m_thinkIndex[NUM_ENT_ENTRIES];
+	CUtlVector<unsigned short>	m_thinkList;
+
+	// Calendar queue of thinkers, bucketed by tick
+	int							m_scheduledTick[NUM_ENT_ENTRIES];	// Tick of the live bucket entry for each thinker
+	CUtlVector<ThinkBucketEntry_t> m_thinkBuckets[THINK_BUCKET_COUNT];
+	CUtlVector<unsigned short>	m_thoughtThisTick;
+	int							m_visitedTick[NUM_ENT_ENTRIES];		// Last tick each entity was handed out to run
+	int							m_nServicedTick;
+	bool						m_bRunningThinks;					// Between ListCopyDue and RescheduleThinkers
+	CUtlVector<int>				m_sortKeys;
+
+	// Stats
+	int		m_nFrames;
+	int		m_nScanned;
+	int		m_nThought;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -270,16 +585,54 @@ int SimThink_ListCopy( CBaseEntity *pList[], int listMax )
 	return g_SimThinkManager.ListCopy( pList, listMax );
 }
 
+int SimThink_ListCopyDue( CBaseEntity *pList[], int listMax )
+{
+	return g_SimThinkManager.ListCopyDue( pList, listMax );
+}
+
+int SimThink_ListCopyLate( CBaseEntity *pList[], int listMax )
+{
+	return g_SimThinkManager.ListCopyLate( pList, listMax );
+}
+
+void SimThink_RescheduleThinkers()
+{
+	g_SimThinkManager.RescheduleThinkers();
+}
+
 void SimThink_EntityChanged( CBaseEntity *pEntity )
 {
 	g_SimThinkManager.EntityChanged( pEntity );
 }
 
+void SimThink_ThinkScheduled( CBaseEntity *pEntity, int thinkTick )
+{
+	g_SimThinkManager.ThinkScheduled( pEntity, thinkTick );
+}
+
 void SimThink_SortThinkList()
 {
 	g_SimThinkManager.ListSort();
 }
 
+static void ThinkSchedulerChanged( ConVar *var, char const *pOldString )
+{
+	if ( sv_think_scheduler.GetBool() )
+	{
+		g_SimThinkManager.RescheduleAll();
+	}
+}
+
+CON_COMMAND( sv_think_scheduler_stats, "Report entities scanned versus thought per frame. Pass \"reset\" to clear them" )
+{
+	g_SimThinkManager.ReportStats();
+
+	if ( engine->Cmd_Argc() > 1 && !Q_stricmp( engine->Cmd_Argv( 1 ), "reset" ) )
+	{
+		g_SimThinkManager.ResetStats();
+	}
+}
+
 // This manages a list of entities queued up to receive PostClientMessages callbacks
 class CPostClientMessageManager
 {
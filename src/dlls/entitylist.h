@@ -361,6 +361,10 @@ void AimTarget_ForceRepopulateList();
 void SimThink_EntityChanged( CBaseEntity *pEntity );
 int SimThink_ListCount();
 int SimThink_ListCopy( CBaseEntity *pList[], int listMax );
+int SimThink_ListCopyDue( CBaseEntity *pList[], int listMax );
+int SimThink_ListCopyLate( CBaseEntity *pList[], int listMax );
+void SimThink_RescheduleThinkers();
+void SimThink_ThinkScheduled( CBaseEntity *pEntity, int thinkTick );
 void SimThink_SortThinkList();
 
 #endif // ENTITYLIST_H
@@ -66,6 +66,7 @@
 #include "util.h"
 #include "vstdlib/ICommandLine.h"
 #include "datacache/imdlcache.h"
+#include "bone_setup.h"
 #include "engine/iserverplugin.h"
 #ifdef _WIN32
 #include "ienginevgui.h"
@@ -950,6 +951,9 @@ void CServerGameDLL::GameFrame( bool simulating )
 	if ( g_InRestore )
 		return;
 
+	// Free bone caches retired two or more frames ago
+	Studio_BoneCacheNewFrame();
+
 	static bool skipframe = false;
 
 	// If server is skipping frames, don't run simulation this time through
@@ -29,7 +29,7 @@ struct globalentity_t
 class CGlobalState : public CAutoGameSystem
 {
 public:
-	CGlobalState( char const *name ) : CAutoGameSystem( name ), m_disableStateUpdates(false)
+	CGlobalState( char const *name ) : CAutoGameSystem( name ), m_disableStateUpdates(false), m_nChangeCount(0)
 	{
 	}
 
@@ -55,7 +55,11 @@ public:
 	{
 		if ( m_disableStateUpdates || !m_list.IsValidIndex(globalIndex) )
 			return;
-		m_list[globalIndex].state = state;
+		if ( m_list[globalIndex].state != state )
+		{
+			m_list[globalIndex].state = state;
+			++m_nChangeCount;
+		}
 	}
 	GLOBALESTATE GetState( int globalIndex )
 	{
@@ -107,6 +111,7 @@ public:
 		int index = GetIndex( m_nameList.String( entity.name ) );
 		if ( index >= 0 )
 			return index;
+		++m_nChangeCount;
 		return m_list.AddToTail( entity );
 	}
 
@@ -115,6 +120,11 @@ public:
 		return m_list.Count();
 	}
 
+	int GetChangeCount( void )
+	{
+		return m_nChangeCount;
+	}
+
 	void			Reset( void );
 	int				Save( ISave &save );
 	int				Restore( IRestore &restore );
@@ -128,6 +138,7 @@ public:
 	CUtlSymbolTable	m_nameList;
 private:
 	bool			m_disableStateUpdates;
+	int				m_nChangeCount;		// Bumped whenever a global is added or changes state
 	CUtlVector<globalentity_t> m_list;
 };
 
@@ -182,6 +193,11 @@ int GlobalEntity_GetNumGlobals( void )
 	return gGlobalState.GetNumGlobals();
 }
 
+int GlobalEntity_GetChangeCount( void )
+{
+	return gGlobalState.GetChangeCount();
+}
+
 CON_COMMAND(dump_globals, "Dump all global entities/states")
 {
 	gGlobalState.DumpGlobals();
@@ -229,6 +245,8 @@ int CGlobalState::Restore( IRestore &restore )
 	Reset();
 	if ( !restore.ReadFields( "GLOBAL", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
+
+	++m_nChangeCount;
 	
 	return 1;
 }
@@ -237,6 +255,7 @@ void CGlobalState::Reset( void )
 {
 	m_list.Purge();
 	m_nameList.RemoveAll();
+	++m_nChangeCount;
 }
 
 
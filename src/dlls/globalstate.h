@@ -23,6 +23,7 @@ const char	*GlobalEntity_GetMap( int globalIndex );
 const char	*GlobalEntity_GetName( int globalIndex );
 
 int			GlobalEntity_GetNumGlobals( void );
+int			GlobalEntity_GetChangeCount( void );	// Changes whenever any global is added or changes state
 void		GlobalEntity_EnableStateUpdates( bool bEnable );
 
 inline int GlobalEntity_Add( string_t globalname, string_t mapName, GLOBALESTATE state )
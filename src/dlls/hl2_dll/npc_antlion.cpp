@@ -826,13 +826,13 @@ void CNPC_Antlion::HandleAnimEvent( animevent_t *pEvent )
 
 	if ( pEvent->event == AE_ANTLION_FOOTSTEP_SOFT )
 	{
-		EmitSound( "NPC_Antlion.FootstepSoft", pEvent->eventtime );
+		EMIT_SOUND_CACHED( this, "NPC_Antlion.FootstepSoft", pEvent->eventtime );
 		return;
 	}
 
 	if ( pEvent->event == AE_ANTLION_FOOTSTEP_HEAVY )
 	{
-		EmitSound( "NPC_Antlion.FootstepHeavy", pEvent->eventtime );
+		EMIT_SOUND_CACHED( this, "NPC_Antlion.FootstepHeavy", pEvent->eventtime );
 		return;
 	}
 	
@@ -1335,7 +1335,7 @@ void CNPC_AntlionGuard::Footstep( bool bHeavy )
 			EmitSound( filter, entindex(), soundParams );
 		}
 
-		EmitSound( "NPC_AntlionGuard.FarStepHeavy" );
+		EMIT_SOUND_CACHED( this, "NPC_AntlionGuard.FarStepHeavy", 0.0f );
 	}
 	else
 	{
@@ -1347,7 +1347,7 @@ void CNPC_AntlionGuard::Footstep( bool bHeavy )
 			EmitSound( filter, entindex(), soundParams );
 		}
 
-		EmitSound( "NPC_AntlionGuard.FarStepLight" );
+		EMIT_SOUND_CACHED( this, "NPC_AntlionGuard.FarStepLight", 0.0f );
 	}
 }
 
@@ -1519,7 +1519,7 @@ void CNPC_AntlionGuard::HandleAnimEvent( animevent_t *pEvent )
 #if HL2_EPISODIC
 			Footstep( true );
 #else 
-			EmitSound( "NPC_AntlionGuard.Inside.StepHeavy", pEvent->eventtime );
+			EMIT_SOUND_CACHED( this, "NPC_AntlionGuard.Inside.StepHeavy", pEvent->eventtime );
 #endif // HL2_EPISODIC
 		}
 		else
@@ -1527,7 +1527,7 @@ void CNPC_AntlionGuard::HandleAnimEvent( animevent_t *pEvent )
 #if HL2_EPISODIC
 			Footstep( true );
 #else 
-			EmitSound( "NPC_AntlionGuard.StepHeavy", pEvent->eventtime );
+			EMIT_SOUND_CACHED( this, "NPC_AntlionGuard.StepHeavy", pEvent->eventtime );
 #endif // HL2_EPISODIC
 		}
 		return;
@@ -169,12 +169,12 @@ void CNPC_Barney::HandleAnimEvent( animevent_t *pEvent )
 	{
 	case NPC_EVENT_LEFTFOOT:
 		{
-			EmitSound( "NPC_Barney.FootstepLeft", pEvent->eventtime );
+			EMIT_SOUND_CACHED( this, "NPC_Barney.FootstepLeft", pEvent->eventtime );
 		}
 		break;
 	case NPC_EVENT_RIGHTFOOT:
 		{
-			EmitSound( "NPC_Barney.FootstepRight", pEvent->eventtime );
+			EMIT_SOUND_CACHED( this, "NPC_Barney.FootstepRight", pEvent->eventtime );
 		}
 		break;
 
@@ -857,11 +857,11 @@ void CFastZombie::FootstepSound( bool fRightFoot )
 {
 	if( fRightFoot )
 	{
-		EmitSound( "NPC_FastZombie.FootstepRight" );
+		EMIT_SOUND_CACHED( this, "NPC_FastZombie.FootstepRight", 0.0f );
 	}
 	else
 	{
-		EmitSound( "NPC_FastZombie.FootstepLeft" );
+		EMIT_SOUND_CACHED( this, "NPC_FastZombie.FootstepLeft", 0.0f );
 	}
 }
 
@@ -172,11 +172,11 @@ void CNPC_Fisherman::HandleAnimEvent( animevent_t *pEvent )
 {
 	if ( pEvent->event == NPC_EVENT_LEFTFOOT )
 	{
-		EmitSound( "NPC_Fisherman.FootstepLeft", pEvent->eventtime );
+		EMIT_SOUND_CACHED( this, "NPC_Fisherman.FootstepLeft", pEvent->eventtime );
 	}
 	else if ( pEvent->event == NPC_EVENT_RIGHTFOOT )
 	{
-		EmitSound( "NPC_Fisherman.FootstepRight", pEvent->eventtime );
+		EMIT_SOUND_CACHED( this, "NPC_Fisherman.FootstepRight", pEvent->eventtime );
 	}
 	else if ( pEvent->event == AE_FISHERMAN_HAT_UP )
 	{
@@ -3332,11 +3332,11 @@ void CBlackHeadcrab::HandleAnimEvent( animevent_t *pEvent )
 
 		if ( walk )
 		{
-			EmitSound( "NPC_BlackHeadcrab.FootstepWalk" );
+			EMIT_SOUND_CACHED( this, "NPC_BlackHeadcrab.FootstepWalk", 0.0f );
 		}
 		else
 		{
-			EmitSound( "NPC_BlackHeadcrab.Footstep" );
+			EMIT_SOUND_CACHED( this, "NPC_BlackHeadcrab.Footstep", 0.0f );
 		}
 
 		return;
@@ -351,12 +351,12 @@ void CNPC_Monk::HandleAnimEvent( animevent_t *pEvent )
 	{
 		case NPC_EVENT_LEFTFOOT:
 			{
-				EmitSound( "NPC_Citizen.FootstepLeft", pEvent->eventtime );
+				EMIT_SOUND_CACHED( this, "NPC_Citizen.FootstepLeft", pEvent->eventtime );
 			}
 			break;
 		case NPC_EVENT_RIGHTFOOT:
 			{
-				EmitSound( "NPC_Citizen.FootstepRight", pEvent->eventtime );
+				EMIT_SOUND_CACHED( this, "NPC_Citizen.FootstepRight", pEvent->eventtime );
 			}
 			break;
 
@@ -1014,11 +1014,11 @@ void CNPC_PoisonZombie::FootstepSound( bool fRightFoot )
 {
 	if( fRightFoot )
 	{
-		EmitSound( "NPC_PoisonZombie.FootstepRight" );
+		EMIT_SOUND_CACHED( this, "NPC_PoisonZombie.FootstepRight", 0.0f );
 	}
 	else
 	{
-		EmitSound( "NPC_PoisonZombie.FootstepLeft" );
+		EMIT_SOUND_CACHED( this, "NPC_PoisonZombie.FootstepLeft", 0.0f );
 	}
 
 	if( ShouldPlayFootstepMoan() )
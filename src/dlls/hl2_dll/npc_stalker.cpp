@@ -1248,12 +1248,12 @@ void CNPC_Stalker::HandleAnimEvent( animevent_t *pEvent )
 	{
 		case NPC_EVENT_LEFTFOOT:
 			{
-				EmitSound( "NPC_Stalker.FootstepLeft", pEvent->eventtime );
+				EMIT_SOUND_CACHED( this, "NPC_Stalker.FootstepLeft", pEvent->eventtime );
 			}
 			break;
 		case NPC_EVENT_RIGHTFOOT:
 			{
-				EmitSound( "NPC_Stalker.FootstepRight", pEvent->eventtime );
+				EMIT_SOUND_CACHED( this, "NPC_Stalker.FootstepRight", pEvent->eventtime );
 			}
 			break;
 
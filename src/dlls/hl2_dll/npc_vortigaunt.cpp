@@ -1097,13 +1097,13 @@ void CNPC_Vortigaunt::HandleAnimEvent( animevent_t *pEvent )
 
 	if ( pEvent->event == AE_NPC_LEFTFOOT )
 	{
-		EmitSound( "NPC_Vortigaunt.FootstepLeft", pEvent->eventtime );
+		EMIT_SOUND_CACHED( this, "NPC_Vortigaunt.FootstepLeft", pEvent->eventtime );
 		return;
 	}
 
 	if ( pEvent->event == AE_NPC_RIGHTFOOT )
 	{
-		EmitSound( "NPC_Vortigaunt.FootstepRight", pEvent->eventtime );
+		EMIT_SOUND_CACHED( this, "NPC_Vortigaunt.FootstepRight", pEvent->eventtime );
 		return;
 	}
 	
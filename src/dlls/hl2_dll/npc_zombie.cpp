@@ -328,11 +328,11 @@ void CZombie::FootstepSound( bool fRightFoot )
 {
 	if( fRightFoot )
 	{
-		EmitSound(  "Zombie.FootstepRight" );
+		EMIT_SOUND_CACHED( this, "Zombie.FootstepRight", 0.0f );
 	}
 	else
 	{
-		EmitSound( "Zombie.FootstepLeft" );
+		EMIT_SOUND_CACHED( this, "Zombie.FootstepLeft", 0.0f );
 	}
 }
 
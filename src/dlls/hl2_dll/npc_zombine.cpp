@@ -768,11 +768,11 @@ void CNPC_Zombine::FootstepSound( bool fRightFoot )
 {
 	if( fRightFoot )
 	{
-		EmitSound( "Zombie.FootstepRight" );
+		EMIT_SOUND_CACHED( this, "Zombie.FootstepRight", 0.0f );
 	}
 	else
 	{
-		EmitSound( "Zombie.FootstepLeft" );
+		EMIT_SOUND_CACHED( this, "Zombie.FootstepLeft", 0.0f );
 	}
 }
 
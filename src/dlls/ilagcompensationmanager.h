@@ -12,6 +12,7 @@
 #endif
 
 class CBasePlayer;
+class CBaseEntity;
 class CUserCmd;
 
 //-----------------------------------------------------------------------------
@@ -23,6 +24,11 @@ public:
 	// Called during player movement to set up/restore after lag compensation
 	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd ) = 0;
 	virtual void	FinishLagCompensation( CBasePlayer *player ) = 0;
+
+	// Non-player entities (vehicles etc.) that should be backtracked along with players.
+	// NPCs are added automatically while sv_unlag_npcs is set.
+	virtual void	AddAdditionalEntity( CBaseEntity *pEntity ) = 0;
+	virtual void	RemoveAdditionalEntity( CBaseEntity *pEntity ) = 0;
 };
 
 extern ILagCompensationManager *lagcompensation;
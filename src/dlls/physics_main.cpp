@@ -2149,7 +2149,8 @@ void Physics_RunThinkFunctions( bool simulating )
 		
 		// UNDONE: This has problems with UTIL_RemoveImmediate() (now disabled during this loop).  
 		// Do we really need UTIL_RemoveImmediate()?
-		int count = SimThink_ListCopy( list, listMax );
+		// Thinkers that don't simulate are only in here on the ticks they're due
+		int count = SimThink_ListCopyDue( list, listMax );
 
 		//DevMsg(1, "Count: %d\n", count );
 		for ( int i = 0; i < count; i++ )
@@ -2161,6 +2162,21 @@ void Physics_RunThinkFunctions( bool simulating )
 			Physics_SimulateEntity( list[i] );
 		}
 
+		// Thinks that the entities above scheduled for this tick on thinkers that hadn't run yet
+		while ( ( count = SimThink_ListCopyLate( list, listMax ) ) > 0 )
+		{
+			for ( int i = 0; i < count; i++ )
+			{
+				if ( !list[i] )
+					continue;
+				gpGlobals->curtime = starttime;
+				Physics_SimulateEntity( list[i] );
+			}
+		}
+
+		// Put the thinkers that ran back in the schedule at their next think
+		SimThink_RescheduleThinkers();
+
 		stackfree( list );
 		UTIL_EnableRemoveImmediate();
 	}
@@ -10,8 +10,8 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utlfixedlinkedlist.h"
 #include "BaseAnimatingOverlay.h"
+#include "ai_basenpc.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -30,12 +30,21 @@
 // Allow 4 units of error ( about 1 / 8 bbox width )
 #define LAG_COMPENSATION_ERROR_EPS_SQR ( 4.0f * 4.0f )
 
+// Records kept per entity, enough for sv_maxunlag at up to 128 ticks per second
+#define MAX_LAG_RECORDS		128
+
+// Non-player entities (NPCs, vehicles) that can be lag compensated at once
+#define MAX_LAG_ADDITIONAL_ENTITIES	128
+#define MAX_LAG_SLOTS		( MAX_PLAYERS + MAX_LAG_ADDITIONAL_ENTITIES )
+
 ConVar sv_unlag( "sv_unlag", "1", 0, "Enables player lag compensation" );
 ConVar sv_maxunlag( "sv_maxunlag", "1.0", 0, "Maximum lag compensation in seconds", true, 0.0f, true, 1.0f );
 ConVar sv_lagflushbonecache( "sv_lagflushbonecache", "1", 0, "Flushes entity bone cache on lag compensation" );
 ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show lag compensated hitboxes whenever a player is lag compensated." );
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", 0, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
+ConVar sv_unlag_npcs( "sv_unlag_npcs", "1", 0, "Enables lag compensation of NPCs" );
+ConVar sv_unlag_cone( "sv_unlag_cone", "45", 0, "Entities whose backtracked bounds lie outside this cone (degrees) around the shooter's aim are not moved back (0 disables)", true, 0.0f, true, 180.0f );
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -114,6 +123,105 @@ public:
 	float					m_masterCycle;
 };
 
+//-----------------------------------------------------------------------------
+// Purpose: Ring buffer of lag records for one entity. Records are addressed
+//			by age, 0 being the newest, so simulation times decrease with age.
+//			Each record also gets a serial number so we can remember the most
+//			recent point the history can't be walked back through (death or
+//			teleport) without walking the records again.
+//-----------------------------------------------------------------------------
+class CLagRecordTrack
+{
+public:
+	CLagRecordTrack()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		m_iNewest = MAX_LAG_RECORDS - 1;
+		m_nCount = 0;
+		m_nNewestSerial = 0;
+		m_nBreakSerial = -1;
+	}
+
+	int Count() const					{ return m_nCount; }
+	LagRecord &Get( int age )			{ Assert( age >= 0 && age < m_nCount ); return m_Records[ ( m_iNewest - age ) & ( MAX_LAG_RECORDS - 1 ) ]; }
+	int Serial( int age ) const			{ return m_nNewestSerial - age; }
+
+	// Adds a new record, dropping the oldest one if the buffer is full
+	LagRecord &AddNewest()
+	{
+		m_iNewest = ( m_iNewest + 1 ) & ( MAX_LAG_RECORDS - 1 );
+		m_nCount = min( m_nCount + 1, MAX_LAG_RECORDS );
+		m_nNewestSerial++;
+		return m_Records[m_iNewest];
+	}
+
+	void RemoveOlderThan( float flDeadtime )
+	{
+		while ( m_nCount > 0 && Get( m_nCount - 1 ).m_flSimulationTime < flDeadtime )
+		{
+			m_nCount--;
+		}
+	}
+
+	// Call after filling in the newest record
+	void UpdateBreaks()
+	{
+		LagRecord &newest = Get( 0 );
+		if ( !( newest.m_fFlags & LC_ALIVE ) )
+		{
+			m_nBreakSerial = Serial( 0 );
+		}
+		else if ( m_nCount > 1 )
+		{
+			Vector delta = Get( 1 ).m_vecOrigin - newest.m_vecOrigin;
+			if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
+			{
+				m_nBreakSerial = max( m_nBreakSerial, Serial( 1 ) );
+			}
+		}
+	}
+
+	// Returns the age of the newest record at or before flTargetTime, or the
+	// oldest record if they are all newer
+	int FindRecord( float flTargetTime )
+	{
+		int lo = 0;
+		int hi = m_nCount - 1;
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) / 2;
+			if ( Get( mid ).m_flSimulationTime <= flTargetTime )
+			{
+				hi = mid;
+			}
+			else
+			{
+				lo = mid + 1;
+			}
+		}
+		return lo;
+	}
+
+	// Can we walk back from the newest record to this one without the entity
+	// having died or teleported along the way?
+	bool CanBacktrackTo( int age )
+	{
+		return ( m_nBreakSerial < Serial( age ) );
+	}
+
+private:
+	int			m_iNewest;
+	int			m_nCount;
+	int			m_nNewestSerial;
+	int			m_nBreakSerial;		// Newest record that is dead or teleported from the one before it
+
+	LagRecord	m_Records[ MAX_LAG_RECORDS ];
+};
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -123,21 +231,22 @@ public:
 ConVar sv_unlag_debug( "sv_unlag_debug", "0", FCVAR_GAMEDLL );
 
 float g_flFractionScale = 0.95;
-static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
+static void RestoreEntityTo( CBaseEntity *pEntity, const Vector &vWantedPos )
 {
 	// Try to move to the wanted position from our current position.
 	trace_t tr;
-	VPROF_BUDGET( "RestorePlayerTo", "CLagCompensationManager" );
-	UTIL_TraceEntity( pPlayer, vWantedPos, vWantedPos, MASK_PLAYERSOLID, &tr );
+	VPROF_BUDGET( "RestoreEntityTo", "CLagCompensationManager" );
+	unsigned int mask = pEntity->PhysicsSolidMaskForEntity();
+	UTIL_TraceEntity( pEntity, vWantedPos, vWantedPos, mask, &tr );
 	if ( tr.startsolid || tr.allsolid )
 	{
 		if ( sv_unlag_debug.GetBool() )
 		{
-			DevMsg( "RestorePlayerTo() could not restore player position for client \"%s\" ( %.1f %.1f %.1f )\n",
-					pPlayer->GetPlayerName(), vWantedPos.x, vWantedPos.y, vWantedPos.z );
+			DevMsg( "RestoreEntityTo() could not restore entity position for \"%s\" ( %.1f %.1f %.1f )\n",
+					pEntity->GetDebugName(), vWantedPos.x, vWantedPos.y, vWantedPos.z );
 		}
 
-		UTIL_TraceEntity( pPlayer, pPlayer->GetLocalOrigin(), vWantedPos, MASK_PLAYERSOLID, &tr );
+		UTIL_TraceEntity( pEntity, pEntity->GetLocalOrigin(), vWantedPos, mask, &tr );
 		if ( tr.startsolid || tr.allsolid )
 		{
 			// In this case, the guy got stuck back wherever we lag compensated him to. Nasty.
@@ -149,8 +258,8 @@ static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
 		{
 			// We can get to a valid place, but not all the way back to where we were.
 			Vector vPos;
-			VectorLerp( pPlayer->GetLocalOrigin(), vWantedPos, tr.fraction * g_flFractionScale, vPos );
-			UTIL_SetOrigin( pPlayer, vPos, true );
+			VectorLerp( pEntity->GetLocalOrigin(), vWantedPos, tr.fraction * g_flFractionScale, vPos );
+			UTIL_SetOrigin( pEntity, vPos, true );
 
 			if ( sv_unlag_debug.GetBool() )
 				DevMsg( " restore got most of the way\n" );
@@ -159,10 +268,28 @@ static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
 	else
 	{
 		// Cool, the player can go back to whence he came.
-		UTIL_SetOrigin( pPlayer, tr.endpos, true );
+		UTIL_SetOrigin( pEntity, tr.endpos, true );
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Could anything fired along vecForward touch these bounds?
+//-----------------------------------------------------------------------------
+static bool IsInsideLagCompensationCone( const Vector &vecEye, const Vector &vecForward, float flCone, const Vector &org, const Vector &mins, const Vector &maxs )
+{
+	Vector vecCenter = org + ( mins + maxs ) * 0.5f;
+	float flRadius = ( maxs - mins ).Length() * 0.5f;
+
+	Vector vecDelta = vecCenter - vecEye;
+	float flDist = vecDelta.Length();
+	if ( flDist <= flRadius )
+		return true;
+
+	float flCos = DotProduct( vecForward, vecDelta ) / flDist;
+	float flAngle = acos( clamp( flCos, -1.0f, 1.0f ) );
+	return ( flAngle <= flCone + asin( flRadius / flDist ) );
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -172,6 +299,11 @@ class CLagCompensationManager : public CAutoGameSystemPerFrame, public ILagCompe
 public:
 	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name )
 	{
+		Q_memset( m_pTracks, 0, sizeof( m_pTracks ) );
+		for ( int i = 0; i < MAX_EDICTS; i++ )
+			m_EntitySlot[i] = -1;
+		for ( int i = 0; i < MAX_LAG_ADDITIONAL_ENTITIES; i++ )
+			m_AdditionalEntityIndex[i] = -1;
 	}
 
 	// IServerSystem stuff
@@ -183,6 +315,7 @@ public:
 	virtual void LevelShutdownPostEntity()
 	{
 		ClearHistory();
+		ClearAdditionalEntities();
 	}
 
 	// called after entities think
@@ -194,32 +327,121 @@ public:
 	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd );
 	void			FinishLagCompensation( CBasePlayer *player );
 
+	void			AddAdditionalEntity( CBaseEntity *pEntity );
+	void			RemoveAdditionalEntity( CBaseEntity *pEntity );
+
 private:
-	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	void			BacktrackEntity( CBaseEntity *pEntity, int slot, float flTargetTime );
+	void			RecordEntity( CBaseEntity *pEntity, int slot, float flDeadtime );
+
+	CBaseEntity *	GetSlotEntity( int slot );
+
+	CLagRecordTrack *GetTrack( int slot )
+	{
+		if ( !m_pTracks[slot] )
+			m_pTracks[slot] = new CLagRecordTrack;
+		return m_pTracks[slot];
+	}
 
 	void ClearHistory()
 	{
-		for ( int i=0; i<MAX_PLAYERS; i++ )
-			m_PlayerTrack[i].Purge();
+		for ( int i=0; i<MAX_LAG_SLOTS; i++ )
+		{
+			delete m_pTracks[i];
+			m_pTracks[i] = NULL;
+		}
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	void ClearAdditionalEntities()
+	{
+		for ( int i=0; i<MAX_LAG_ADDITIONAL_ENTITIES; i++ )
+		{
+			m_AdditionalEntities[i] = NULL;
+			m_AdditionalEntityIndex[i] = -1;
+		}
+		for ( int i=0; i<MAX_EDICTS; i++ )
+			m_EntitySlot[i] = -1;
+	}
+
+	// keep a history of lag records for each player and additional entity,
+	// allocated the first time the slot is recorded
+	CLagRecordTrack *		m_pTracks[ MAX_LAG_SLOTS ];
+
+	// Non-player entities, slot MAX_PLAYERS + i
+	EHANDLE					m_AdditionalEntities[ MAX_LAG_ADDITIONAL_ENTITIES ];
+	short					m_AdditionalEntityIndex[ MAX_LAG_ADDITIONAL_ENTITIES ];	// entindex registered in m_EntitySlot, -1 if none
+	short					m_EntitySlot[ MAX_EDICTS ];
 
 	// Scratchpad for determining what needs to be restored
-	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
+	CBitVec<MAX_LAG_SLOTS>	m_RestorePlayer;
 	bool					m_bNeedToRestore;
 	
-	LagRecord				m_RestoreData[ MAX_PLAYERS ];	// player data before we moved him back
-	LagRecord				m_ChangeData[ MAX_PLAYERS ];	// player data where we moved him back
+	LagRecord				m_RestoreData[ MAX_LAG_SLOTS ];	// player data before we moved him back
+	LagRecord				m_ChangeData[ MAX_LAG_SLOTS ];	// player data where we moved him back
 
 	CBasePlayer				*m_pCurrentPlayer;	// The player we are doing lag compensation for
+
+	// Shooter's aim for the cone check
+	Vector					m_vecShooterEye;
+	Vector					m_vecShooterForward;
+	float					m_flShooterCone;
 };
 
 static CLagCompensationManager g_LagCompensationManager( "CLagCompensationManager" );
 ILagCompensationManager *lagcompensation = &g_LagCompensationManager;
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Additional entities are lag compensated alongside players
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::AddAdditionalEntity( CBaseEntity *pEntity )
+{
+	int entindex = pEntity->entindex();
+	if ( entindex <= 0 || entindex >= MAX_EDICTS || m_EntitySlot[entindex] != -1 )
+		return;
+
+	for ( int i = 0; i < MAX_LAG_ADDITIONAL_ENTITIES; i++ )
+	{
+		if ( m_AdditionalEntities[i] == NULL )
+		{
+			m_AdditionalEntities[i] = pEntity;
+			m_AdditionalEntityIndex[i] = entindex;
+			m_EntitySlot[entindex] = MAX_PLAYERS + i;
+			return; 
+		}
+	}
+
+	if ( sv_unlag_debug.GetBool() )
+	{
+		DevMsg( "Too many lag compensated entities, not adding %s\n", pEntity->GetDebugName() );
+	}
+}
+
+void CLagCompensationManager::RemoveAdditionalEntity( CBaseEntity *pEntity )
+{
+	int entindex = pEntity->entindex();
+	if ( entindex <= 0 || entindex >= MAX_EDICTS || m_EntitySlot[entindex] == -1 )
+		return;
+
+	int slot = m_EntitySlot[entindex];
+	m_EntitySlot[entindex] = -1;
+	m_AdditionalEntities[slot - MAX_PLAYERS] = NULL;
+	m_AdditionalEntityIndex[slot - MAX_PLAYERS] = -1;
+
+	delete m_pTracks[slot];
+	m_pTracks[slot] = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+CBaseEntity *CLagCompensationManager::GetSlotEntity( int slot )
+{
+	if ( slot < MAX_PLAYERS )
+		return UTIL_PlayerByIndex( slot + 1 );
+
+	return m_AdditionalEntities[slot - MAX_PLAYERS];
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Called once per frame after all entities have had a chance to think
 //-----------------------------------------------------------------------------
@@ -234,67 +456,103 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	VPROF_BUDGET( "FrameUpdatePostEntityThink", "CLagCompensationManager" );
 
 	// remove all records before that time:
-	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
+	float flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
-
 		if ( !pPlayer )
 		{
-			track->RemoveAll();
+			if ( m_pTracks[i-1] )
+				m_pTracks[i-1]->Clear();
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
+		RecordEntity( pPlayer, i-1, flDeadtime );
+	}
 
-		// remove tail records that are too old
-		int tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+	if ( sv_unlag_npcs.GetBool() )
+	{
+		CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+		for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
 		{
-			LagRecord &tail = track->Element( tailIndex );
+			AddAdditionalEntity( ppAIs[i] );
+		}
+	}
 
-			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
-				break;
+	for ( int i = 0; i < MAX_LAG_ADDITIONAL_ENTITIES; i++ )
+	{
+		int slot = MAX_PLAYERS + i;
+		CBaseEntity *pEntity = m_AdditionalEntities[i];
 			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+		if ( !pEntity )
+		{
+			// entity went away, free the slot (the track may already be gone via ClearHistory)
+			if ( m_AdditionalEntityIndex[i] != -1 )
+			{
+				m_EntitySlot[ m_AdditionalEntityIndex[i] ] = -1;
+				m_AdditionalEntityIndex[i] = -1;
+			}
+			if ( m_pTracks[slot] )
+			{
+				delete m_pTracks[slot];
+				m_pTracks[slot] = NULL;
+			}
+			continue;
 		}
 
-		// check if head has same simulation time
-		if ( track->Count() > 0 )
+		if ( !sv_unlag_npcs.GetBool() && pEntity->MyNPCPointer() )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
-			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
-				continue; // don't add new entry for same or older time
+			RemoveAdditionalEntity( pEntity );
+			continue;
 		}
 
-		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		RecordEntity( pEntity, slot, flDeadtime );
+	}
+}
 
-		record.m_fFlags = 0;
-		if ( pPlayer->IsAlive() )
-		{
-			record.m_fFlags |= LC_ALIVE;
-		}
+//-----------------------------------------------------------------------------
+// Purpose: Adds a record for the entity's current state to its track
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::RecordEntity( CBaseEntity *pEntity, int slot, float flDeadtime )
+{
+	CLagRecordTrack *track = GetTrack( slot );
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMaxs			= pPlayer->WorldAlignMaxs();
-		record.m_vecMins			= pPlayer->WorldAlignMins();
+	// remove tail records that are too old
+	track->RemoveOlderThan( flDeadtime );
 
-		int layerCount = pPlayer->GetNumAnimOverlays();
+	// check if head has same simulation time
+	if ( track->Count() > 0 )
+	{
+		// check if player changed simulation time since last time updated
+		if ( track->Get( 0 ).m_flSimulationTime >= pEntity->GetSimulationTime() )
+			return; // don't add new entry for same or older time
+	}
+
+	// add new record to player track
+	LagRecord &record = track->AddNewest();
+
+	record.m_fFlags = 0;
+	if ( pEntity->IsAlive() )
+	{
+		record.m_fFlags |= LC_ALIVE;
+	}
+
+	record.m_flSimulationTime	= pEntity->GetSimulationTime();
+	record.m_vecAngles			= pEntity->GetLocalAngles();
+	record.m_vecOrigin			= pEntity->GetLocalOrigin();
+	record.m_vecMaxs			= pEntity->WorldAlignMaxs();
+	record.m_vecMins			= pEntity->WorldAlignMins();
+
+	CBaseAnimatingOverlay *pOverlay = pEntity->MyCombatCharacterPointer();
+	if ( pOverlay )
+	{
+		int layerCount = pOverlay->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
-			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+			CAnimationLayer *currentLayer = pOverlay->GetAnimOverlay(layerIndex);
 			if( currentLayer )
 			{
 				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
@@ -303,9 +561,16 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 			}
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
 	}
+
+	CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+	if ( pAnimating )
+	{
+		record.m_masterSequence = pAnimating->GetSequence();
+		record.m_masterCycle = pAnimating->GetCycle();
+	}
+
+	track->UpdateBreaks();
 }
 
 // Called during player movement to set up/restore after lag compensation
@@ -327,8 +592,6 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 
 	// NOTE: Put this here so that it won't show up in single player mode.
 	VPROF_BUDGET( "StartLagCompensation", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-	Q_memset( m_RestoreData, 0, sizeof( m_RestoreData ) );
-	Q_memset( m_ChangeData, 0, sizeof( m_ChangeData ) );
 
 	// Get true latency
 
@@ -365,6 +628,12 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
 	
+	float flTargetTime = TICKS_TO_TIME( targettick );
+
+	m_vecShooterEye = player->EyePosition();
+	AngleVectors( cmd->viewangles, &m_vecShooterForward );
+	m_flShooterCone = DEG2RAD( sv_unlag_cone.GetFloat() );
+
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
@@ -387,76 +656,58 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 			continue;
 
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackEntity( pPlayer, i-1, flTargetTime );
+	}
+
+	// Then NPCs and other additional entities
+	for ( int i = 0; i < MAX_LAG_ADDITIONAL_ENTITIES; i++ )
+	{
+		CBaseEntity *pEntity = m_AdditionalEntities[i];
+		if ( !pEntity )
+			continue;
+
+		// If this entity hasn't been transmitted to us and acked, then don't bother lag compensating it.
+		if ( pEntityTransmitBits && !pEntityTransmitBits->Get( pEntity->entindex() ) )
+			continue;
+
+		BacktrackEntity( pEntity, MAX_PLAYERS + i, flTargetTime );
 	}
 }
 
-void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
+void CLagCompensationManager::BacktrackEntity( CBaseEntity *pEntity, int slot, float flTargetTime )
 {
 	Vector org, mins, maxs;
 	QAngle ang;
 
-	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
-	int pl_index = pPlayer->entindex() - 1;
+	VPROF_BUDGET( "BacktrackEntity", "CLagCompensationManager" );
 
-	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	// get track history of this entity
+	CLagRecordTrack *track = m_pTracks[ slot ];
 
 	// check if we have at leat one entry
-	if ( track->Count() <= 0 )
+	if ( !track || track->Count() <= 0 )
 		return;
 
-	int curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	// find the record for the target time, then make sure the entity didn't
+	// die or teleport anywhere between it and the present
+	int age = track->FindRecord( flTargetTime );
 
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	if ( !track->CanBacktrackTo( age ) )
 	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
-
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
-		{
-			// lost track, too much difference
-			return; 
-		}
-
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
-
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
+		// player most be alive, lost track
+		return;
 	}
 
-	Assert( record );
-
-	if ( !record )
+	Vector delta = track->Get( 0 ).m_vecOrigin - pEntity->GetLocalOrigin();
+	if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
 	{
-		if ( sv_unlag_debug.GetBool() )
-		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
-		}
-
-		return; // that should never happen
+		// lost track, too much difference
+		return;
 	}
 
+	LagRecord *record = &track->Get( age );
+	LagRecord *prevRecord = ( age > 0 ) ? &track->Get( age - 1 ) : NULL;
+
 	float frac = 0.0f;
 	if ( prevRecord && 
 		 (record->m_flSimulationTime < flTargetTime) &&
@@ -489,16 +740,23 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		maxs = record->m_vecMaxs;
 	}
 
+	// Don't bother moving anything the shooter can't be aiming at
+	if ( m_flShooterCone > 0 &&
+		 !IsInsideLagCompensationCone( m_vecShooterEye, m_vecShooterForward, m_flShooterCone, org, mins, maxs ) )
+	{
+		return;
+	}
+
 	// See if this is still a valid position for us to teleport to
 	if ( sv_unlag_fixstuck.GetBool() )
 	{
 		// Try to move to the wanted position from our current position.
 		trace_t tr;
-		UTIL_TraceEntity( pPlayer, org, org, MASK_PLAYERSOLID, &tr );
+		UTIL_TraceEntity( pEntity, org, org, pEntity->PhysicsSolidMaskForEntity(), &tr );
 		if ( tr.startsolid || tr.allsolid )
 		{
 			if ( sv_unlag_debug.GetBool() )
-				DevMsg( "WARNING: BackupPlayer trying to back player into a bad position - client %s\n", pPlayer->GetPlayerName() );
+				DevMsg( "WARNING: BackupPlayer trying to back player into a bad position - %s\n", pEntity->GetDebugName() );
 
 			CBasePlayer *pHitPlayer = dynamic_cast<CBasePlayer *>( tr.m_pEnt );
 
@@ -511,20 +769,19 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 				{
 					// prevent recursion - save a copy of m_RestorePlayer,
 					// pretend that this player is off-limits
-					int pl_index = pPlayer->entindex() - 1;
 
 					// Temp turn this flag on
-					m_RestorePlayer.Set( pl_index );
+					m_RestorePlayer.Set( slot );
 
-					BacktrackPlayer( pHitPlayer, flTargetTime );
+					BacktrackEntity( pHitPlayer, pHitPlayer->entindex() - 1, flTargetTime );
 
 					// Remove the temp flag
-					m_RestorePlayer.Clear( pl_index );
+					m_RestorePlayer.Clear( slot );
 				}				
 			}
 
 			// now trace us back as far as we can go
-			UTIL_TraceEntity( pPlayer, pPlayer->GetLocalOrigin(), org, MASK_PLAYERSOLID, &tr );
+			UTIL_TraceEntity( pEntity, pEntity->GetLocalOrigin(), org, pEntity->PhysicsSolidMaskForEntity(), &tr );
 
 			if ( tr.startsolid || tr.allsolid )
 			{
@@ -537,7 +794,7 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			{
 				// We can get to a valid place, but not all the way to the target
 				Vector vPos;
-				VectorLerp( pPlayer->GetLocalOrigin(), org, tr.fraction * g_flFractionScale, vPos );
+				VectorLerp( pEntity->GetLocalOrigin(), org, tr.fraction * g_flFractionScale, vPos );
 				
 				// This is as close as we're going to get
 				org = vPos;
@@ -550,31 +807,31 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	
 	// See if this represents a change for the player
 	int flags = 0;
-	LagRecord *restore = &m_RestoreData[ pl_index ];
-	LagRecord *change  = &m_ChangeData[ pl_index ];
+	LagRecord *restore = &m_RestoreData[ slot ];
+	LagRecord *change  = &m_ChangeData[ slot ];
 
-	QAngle angdiff = pPlayer->GetLocalAngles() - ang;
-	Vector orgdiff = pPlayer->GetLocalOrigin() - org;
+	QAngle angdiff = pEntity->GetLocalAngles() - ang;
+	Vector orgdiff = pEntity->GetLocalOrigin() - org;
 
 	// Always remember the pristine simulation time in case we need to restore it.
-	restore->m_flSimulationTime = pPlayer->GetSimulationTime();
+	restore->m_flSimulationTime = pEntity->GetSimulationTime();
 
 	if ( angdiff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
 	{
 		flags |= LC_ANGLES_CHANGED;
-		restore->m_vecAngles = pPlayer->GetLocalAngles();
-		pPlayer->SetLocalAngles( ang );
+		restore->m_vecAngles = pEntity->GetLocalAngles();
+		pEntity->SetLocalAngles( ang );
 		change->m_vecAngles = ang;
 	}
 
 	// Use absolute equality here
-	if ( ( mins != pPlayer->WorldAlignMins() ) ||
-		 ( maxs != pPlayer->WorldAlignMaxs() ) )
+	if ( ( mins != pEntity->WorldAlignMins() ) ||
+		 ( maxs != pEntity->WorldAlignMaxs() ) )
 	{
 		flags |= LC_SIZE_CHANGED;
-		restore->m_vecMins = pPlayer->WorldAlignMins() ;
-		restore->m_vecMaxs = pPlayer->WorldAlignMaxs();
-		pPlayer->SetSize( mins, maxs );
+		restore->m_vecMins = pEntity->WorldAlignMins() ;
+		restore->m_vecMaxs = pEntity->WorldAlignMaxs();
+		pEntity->SetSize( mins, maxs );
 		change->m_vecMins = mins;
 		change->m_vecMaxs = maxs;
 	}
@@ -583,122 +840,127 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	if ( orgdiff.LengthSqr() > LAG_COMPENSATION_EPS_SQR )
 	{
 		flags |= LC_ORIGIN_CHANGED;
-		restore->m_vecOrigin = pPlayer->GetLocalOrigin();
-		pPlayer->SetLocalOrigin( org );
+		restore->m_vecOrigin = pEntity->GetLocalOrigin();
+		pEntity->SetLocalOrigin( org );
 		change->m_vecOrigin = org;
 	}
 
-	// Sorry for the loss of the optimization for the case of people
-	// standing still, but you breathe even on the server.
-	// This is quicker than actually comparing all bazillion floats.
-	flags |= LC_ANIMATION_CHANGED;
-	restore->m_masterSequence = pPlayer->GetSequence();
-	restore->m_masterCycle = pPlayer->GetCycle();
-
-	bool interpolationAllowed = false;
-	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+	CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+	if ( pAnimating )
 	{
-		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
-		interpolationAllowed = true;
-	}
+		// Sorry for the loss of the optimization for the case of people
+		// standing still, but you breathe even on the server.
+		// This is quicker than actually comparing all bazillion floats.
+		flags |= LC_ANIMATION_CHANGED;
+		restore->m_masterSequence = pAnimating->GetSequence();
+		restore->m_masterCycle = pAnimating->GetCycle();
+
+		bool interpolationAllowed = false;
+		if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+		{
+			// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
+			interpolationAllowed = true;
+		}
 	
-	////////////////////////
-	// First do the master settings
-	bool interpolatedMasters = false;
-	if( frac > 0.0f && interpolationAllowed )
-	{
-		interpolatedMasters = true;
-		pPlayer->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
-		pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
-
-		if( record->m_masterCycle > prevRecord->m_masterCycle )
+		////////////////////////
+		// First do the master settings
+		bool interpolatedMasters = false;
+		if( frac > 0.0f && interpolationAllowed )
 		{
-			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
-			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
-			pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
+			interpolatedMasters = true;
+			pAnimating->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
+			pAnimating->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+
+			if( record->m_masterCycle > prevRecord->m_masterCycle )
+			{
+				// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
+				// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
+				float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
+				pAnimating->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
+			}
+			else
+			{
+				pAnimating->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+			}
 		}
-		else
+		if( !interpolatedMasters )
 		{
-			pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+			pAnimating->SetSequence(record->m_masterSequence);
+			pAnimating->SetCycle(record->m_masterCycle);
 		}
-	}
-	if( !interpolatedMasters )
-	{
-		pPlayer->SetSequence(record->m_masterSequence);
-		pPlayer->SetCycle(record->m_masterCycle);
-	}
 
-	////////////////////////
-	// Now do all the layers
-	int layerCount = pPlayer->GetNumAnimOverlays();
-	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
-	{
-		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
-		if( currentLayer )
+		////////////////////////
+		// Now do all the layers
+		CBaseAnimatingOverlay *pOverlay = pEntity->MyCombatCharacterPointer();
+		int layerCount = ( pOverlay ) ? pOverlay->GetNumAnimOverlays() : 0;
+		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
-			restore->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-			restore->m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-			restore->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-			restore->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
-
-			bool interpolated = false;
-			if( (frac > 0.0f)  &&  interpolationAllowed )
+			CAnimationLayer *currentLayer = pOverlay->GetAnimOverlay(layerIndex);
+			if( currentLayer )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
-				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
-					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
-					)
+				restore->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				restore->m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				restore->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				restore->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+
+				bool interpolated = false;
+				if( (frac > 0.0f)  &&  interpolationAllowed )
 				{
-					// We can't interpolate across a sequence or order change
-					interpolated = true;
-					if( recordsLayerRecord.m_cycle > prevRecordsLayerRecord.m_cycle )
+					LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
+					LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+					if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
+						&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
+						)
 					{
-						// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
-						// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-						float newCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle + 1 );
-						currentLayer->m_flCycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
+						// We can't interpolate across a sequence or order change
+						interpolated = true;
+						if( recordsLayerRecord.m_cycle > prevRecordsLayerRecord.m_cycle )
+						{
+							// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
+							// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
+							float newCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle + 1 );
+							currentLayer->m_flCycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
+						}
+						else
+						{
+							currentLayer->m_flCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle  );
+						}
+						currentLayer->m_nOrder = recordsLayerRecord.m_order;
+						currentLayer->m_nSequence = recordsLayerRecord.m_sequence;
+						currentLayer->m_flWeight = Lerp( frac, recordsLayerRecord.m_weight, prevRecordsLayerRecord.m_weight  );
 					}
-					else
-					{
-						currentLayer->m_flCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle  );
-					}
-					currentLayer->m_nOrder = recordsLayerRecord.m_order;
-					currentLayer->m_nSequence = recordsLayerRecord.m_sequence;
-					currentLayer->m_flWeight = Lerp( frac, recordsLayerRecord.m_weight, prevRecordsLayerRecord.m_weight  );
 				}
-			}
-			if( !interpolated )
-			{
-				//Either no interp, or interp failed.  Just use record.
-				currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
-				currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
-				currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
-				currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
+				if( !interpolated )
+				{
+					//Either no interp, or interp failed.  Just use record.
+					currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
+					currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
+					currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
+					currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
+				}
 			}
 		}
+
+		if ( sv_lagflushbonecache.GetBool() )
+			pAnimating->InvalidateBoneCache();
 	}
 	
 	if ( !flags )
 		return; // we didn't change anything
 
-	if ( sv_lagflushbonecache.GetBool() )
-		pPlayer->InvalidateBoneCache();
-
 	/*char text[256]; Q_snprintf( text, sizeof(text), "time %.2f", flTargetTime );
 	pPlayer->DrawServerHitboxes( 10 );
 	NDebugOverlay::Text( org, text, false, 10 );
 	NDebugOverlay::EntityBounds( pPlayer, 255, 0, 0, 32, 10 ); */
 
-	m_RestorePlayer.Set( pl_index ); //remember that we changed this player
+	m_RestorePlayer.Set( slot ); //remember that we changed this player
 	m_bNeedToRestore = true;  // we changed at least one player
 	restore->m_fFlags = flags; // we need to restore these flags
 	change->m_fFlags = flags; // we have changed these flags
 
-	if( sv_showlagcompensation.GetInt() == 1 )
+	if( sv_showlagcompensation.GetInt() == 1 && pAnimating )
 	{
-		pPlayer->DrawServerHitboxes(4, true);
+		pAnimating->DrawServerHitboxes(4, true);
 	}
 }
 
@@ -709,25 +971,17 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 	if ( !m_bNeedToRestore )
 		return; // no player was changed at all
 
-	// Iterate all active players
-	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	// Iterate all changed entities
+	for ( int slot = m_RestorePlayer.FindNextSetBit( 0 ); slot != -1; slot = m_RestorePlayer.FindNextSetBit( slot + 1 ) )
 	{
-		int pl_index = i - 1;
-		
-		if ( !m_RestorePlayer.Get( pl_index ) )
-		{
-			// player wasn't changed by lag compensation
-			continue;
-		}
-
-		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
-		if ( !pPlayer )
+		CBaseEntity *pEntity = GetSlotEntity( slot );
+		if ( !pEntity )
 		{
 			continue;
 		}
 
-		LagRecord *restore = &m_RestoreData[ pl_index ];
-		LagRecord *change  = &m_ChangeData[ pl_index ];
+		LagRecord *restore = &m_RestoreData[ slot ];
+		LagRecord *change  = &m_ChangeData[ slot ];
 
 		bool restoreSimulationTime = false;
 
@@ -737,11 +991,11 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 	
 			// see if simulation made any changes, if no, then do the restore, otherwise,
 			//  leave new values in
-			if ( pPlayer->WorldAlignMins() == change->m_vecMins && 
-				 pPlayer->WorldAlignMaxs() == change->m_vecMaxs )
+			if ( pEntity->WorldAlignMins() == change->m_vecMins &&
+				 pEntity->WorldAlignMaxs() == change->m_vecMaxs )
 			{
 				// Restore it
-				pPlayer->SetSize( restore->m_vecMins, restore->m_vecMaxs );
+				pEntity->SetSize( restore->m_vecMins, restore->m_vecMaxs );
 			}
 		}
 
@@ -749,9 +1003,9 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 		{		   
 			restoreSimulationTime = true;
 
-			if ( pPlayer->GetLocalAngles() == change->m_vecAngles )
+			if ( pEntity->GetLocalAngles() == change->m_vecAngles )
 			{
-				pPlayer->SetLocalAngles( restore->m_vecAngles );
+				pEntity->SetLocalAngles( restore->m_vecAngles );
 			}
 		}
 
@@ -760,26 +1014,28 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 			restoreSimulationTime = true;
 
 			// Okay, let's see if we can do something reasonable with the change
-			Vector delta = pPlayer->GetLocalOrigin() - change->m_vecOrigin;
+			Vector delta = pEntity->GetLocalOrigin() - change->m_vecOrigin;
 			
 			// If it moved really far, just leave the player in the new spot!!!
 			if ( delta.LengthSqr() < LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
 			{
-				RestorePlayerTo( pPlayer, restore->m_vecOrigin + delta );
+				RestoreEntityTo( pEntity, restore->m_vecOrigin + delta );
 			}
 		}
 
-		if( restore->m_fFlags & LC_ANIMATION_CHANGED )
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if( ( restore->m_fFlags & LC_ANIMATION_CHANGED ) && pAnimating )
 		{
 			restoreSimulationTime = true;
 
-			pPlayer->SetSequence(restore->m_masterSequence);
-			pPlayer->SetCycle(restore->m_masterCycle);
+			pAnimating->SetSequence(restore->m_masterSequence);
+			pAnimating->SetCycle(restore->m_masterCycle);
 
-			int layerCount = pPlayer->GetNumAnimOverlays();
+			CBaseAnimatingOverlay *pOverlay = pEntity->MyCombatCharacterPointer();
+			int layerCount = ( pOverlay ) ? pOverlay->GetNumAnimOverlays() : 0;
 			for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 			{
-				CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+				CAnimationLayer *currentLayer = pOverlay->GetAnimOverlay(layerIndex);
 				if( currentLayer )
 				{
 					currentLayer->m_flCycle = restore->m_layerRecords[layerIndex].m_cycle;
@@ -792,9 +1048,7 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 
 		if ( restoreSimulationTime )
 		{
-			pPlayer->SetSimulationTime( restore->m_flSimulationTime );
+			pEntity->SetSimulationTime( restore->m_flSimulationTime );
 		}
 	}
 }
-
-
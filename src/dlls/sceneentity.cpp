@@ -48,6 +48,7 @@ class CBaseFlex;
 //#define COMPILED_VCDS 1
 
 static ConVar scene_forcecombined( "scene_forcecombined", "0", 0, "When playing back, force use of combined .wav files even in english." );
+static ConVar scene_usecompiled( "scene_usecompiled", "1", 0, "Load a scene's compiled .xcd (see scene_compile) instead of parsing its .vcd when the .xcd was compiled from the current .vcd." );
 static ConVar scene_maxcaptionradius( "scene_maxcaptionradius", "1200", 0, "Only show closed captions if recipient is within this many units of speaking actor (0==disabled)." );
 
 // Assume sound system is 100 msec lagged (only used if we can't find snd_mixahead cvar!)
@@ -3100,52 +3101,93 @@ void CSceneEntity::FinishAsyncLoading( char const *pszScene, bool binary, size_t
 	}
 }
 
-CChoreoScene *CSceneEntity::BlockingLoadScene( const char *filename )
+// .xcd files we've already looked for and not found, so scenes that were never
+// compiled don't cost a file system probe on every load
+static CUtlSymbolTable g_MissingCompiledScenes( 0, 32, true );
+
+//-----------------------------------------------------------------------------
+// Purpose: Restores a compiled .xcd scene.  If the .vcd text is passed in, the
+//  .xcd is only used when it was compiled from that exact text (same CRC).
+//  Returns NULL if the .xcd is missing, stale or can't be restored.
+//-----------------------------------------------------------------------------
+static CChoreoScene *LoadCompiledScene( const char *binfile, const char *pTextBuffer, int nTextSize )
 {
-	DevMsg( 2, "Blocking load of scene from '%s'\n", filename );
+	if ( UTL_INVAL_SYMBOL != g_MissingCompiledScenes.Find( binfile ) )
+		return NULL;
 
-#if defined( COMPILED_VCDS )
-	// The xbox build has .xcd files in the hl2x/scenes folder, so use those...
-	char binfile[ 512 ];
-	Q_strncpy( binfile, filename, sizeof( binfile ) );
-	Q_SetExtension( binfile, ".xcd", sizeof( binfile ) );
-	if ( filesystem->FileExists( binfile, IsXbox() ? "XGAME" : "GAME" ) )
+	char *buffer = NULL;
+	int filesize = filesystem->ReadFileEx( binfile, ( IsXbox() ) ? "XGAME" : "GAME", (void **)&buffer, true );
+	if ( filesize <= 0 )
 	{
-		char *buffer = NULL;
-		int filesize = filesystem->ReadFileEx( binfile, ( IsXbox() ) ? "XGAME" : "GAME", (void **)&buffer, true );
-		if ( filesize > 0 )
-		{
-			CChoreoScene *scene = new CChoreoScene( NULL );
+		g_MissingCompiledScenes.AddString( binfile );
+		return NULL;
+	}
 
-			CUtlBuffer buf( buffer, filesize, CUtlBuffer::READ_ONLY );
-			if ( !scene->RestoreFromBuffer( buf, binfile ) )
-			{
-				Warning( "CSceneEntity::BlockingLoadScene:  Unable to load binary scene '%s'\n", binfile );
-				delete scene;
-				scene = NULL;
-			}
-			else
-			{
-				scene->SetPrintFunc( LocalScene_Printf );
-			}
+	CUtlBuffer buf( buffer, filesize, CUtlBuffer::READ_ONLY );
 
+	if ( pTextBuffer )
+	{
+		unsigned int crc;
+		if ( !CChoreoScene::GetCRCFromBuffer( buf, crc ) || crc != CRC32_ProcessSingleBuffer( pTextBuffer, nTextSize ) )
+		{
+			DevMsg( 2, "Compiled scene '%s' is out of date, parsing the .vcd\n", binfile );
 			delete[] buffer;
-			return scene;
+			return NULL;
 		}
+	}
 
-		return NULL;
+	CChoreoScene *scene = new CChoreoScene( NULL );
+	if ( !scene->RestoreFromBuffer( buf, binfile ) )
+	{
+		Warning( "CSceneEntity::BlockingLoadScene:  Unable to load binary scene '%s'\n", binfile );
+		delete scene;
+		scene = NULL;
 	}
-#endif
+	else
+	{
+		scene->SetPrintFunc( LocalScene_Printf );
+	}
+
+	delete[] buffer;
+	return scene;
+}
+
+CChoreoScene *CSceneEntity::BlockingLoadScene( const char *filename )
+{
+	DevMsg( 2, "Blocking load of scene from '%s'\n", filename );
+
+	char binfile[ 512 ];
+	Q_strncpy( binfile, filename, sizeof( binfile ) );
+	Q_SetExtension( binfile, ".xcd", sizeof( binfile ) );
 
 	char loadfile[ 512 ];
 	Q_strncpy( loadfile, filename, sizeof( loadfile ) );
 	Q_SetExtension( loadfile, ".vcd", sizeof( loadfile ) );
 	Q_FixSlashes( loadfile );
 
-	// Load the file
 	char *buffer = NULL;
-	
-	int filesize = filesystem->ReadFileEx( loadfile, ( IsXbox() ) ? "XGAME" : "GAME", (void **)&buffer, true );
+	int filesize = 0;
+
+#if defined( COMPILED_VCDS )
+	// The xbox build has .xcd files in the hl2x/scenes folder, so use those...
+	CChoreoScene *scene = LoadCompiledScene( binfile, NULL, 0 );
+	if ( scene )
+		return scene;
+
+	filesize = filesystem->ReadFileEx( loadfile, ( IsXbox() ) ? "XGAME" : "GAME", (void **)&buffer, true );
+#else
+	// The .vcd is read either way; its CRC tells us whether the .xcd is current
+	filesize = filesystem->ReadFileEx( loadfile, "GAME", (void **)&buffer, true );
+	if ( scene_usecompiled.GetBool() )
+	{
+		CChoreoScene *scene = LoadCompiledScene( binfile, ( filesize > 0 ) ? buffer : NULL, filesize );
+		if ( scene )
+		{
+			delete[] buffer;
+			return scene;
+		}
+	}
+#endif
 
 	if ( filesize <= 0 )
 	{
@@ -3154,11 +3196,11 @@ CChoreoScene *CSceneEntity::BlockingLoadScene( const char *filename )
 	}
 
 	g_TokenProcessor.SetBuffer( buffer );
-	CChoreoScene *scene = ChoreoLoadScene( loadfile, NULL, &g_TokenProcessor, LocalScene_Printf );
+	CChoreoScene *textscene = ChoreoLoadScene( loadfile, NULL, &g_TokenProcessor, LocalScene_Printf );
 
 	delete[] buffer;
 
-	return scene;
+	return textscene;
 }
 
 CChoreoScene *BlockingLoadScene( const char *filename )
@@ -4181,6 +4223,71 @@ int GetSceneSpeechCount( char const *pszScene )
 	return entry->GetSoundCount();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Writes the compiled .xcd version of a .vcd
+//-----------------------------------------------------------------------------
+static bool CompileScene( const char *filename )
+{
+	char loadfile[ 512 ];
+	Q_strncpy( loadfile, filename, sizeof( loadfile ) );
+	Q_SetExtension( loadfile, ".vcd", sizeof( loadfile ) );
+	Q_FixSlashes( loadfile );
+
+	char *buffer = NULL;
+	int filesize = filesystem->ReadFileEx( loadfile, "GAME", (void **)&buffer, true );
+	if ( filesize <= 0 )
+		return false;
+
+	unsigned int crc = CRC32_ProcessSingleBuffer( buffer, filesize );
+
+	g_TokenProcessor.SetBuffer( buffer );
+	CChoreoScene *scene = ChoreoLoadScene( loadfile, NULL, &g_TokenProcessor, LocalScene_Printf );
+	delete[] buffer;
+
+	if ( !scene )
+		return false;
+
+	char binfile[ 512 ];
+	Q_strncpy( binfile, loadfile, sizeof( binfile ) );
+	Q_SetExtension( binfile, ".xcd", sizeof( binfile ) );
+
+	bool bret = scene->SaveBinary( binfile, "MOD", crc );
+	delete scene;
+
+	if ( bret )
+	{
+		// There's no way to take just this one out, so look for all of them again
+		g_MissingCompiledScenes.RemoveAll();
+	}
+	return bret;
+}
+
+CON_COMMAND( scene_compile, "Write compiled .xcd files for the given scene, or for every scene in the scene cache." )
+{
+	if ( engine->Cmd_Argc() > 1 )
+	{
+		if ( !CompileScene( engine->Cmd_Argv( 1 ) ) )
+		{
+			Warning( "Unable to compile scene '%s'\n", engine->Cmd_Argv( 1 ) );
+		}
+		return;
+	}
+
+	int nCompiled = 0;
+	int c = g_SceneCache.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		char scenename[ 512 ];
+		g_SceneCache.GetElementName( i, scenename, sizeof( scenename ) );
+		if ( CompileScene( scenename ) )
+		{
+			++nCompiled;
+		}
+	}
+
+	Msg( "Compiled %i of %i scenes\n", nCompiled, c );
+}
+
 extern ISceneFileCache *scenefilecache;
 
 //-----------------------------------------------------------------------------
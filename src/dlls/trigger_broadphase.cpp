@@ -0,0 +1,441 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Sweep-and-prune broadphase for static trigger volumes
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "trigger_broadphase.h"
+#include "collisionutils.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static void TriggerBroadphaseChanged( ConVar *var, char const *pOldString );
+
+ConVar sv_trigger_broadphase( "sv_trigger_broadphase", "1", 0, "Test moving entities against static triggers with the game's trigger broadphase instead of the engine's partition", TriggerBroadphaseChanged );
+ConVar sv_trigger_broadphase_margin( "sv_trigger_broadphase_margin", "64", 0, "Padding around a moving entity when caching the triggers it might touch" );
+
+bool IsTriggerClass( CBaseEntity *pEntity );
+
+CTriggerBroadphase g_TriggerBroadphase( "CTriggerBroadphase" );
+
+//-----------------------------------------------------------------------------
+
+static void TriggerBroadphaseChanged( ConVar *var, char const *pOldString )
+{
+	if ( !sv_trigger_broadphase.GetBool() )
+	{
+		g_TriggerBroadphase.RemoveAllTriggers();
+		return;
+	}
+
+	// Pick up the triggers that are already in the level
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity != NULL; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		if ( IsTriggerClass( pEntity ) )
+		{
+			g_TriggerBroadphase.AddTrigger( pEntity );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+CTriggerBroadphase::CTriggerBroadphase( char const *name ) : CAutoGameSystem( name )
+{
+	m_bDirty = false;
+	m_nGeneration = 0;
+	m_InBroadphase.ClearAll();
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		m_SolidCache[i].nGeneration = -1;
+	}
+	ResetStats();
+}
+
+//-----------------------------------------------------------------------------
+
+void CTriggerBroadphase::LevelShutdownPostEntity()
+{
+	m_Triggers.Purge();
+	m_MaxXPrefix.Purge();
+	m_InBroadphase.ClearAll();
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		m_SolidCache[i].hSolid = NULL;
+		m_SolidCache[i].candidates.Purge();
+	}
+	m_bDirty = false;
+	m_nGeneration++;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes a trigger out of the engine's partition and tests it here.
+//			Only triggers that aren't attached to anything are accepted, since
+//			anything that moves would need its sorted position updated.
+//-----------------------------------------------------------------------------
+void CTriggerBroadphase::AddTrigger( CBaseEntity *pTrigger )
+{
+	if ( !sv_trigger_broadphase.GetBool() )
+		return;
+
+	int entindex = pTrigger->entindex();
+	if ( entindex <= 0 || m_InBroadphase.Get( entindex ) )
+		return;
+
+	// Moving and vphysics triggers stay with the engine
+	if ( pTrigger->GetMoveParent() || pTrigger->GetMoveType() != MOVETYPE_NONE || pTrigger->VPhysicsGetObject() )
+		return;
+
+	if ( m_Triggers.Count() >= 0xFFFF )
+		return;
+
+	int i = m_Triggers.AddToTail();
+	m_Triggers[i].hTrigger = pTrigger;
+	pTrigger->CollisionProp()->WorldSpaceAABB( &m_Triggers[i].vecMins, &m_Triggers[i].vecMaxs );
+
+	m_InBroadphase.Set( entindex );
+	m_bDirty = true;
+
+	pTrigger->CollisionProp()->UpdateServerPartitionMask();
+}
+
+//-----------------------------------------------------------------------------
+
+void CTriggerBroadphase::RemoveTrigger( CBaseEntity *pTrigger )
+{
+	int entindex = pTrigger->entindex();
+	if ( entindex <= 0 || !m_InBroadphase.Get( entindex ) )
+		return;
+
+	int i = FindTrigger( pTrigger );
+	if ( i != -1 )
+	{
+		m_Triggers.Remove( i );
+	}
+
+	m_InBroadphase.Clear( entindex );
+	m_bDirty = true;
+	m_nGeneration++;
+
+	pTrigger->CollisionProp()->UpdateServerPartitionMask();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hands every trigger back to the engine
+//-----------------------------------------------------------------------------
+void CTriggerBroadphase::RemoveAllTriggers()
+{
+	CUtlVector<EHANDLE> triggers;
+	for ( int i = 0; i < m_Triggers.Count(); i++ )
+	{
+		triggers.AddToTail( m_Triggers[i].hTrigger );
+	}
+
+	m_Triggers.Purge();
+	m_MaxXPrefix.Purge();
+	m_InBroadphase.ClearAll();
+	m_bDirty = false;
+	m_nGeneration++;
+
+	for ( int i = 0; i < triggers.Count(); i++ )
+	{
+		if ( triggers[i] != NULL )
+		{
+			triggers[i]->CollisionProp()->UpdateServerPartitionMask();
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool CTriggerBroadphase::IsTriggerInBroadphase( const CBaseEntity *pTrigger ) const
+{
+	int entindex = pTrigger->entindex();
+	return ( entindex > 0 && m_InBroadphase.Get( entindex ) );
+}
+
+//-----------------------------------------------------------------------------
+
+int CTriggerBroadphase::FindTrigger( const CBaseEntity *pTrigger ) const
+{
+	for ( int i = 0; i < m_Triggers.Count(); i++ )
+	{
+		if ( m_Triggers[i].hTrigger == pTrigger )
+			return i;
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A trigger ran PhysicsTouchTriggers, had its partition updated
+//			(origin, size or solid change), or got a new parent or move type.
+//			Enabling or toggling it leaves the bounds alone, but if it actually
+//			moved or can move now, it's no longer static and goes back to the
+//			engine.
+//-----------------------------------------------------------------------------
+void CTriggerBroadphase::TriggerMoved( CBaseEntity *pTrigger )
+{
+	if ( !IsTriggerInBroadphase( pTrigger ) )
+		return;
+
+	if ( pTrigger->GetMoveParent() || pTrigger->GetMoveType() != MOVETYPE_NONE || pTrigger->VPhysicsGetObject() )
+	{
+		RemoveTrigger( pTrigger );
+		return;
+	}
+
+	int i = FindTrigger( pTrigger );
+	if ( i == -1 )
+		return;
+
+	Vector vecMins, vecMaxs;
+	pTrigger->CollisionProp()->WorldSpaceAABB( &vecMins, &vecMaxs );
+	if ( vecMins != m_Triggers[i].vecMins || vecMaxs != m_Triggers[i].vecMaxs )
+	{
+		RemoveTrigger( pTrigger );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sorts the triggers along x and builds the running max of their
+//			far edges, so a query can stop walking back as soon as no earlier
+//			trigger can reach it.
+//-----------------------------------------------------------------------------
+int __cdecl CTriggerBroadphase::CompareEntries( const TriggerEntry_t *p1, const TriggerEntry_t *p2 )
+{
+	if ( p1->vecMins.x < p2->vecMins.x )
+		return -1;
+	return ( p1->vecMins.x > p2->vecMins.x ) ? 1 : 0;
+}
+
+void CTriggerBroadphase::Rebuild()
+{
+	// Drop anything that was deleted without telling us
+	for ( int i = m_Triggers.Count() - 1; i >= 0; i-- )
+	{
+		if ( m_Triggers[i].hTrigger == NULL )
+		{
+			m_Triggers.FastRemove( i );
+		}
+	}
+
+	m_Triggers.Sort( CompareEntries );
+
+	m_MaxXPrefix.SetCount( m_Triggers.Count() );
+	float flMaxX = -FLT_MAX;
+	for ( int i = 0; i < m_Triggers.Count(); i++ )
+	{
+		flMaxX = max( flMaxX, m_Triggers[i].vecMaxs.x );
+		m_MaxXPrefix[i] = flMaxX;
+	}
+
+	m_bDirty = false;
+	m_nGeneration++;
+	m_nRebuilds++;
+}
+
+//-----------------------------------------------------------------------------
+
+void CTriggerBroadphase::GatherCandidates( const Vector &vecMins, const Vector &vecMaxs, CUtlVector<unsigned short> &list )
+{
+	list.RemoveAll();
+
+	// Find the first trigger starting beyond the box
+	int lo = 0;
+	int hi = m_Triggers.Count();
+	while ( lo < hi )
+	{
+		int mid = ( lo + hi ) / 2;
+		if ( m_Triggers[mid].vecMins.x <= vecMaxs.x )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	// Everything before it starts early enough; walk back until nothing can reach the box
+	for ( int i = lo - 1; i >= 0 && m_MaxXPrefix[i] >= vecMins.x; i-- )
+	{
+		m_nCandidatesTested++;
+		if ( IsBoxIntersectingBox( vecMins, vecMaxs, m_Triggers[i].vecMins, m_Triggers[i].vecMaxs ) )
+		{
+			list.AddToTail( i );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Marks the solid as touching each static trigger its trigger bounds
+//			overlap, swept from pPrevAbsOrigin if there is one.
+//-----------------------------------------------------------------------------
+void CTriggerBroadphase::SolidMoved( CBaseEntity *pSolid, const Vector *pPrevAbsOrigin )
+{
+	if ( !m_Triggers.Count() )
+		return;
+
+	VPROF_BUDGET( "CTriggerBroadphase::SolidMoved", VPROF_BUDGETGROUP_PHYSICS );
+
+	if ( m_bDirty )
+	{
+		Rebuild();
+	}
+
+	Vector vecMins, vecMaxs;
+	pSolid->CollisionProp()->WorldSpaceTriggerBounds( &vecMins, &vecMaxs );
+
+	Vector vecDelta( 0, 0, 0 );
+	Vector vecSweepMins = vecMins;
+	Vector vecSweepMaxs = vecMaxs;
+	if ( pPrevAbsOrigin )
+	{
+		vecDelta = *pPrevAbsOrigin - pSolid->GetAbsOrigin();
+		VectorMin( vecSweepMins, vecMins + vecDelta, vecSweepMins );
+		VectorMax( vecSweepMaxs, vecMaxs + vecDelta, vecSweepMaxs );
+	}
+
+	m_nQueries++;
+
+	// Reuse the candidates from last time if we're still inside the padded box
+	SolidCache_t &cache = m_SolidCache[ pSolid->entindex() ];
+	if ( cache.hSolid == pSolid &&
+		 cache.nGeneration == m_nGeneration &&
+		 vecSweepMins.x >= cache.vecFatMins.x && vecSweepMins.y >= cache.vecFatMins.y && vecSweepMins.z >= cache.vecFatMins.z &&
+		 vecSweepMaxs.x <= cache.vecFatMaxs.x && vecSweepMaxs.y <= cache.vecFatMaxs.y && vecSweepMaxs.z <= cache.vecFatMaxs.z )
+	{
+		m_nCacheHits++;
+	}
+	else
+	{
+		float flMargin = sv_trigger_broadphase_margin.GetFloat();
+		Vector vecMargin( flMargin, flMargin, flMargin );
+
+		cache.hSolid = pSolid;
+		cache.nGeneration = m_nGeneration;
+		cache.vecFatMins = vecSweepMins - vecMargin;
+		cache.vecFatMaxs = vecSweepMaxs + vecMargin;
+		GatherCandidates( cache.vecFatMins, cache.vecFatMaxs, cache.candidates );
+	}
+
+	if ( !cache.candidates.Count() )
+		return;
+
+	Vector vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+	Vector vecExtents = vecMaxs - vecCenter;
+
+	Ray_t ray;
+	ray.Init( vecCenter + vecDelta, vecCenter, -vecExtents, vecExtents );
+
+	// Touch functions can add or remove triggers, so collect first
+	CBaseEntity **ppTouched = (CBaseEntity **)stackalloc( cache.candidates.Count() * sizeof(CBaseEntity *) );
+	int nTouched = 0;
+
+	for ( int i = 0; i < cache.candidates.Count(); i++ )
+	{
+		TriggerEntry_t &entry = m_Triggers[ cache.candidates[i] ];
+		if ( !IsBoxIntersectingBox( vecSweepMins, vecSweepMaxs, entry.vecMins, entry.vecMaxs ) )
+			continue;
+
+		CBaseEntity *pTrigger = entry.hTrigger;
+		if ( !pTrigger || pTrigger == pSolid || !pTrigger->IsSolidFlagSet( FSOLID_TRIGGER ) )
+			continue;
+
+		m_nNarrowphaseTests++;
+
+		trace_t tr;
+		enginetrace->ClipRayToEntity( ray, MASK_ALL, pTrigger, &tr );
+		if ( tr.startsolid || tr.fraction < 1.0f )
+		{
+			ppTouched[nTouched++] = pTrigger;
+		}
+	}
+
+	for ( int i = 0; i < nTouched; i++ )
+	{
+		// Same as the engine does through CServerGameEnts::MarkEntitiesAsTouching
+		trace_t tr;
+		UTIL_ClearTrace( tr );
+		tr.endpos = ( ppTouched[i]->GetAbsOrigin() + pSolid->GetAbsOrigin() ) * 0.5;
+		ppTouched[i]->PhysicsMarkEntitiesAsTouching( pSolid, tr );
+		m_nTouches++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void CTriggerBroadphase::EnumerateAlongRay( const Ray_t &ray, IEntityEnumerator *pEnum )
+{
+	if ( !m_Triggers.Count() )
+		return;
+
+	if ( m_bDirty )
+	{
+		Rebuild();
+	}
+
+	Vector vecEnd = ray.m_Start + ray.m_Delta;
+	Vector vecMins, vecMaxs;
+	VectorMin( ray.m_Start, vecEnd, vecMins );
+	VectorMax( ray.m_Start, vecEnd, vecMaxs );
+	vecMins -= ray.m_Extents;
+	vecMaxs += ray.m_Extents;
+
+	CUtlVector<unsigned short> candidates;
+	GatherCandidates( vecMins, vecMaxs, candidates );
+
+	CUtlVector<EHANDLE> triggers;
+	for ( int i = 0; i < candidates.Count(); i++ )
+	{
+		triggers.AddToTail( m_Triggers[ candidates[i] ].hTrigger );
+	}
+
+	for ( int i = 0; i < triggers.Count(); i++ )
+	{
+		CBaseEntity *pTrigger = triggers[i];
+		if ( pTrigger && pTrigger->IsSolidFlagSet( FSOLID_TRIGGER ) )
+		{
+			if ( !pEnum->EnumEntity( pTrigger ) )
+				break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void CTriggerBroadphase::ReportStats()
+{
+	Msg( "Trigger broadphase: %d static triggers (%d rebuilds)\n", m_Triggers.Count(), m_nRebuilds );
+	Msg( "  %d queries, %d reused cached candidates (%.1f%%)\n",
+		m_nQueries, m_nCacheHits, ( m_nQueries ) ? 100.0f * m_nCacheHits / m_nQueries : 0.0f );
+	Msg( "  %d candidate box tests, %d narrowphase tests, %d touches\n",
+		m_nCandidatesTested, m_nNarrowphaseTests, m_nTouches );
+}
+
+void CTriggerBroadphase::ResetStats()
+{
+	m_nQueries = 0;
+	m_nCacheHits = 0;
+	m_nCandidatesTested = 0;
+	m_nNarrowphaseTests = 0;
+	m_nTouches = 0;
+	m_nRebuilds = 0;
+}
+
+CON_COMMAND( sv_trigger_broadphase_stats, "Report trigger broadphase stats. Pass \"reset\" to clear them" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_TriggerBroadphase.ReportStats();
+
+	if ( engine->Cmd_Argc() > 1 && !Q_stricmp( engine->Cmd_Argv( 1 ), "reset" ) )
+	{
+		g_TriggerBroadphase.ResetStats();
+	}
+}
@@ -0,0 +1,96 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Sweep-and-prune broadphase for static trigger volumes
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef TRIGGER_BROADPHASE_H
+#define TRIGGER_BROADPHASE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "igamesystem.h"
+#include "utlvector.h"
+#include "bitvec.h"
+
+class CBaseEntity;
+class IEntityEnumerator;
+struct Ray_t;
+
+//-----------------------------------------------------------------------------
+// Purpose: Triggers that never move are kept here instead of in the engine's
+//			trigger partition list. Their bounds are sorted along x, and each
+//			moving solid remembers which triggers overlap a padded box around
+//			it, so most moves only re-test that short list.
+//			Touch links are still made through PhysicsMarkEntitiesAsTouching,
+//			so StartTouch/EndTouch come from the usual touch stamps.
+//-----------------------------------------------------------------------------
+class CTriggerBroadphase : public CAutoGameSystem
+{
+public:
+	CTriggerBroadphase( char const *name );
+
+	// IGameSystem
+	virtual void	LevelShutdownPostEntity();
+
+	void			AddTrigger( CBaseEntity *pTrigger );
+	void			RemoveTrigger( CBaseEntity *pTrigger );
+	void			RemoveAllTriggers();
+	bool			IsTriggerInBroadphase( const CBaseEntity *pTrigger ) const;
+
+	// Called from CBaseEntity::PhysicsTouchTriggers; TriggerMoved also from
+	// partition updates and parent/move type changes
+	void			SolidMoved( CBaseEntity *pSolid, const Vector *pPrevAbsOrigin );
+	void			TriggerMoved( CBaseEntity *pTrigger );
+
+	// Calls pEnum for every trigger whose bounds the ray passes through
+	void			EnumerateAlongRay( const Ray_t &ray, IEntityEnumerator *pEnum );
+
+	void			ReportStats();
+	void			ResetStats();
+
+private:
+	void			Rebuild();
+	int				FindTrigger( const CBaseEntity *pTrigger ) const;
+	void			GatherCandidates( const Vector &vecMins, const Vector &vecMaxs, CUtlVector<unsigned short> &list );
+
+	struct TriggerEntry_t
+	{
+		EHANDLE		hTrigger;
+		Vector		vecMins;
+		Vector		vecMaxs;
+	};
+
+	static int __cdecl CompareEntries( const TriggerEntry_t *p1, const TriggerEntry_t *p2 );
+
+	struct SolidCache_t
+	{
+		EHANDLE		hSolid;
+		int			nGeneration;
+		Vector		vecFatMins;
+		Vector		vecFatMaxs;
+		CUtlVector<unsigned short> candidates;		// Indices into m_Triggers overlapping the fat box
+	};
+
+	CUtlVector<TriggerEntry_t>	m_Triggers;				// Sorted by vecMins.x after Rebuild()
+	CUtlVector<float>			m_MaxXPrefix;			// Largest vecMaxs.x among m_Triggers[0..i]
+	CBitVec<MAX_EDICTS>			m_InBroadphase;
+	bool						m_bDirty;
+	int							m_nGeneration;			// Bumped whenever indices into m_Triggers change
+
+	SolidCache_t				m_SolidCache[MAX_EDICTS];
+
+	// Stats
+	int		m_nQueries;
+	int		m_nCacheHits;
+	int		m_nCandidatesTested;
+	int		m_nNarrowphaseTests;
+	int		m_nTouches;
+	int		m_nRebuilds;
+};
+
+extern CTriggerBroadphase g_TriggerBroadphase;
+
+#endif // TRIGGER_BROADPHASE_H
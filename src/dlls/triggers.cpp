@@ -33,6 +33,7 @@
 #include "ai_behavior_follow.h"
 #include "ai_behavior_lead.h"
 #include "gameinterface.h"
+#include "trigger_broadphase.h"
 
 #ifdef HL2_DLL
 #include "hl2_player.h"
@@ -193,6 +194,8 @@ void CBaseTrigger::UpdateOnRemove( void )
 		VPhysicsGetObject()->RemoveTrigger();
 	}
 
+	g_TriggerBroadphase.RemoveTrigger( this );
+
 	BaseClass::UpdateOnRemove();
 }
 
@@ -228,6 +231,9 @@ void CBaseTrigger::Activate( void )
 	}
 
 	BaseClass::Activate();
+
+	// Static triggers are touched through the trigger broadphase
+	g_TriggerBroadphase.AddTrigger( this );
 }
 
 
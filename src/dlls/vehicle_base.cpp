@@ -18,6 +18,7 @@
 #include "func_break.h"
 #include "physics_impact_damage.h"
 #include "entityblocker.h"
+#include "ilagcompensationmanager.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -370,6 +371,7 @@ CPropVehicleDriveable::CPropVehicleDriveable( void ) :
 //-----------------------------------------------------------------------------
 CPropVehicleDriveable::~CPropVehicleDriveable( void )
 {
+	lagcompensation->RemoveAdditionalEntity( this );
 	DestroyServerVehicle();
 }
 
@@ -423,6 +425,8 @@ void CPropVehicleDriveable::Spawn( void )
 	m_flMinimumSpeedToEnterExit = 0;
 	m_takedamage = DAMAGE_EVENTS_ONLY;
 	m_bEngineLocked = false;
+
+	lagcompensation->AddAdditionalEntity( this );
 }
 
 
@@ -654,6 +654,9 @@ BASEPTR	CBaseEntity::ThinkSet( BASEPTR func, float thinkTime, const char *szCont
 		int thinkTick = ( thinkTime == TICK_NEVER_THINK ) ? TICK_NEVER_THINK : TIME_TO_TICKS( thinkTime );
 		m_aThinkFunctions[ iIndex ].m_nNextThinkTick = thinkTick;
 		CheckHasThinkFunction( thinkTick == TICK_NEVER_THINK ? false : true );
+#if !defined( CLIENT_DLL )
+		SimThink_ThinkScheduled( this, thinkTick );
+#endif
 	}
 	return func;
 }
@@ -679,6 +682,9 @@ void CBaseEntity::SetNextThink( float thinkTime, const char *szContext )
 		// Old system
 		m_nNextThinkTick = thinkTick;
 		CheckHasThinkFunction( thinkTick == TICK_NEVER_THINK ? false : true );
+#if !defined( CLIENT_DLL )
+		SimThink_ThinkScheduled( this, thinkTick );
+#endif
 		return;
 	}
 	else
@@ -694,6 +700,9 @@ void CBaseEntity::SetNextThink( float thinkTime, const char *szContext )
 	// Old system
 	m_aThinkFunctions[ iIndex ].m_nNextThinkTick = thinkTick;
 	CheckHasThinkFunction( thinkTick == TICK_NEVER_THINK ? false : true );
+#if !defined( CLIENT_DLL )
+	SimThink_ThinkScheduled( this, thinkTick );
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -906,6 +915,9 @@ void CBaseEntity::SetNextThink( int nContextIndex, float thinkTime )
 	else
 	{
 		m_aThinkFunctions[nContextIndex].m_nNextThinkTick = thinkTick;
+#if !defined( CLIENT_DLL )
+		SimThink_ThinkScheduled( this, thinkTick );
+#endif
 	}
 	CheckHasThinkFunction( thinkTick == TICK_NEVER_THINK ? false : true );
 }
@@ -11,6 +11,7 @@
 #endif
 
 #include "tier1/utlvector.h"
+#include "tier1/mempool.h"
 
 class CChoreoChannel;
 class CChoreoScene;
@@ -83,6 +84,8 @@ private:
 
 	// Purely for save/load
 	bool			m_bMarkedForSave;
+
+	DECLARE_FIXEDSIZE_ALLOCATOR( CChoreoActor );
 };
 
 #endif // CHOREOACTOR_H
@@ -13,6 +13,7 @@
 
 #include "tier1/utlvector.h"
 #include "tier1/utlrbtree.h"
+#include "tier1/mempool.h"
 
 class CChoreoEvent;
 class CChoreoActor;
@@ -89,6 +90,8 @@ private:
 
 	// Purely for save/load
 	bool			m_bMarkedForSave;
+
+	DECLARE_FIXEDSIZE_ALLOCATOR( CChoreoChannel );
 };
 
 #endif // CHOREOCHANNEL_H
@@ -24,6 +24,9 @@
 
 int CChoreoEvent::s_nGlobalID = 1;
 
+DEFINE_FIXEDSIZE_ALLOCATOR( CChoreoEvent, 256, CMemoryPool::GROW_FAST );
+DEFINE_FIXEDSIZE_ALLOCATOR( CFlexAnimationTrack, 128, CMemoryPool::GROW_FAST );
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : *owner - 
@@ -21,6 +21,7 @@ class CUtlBuffer;
 
 #include <string>
 #include "tier1/utlvector.h"
+#include "tier1/mempool.h"
 #include "expressionsample.h"
 #include "networkvar.h"
 
@@ -241,6 +242,9 @@ private:
 	bool				m_bServerSide:1;
 
 	bool				m_bInverted; // track is displayed 1..0 instead of 0..1
+
+	// Scenes are rebuilt every time an npc starts a line, so tracks come from a pool
+	DECLARE_FIXEDSIZE_ALLOCATOR( CFlexAnimationTrack );
 };
 
 //-----------------------------------------------------------------------------
@@ -701,6 +705,9 @@ public:
 
 	bool			m_bForceShortMovement:1;
 	bool			m_bSyncToFollowingGesture:1;
+
+	// Scenes are rebuilt every time an npc starts a line, so events come from a pool
+	DECLARE_FIXEDSIZE_ALLOCATOR( CChoreoEvent );
 };
 
 #endif // CHOREOEVENT_H
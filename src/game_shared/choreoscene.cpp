@@ -3904,6 +3904,7 @@ bool CChoreoScene::RestoreFromBuffer( CUtlBuffer& buf, char const *filename )
 
 	int i;
 	int eventCount = buf.GetShort();
+	m_Events.EnsureCapacity( m_Events.Count() + eventCount );
 	for ( i = 0; i < eventCount; ++i )
 	{
 		MEM_ALLOC_CREDIT();
@@ -3919,6 +3920,7 @@ bool CChoreoScene::RestoreFromBuffer( CUtlBuffer& buf, char const *filename )
 	}
 
 	int actorCount = buf.GetShort();
+	m_Actors.EnsureCapacity( m_Actors.Count() + actorCount );
 	for ( i = 0; i < actorCount; ++i )
 	{
 		CChoreoActor *a = AllocActor();
@@ -22,6 +22,7 @@
 #include "baseanimating.h"
 #include "sendproxy.h"
 #include "hierarchy.h"
+#include "trigger_broadphase.h"
 #endif
 
 #include "predictable_entity.h"
@@ -1167,12 +1168,15 @@ void CCollisionProperty::UpdateServerPartitionMask( )
 	{
 		mask |=	PARTITION_ENGINE_SOLID_EDICTS;
 	}
-	if ( IsSolidFlagSet(FSOLID_TRIGGER) )
+	if ( IsSolidFlagSet(FSOLID_TRIGGER) && !g_TriggerBroadphase.IsTriggerInBroadphase( m_pOuter ) )
 	{
+		// Static triggers are tested by the game's trigger broadphase instead
 		mask |=	PARTITION_ENGINE_TRIGGER_EDICTS;
 	}
-	Assert( mask != 0 );
-	partition->Insert( mask, handle );
+	if ( mask != 0 )
+	{
+		partition->Insert( mask, handle );
+	}
 #endif
 }
 
@@ -1220,6 +1224,13 @@ void CCollisionProperty::UpdatePartition( )
 			CreatePartitionHandle();
 			UpdateServerPartitionMask();
 		}
+
+		// Static triggers keep cached bounds in the broadphase; teleports and
+		// size changes come through here without running PhysicsTouchTriggers
+		if ( IsSolidFlagSet( FSOLID_TRIGGER ) )
+		{
+			g_TriggerBroadphase.TriggerMoved( m_pOuter );
+		}
 #else
 		if ( GetPartitionHandle() == PARTITION_INVALID_HANDLE )
 			return;
@@ -255,6 +255,7 @@ private:
 	//IPhysicsObject	*m_pPhysicsObject;
 	
 	friend class CBaseEntity;
+	friend class CTriggerBroadphase;
 };
 
 
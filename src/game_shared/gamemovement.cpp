@@ -48,6 +48,12 @@ ConVar xc_uncrouch_on_jump( "xc_uncrouch_on_jump", "1", FCVAR_ARCHIVE, "Uncrouch
 // [MD] I'll remove this eventually. For now, I want the ability to A/B the optimizations.
 bool g_bMovementOptimizations = true;
 
+#ifndef CLIENT_DLL
+static ConVar sv_showmovementtraces( "sv_showmovementtraces", "0", 0, "Show the traces and point contents queries made by each player's last usercmd." );
+#else
+static ConVar sv_showmovementtraces( "cl_showmovementtraces", "0", 0, "Show the traces and point contents queries made by each predicted usercmd." );
+#endif
+
 // Roughly how often we want to update the info about the ground surface we're on.
 // We don't need to do this very often.
 #define CATEGORIZE_GROUND_SURFACE_INTERVAL			0.3f
@@ -168,6 +174,7 @@ CGameMovement::CGameMovement( void )
 	mv					= NULL;
 
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
+	m_bCachedGroundTrace = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -313,6 +320,8 @@ inline
 
 CBaseHandle CGameMovement::TestPlayerPosition( const Vector& pos, int collisionGroup, trace_t& pm )
 {
+	++m_nMovementTraces;
+
 	Ray_t ray;
 	ray.Init( pos, pos, GetPlayerMins(), GetPlayerMaxs() );
 	UTIL_TraceRay( ray, PlayerSolidMask(), mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
@@ -693,6 +702,13 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 	gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
 
 	ResetGetPointContentsCache();
+	ResetGroundTraceCache();
+
+	m_nMovementTraces = 0;
+	m_nGroundSubBoxQueries = 0;
+	m_nPointContentsQueries = 0;
+	m_nPointContentsCacheHits = 0;
+	m_nGroundTraceCacheHits = 0;
 
 	// Cropping movement speed scales mv->m_fForwardSpeed etc. globally
 	// Once we crop, we don't want to recursively crop again, so we set the crop
@@ -712,6 +728,11 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	FinishTrackPredictionErrors();
 
+	if ( sv_showmovementtraces.GetBool() )
+	{
+		ReportMovementTraces();
+	}
+
 	//This is probably not needed, but just in case.
 	gpGlobals->frametime = flStoreFrametime;
 }
@@ -2997,19 +3018,77 @@ int CGameMovement::GetPointContentsCached( const Vector &point )
 	{
 		if ( m_CachedGetPointContents == -9999 || point.DistToSqr( m_CachedGetPointContentsPoint ) > 1 )
 		{
+			++m_nPointContentsQueries;
 			m_CachedGetPointContents = enginetrace->GetPointContents ( point );
 			m_CachedGetPointContentsPoint = point;
 		}
+		else
+		{
+			++m_nPointContentsCacheHits;
+		}
 		
 		return m_CachedGetPointContents;
 	}
 	else
 	{
+		++m_nPointContentsQueries;
 		return enginetrace->GetPointContents ( point );
 	}
 }
 
 
+void CGameMovement::ResetGroundTraceCache()
+{
+	m_bCachedGroundTrace = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the ground trace from an earlier CategorizePosition() in this
+//			command if the player is still at the same origin with the same hull.
+//-----------------------------------------------------------------------------
+bool CGameMovement::GetGroundTraceCached( trace_t &pm )
+{
+	if ( !g_bMovementOptimizations || !m_bCachedGroundTrace )
+		return false;
+
+	if ( mv->m_vecAbsOrigin != m_CachedGroundTraceOrigin ||
+		 GetPlayerMins() != m_CachedGroundTraceMins ||
+		 GetPlayerMaxs() != m_CachedGroundTraceMaxs )
+	{
+		return false;
+	}
+
+	pm = m_CachedGroundTrace;
+	++m_nGroundTraceCacheHits;
+	return true;
+}
+
+
+void CGameMovement::ReportMovementTraces( void )
+{
+#ifndef _LINUX
+	bool isServer = player->IsServer();
+	engine->Con_NPrintf( player->entindex(), "%s %d cmd %d: %d traces, %d ground sub-box, %d contents (%d cached), %d ground reused", 
+		isServer ? "server" : "client",
+		player->entindex(), player->CurrentCommandNumber(),
+		m_nMovementTraces, m_nGroundSubBoxQueries,
+		m_nPointContentsQueries, m_nPointContentsCacheHits,
+		m_nGroundTraceCacheHits );
+#endif
+}
+
+
+void CGameMovement::SetGroundTraceCached( const trace_t &pm )
+{
+	m_bCachedGroundTrace = true;
+	m_CachedGroundTraceOrigin = mv->m_vecAbsOrigin;
+	m_CachedGroundTraceMins = GetPlayerMins();
+	m_CachedGroundTraceMaxs = GetPlayerMaxs();
+	m_CachedGroundTrace = pm;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : &input - 
@@ -3043,6 +3122,7 @@ bool CGameMovement::CheckWater( void )
 
 		// Now check a point that is at the player hull midpoint.
 		point[2] = mv->m_vecAbsOrigin[2] + (GetPlayerMins()[2] + GetPlayerMaxs()[2])*0.5;
+		++m_nPointContentsQueries;
 		cont = enginetrace->GetPointContents( point );
 		// If that point is also under water...
 		if ( cont & MASK_WATER )
@@ -3052,6 +3132,7 @@ bool CGameMovement::CheckWater( void )
 
 			// Now check the eye position.  (view_ofs is relative to the origin)
 			point[2] = mv->m_vecAbsOrigin[2] + player->GetViewOffset()[2];
+			++m_nPointContentsQueries;
 			cont = enginetrace->GetPointContents( point );
 			if ( cont & MASK_WATER )
 				player->SetWaterLevel( WL_Eyes );  // In over our eyes
@@ -3228,36 +3309,39 @@ void CGameMovement::CategorizePosition( void )
 	}
 	else
 	{
-		// Try and move down.
-		TracePlayerBBox( bumpOrigin, point, MASK_PLAYERSOLID, COLLISION_GROUP_PLAYER_MOVEMENT, pm );
-		
-		// Moving up two units got us stuck in something, start tracing down exactly at our
-		//  current origin (since CheckStuck allowed us to get here, that pos is valid)
-		if ( pm.startsolid )
+		// A player that hasn't moved since the last categorize this command gets the same answer
+		if ( !GetGroundTraceCached( pm ) )
 		{
-			bumpOrigin = mv->m_vecAbsOrigin;
+			// Try and move down.
 			TracePlayerBBox( bumpOrigin, point, MASK_PLAYERSOLID, COLLISION_GROUP_PLAYER_MOVEMENT, pm );
+			
+			// Moving up two units got us stuck in something, start tracing down exactly at our
+			//  current origin (since CheckStuck allowed us to get here, that pos is valid)
+			if ( pm.startsolid )
+			{
+				bumpOrigin = mv->m_vecAbsOrigin;
+				TracePlayerBBox( bumpOrigin, point, MASK_PLAYERSOLID, COLLISION_GROUP_PLAYER_MOVEMENT, pm );
+			}
+
+			// If we hit a steep plane, test four sub-boxes, to see if any of them would have found
+			// shallower slope we could actually stand on
+			if ( pm.plane.normal[2] < 0.7)
+			{
+				++m_nGroundSubBoxQueries;
+				TracePlayerBBoxForGround( bumpOrigin, point, GetPlayerMins(), GetPlayerMaxs(), mv->m_nPlayerHandle.Get(), MASK_PLAYERSOLID, COLLISION_GROUP_PLAYER_MOVEMENT, pm );
+			}
+
+			SetGroundTraceCached( pm );
 		}
 
 		// If we hit a steep plane, we are not on ground
 		if ( pm.plane.normal[2] < 0.7)
 		{
-			// Test four sub-boxes, to see if any of them would have found shallower slope we could
-			// actually stand on
-			TracePlayerBBoxForGround( bumpOrigin, point, GetPlayerMins(), GetPlayerMaxs(), mv->m_nPlayerHandle.Get(), MASK_PLAYERSOLID, COLLISION_GROUP_PLAYER_MOVEMENT, pm );
-			if ( pm.plane.normal[2] < 0.7)
-			{
-
-				SetGroundEntity( (CBaseEntity *)NULL );	// too steep
-				// probably want to add a check for a +z velocity too!
-				if ( ( mv->m_vecVelocity.z > 0.0f ) && ( player->GetMoveType() != MOVETYPE_NOCLIP ) )
-				{
-					player->m_surfaceFriction = 0.25f;
-				}
-			}
-			else
+			SetGroundEntity( (CBaseEntity *)NULL );	// too steep
+			// probably want to add a check for a +z velocity too!
+			if ( ( mv->m_vecVelocity.z > 0.0f ) && ( player->GetMoveType() != MOVETYPE_NOCLIP ) )
 			{
-				SetGroundEntity( pm.m_pEnt );  // Otherwise, point to index of ent under us.
+				player->m_surfaceFriction = 0.25f;
 			}
 		}
 		else
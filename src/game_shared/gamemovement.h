@@ -186,6 +186,12 @@ protected:
 	void ResetGetPointContentsCache();
 	int GetPointContentsCached( const Vector &point );
 
+	void ResetGroundTraceCache();
+	bool GetGroundTraceCached( trace_t &pm );
+	void SetGroundTraceCached( const trace_t &pm );
+
+	void ReportMovementTraces( void );
+
 	// Ducking
 	virtual void	Duck( void );
 	virtual void	HandleDuckingSpeedCrop();
@@ -240,6 +246,20 @@ protected:
 	int m_CachedGetPointContents;
 	Vector m_CachedGetPointContentsPoint;	
 
+	// Cache used to reuse CategorizePosition()'s ground trace within a command when the player hasn't moved.
+	bool m_bCachedGroundTrace;
+	Vector m_CachedGroundTraceOrigin;
+	Vector m_CachedGroundTraceMins;
+	Vector m_CachedGroundTraceMaxs;
+	trace_t m_CachedGroundTrace;
+
+	// Per-usercmd query counts, shown by sv_showmovementtraces/cl_showmovementtraces.
+	int m_nMovementTraces;
+	int m_nGroundSubBoxQueries;
+	int m_nPointContentsQueries;
+	int m_nPointContentsCacheHits;
+	int m_nGroundTraceCacheHits;
+
 	Vector			m_vecProximityMins;		// Used to be globals in sv_user.cpp.
 	Vector			m_vecProximityMaxs;
 
@@ -259,6 +279,8 @@ inline void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& e
 {
 	VPROF( "CGameMovement::TracePlayerBBox" );
 
+	++m_nMovementTraces;
+
 	Ray_t ray;
 	ray.Init( start, end, GetPlayerMins(), GetPlayerMaxs() );
 	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
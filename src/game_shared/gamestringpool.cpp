@@ -7,7 +7,7 @@
 
 #include "cbase.h"
 
-#include "stringpool.h"
+#include "generichash.h"
 #include "igamesystem.h"
 #include "gamestringpool.h"
 
@@ -16,8 +16,13 @@
 
 //-----------------------------------------------------------------------------
 // Purpose: The actual storage for pooled per-level strings
+//
+// Strings are hashed case-insensitively into a fixed bucket table; each entry 
+// keeps its hash so chains only fall back to Q_stricmp when the hashes match.  
+// The characters themselves are packed into large blocks that are released 
+// together at level shutdown.
 //-----------------------------------------------------------------------------
-class CGameStringPool : public CStringPool,	public CBaseGameSystem
+class CGameStringPool : public CBaseGameSystem
 {
 	virtual char const *Name() { return "CGameStringPool"; }
 
@@ -27,16 +32,161 @@ class CGameStringPool : public CStringPool,	public CBaseGameSystem
 	}
 
 public:
-	void CGameStringPool::Dump( void )
+	CGameStringPool();
+	~CGameStringPool();
+
+	const char *Allocate( const char *pszValue );
+	const char *Find( const char *pszValue );
+	void FreeAll();
+	void Dump( void );
+
+private:
+	enum
+	{
+		NUM_BUCKETS = 4096,					// must be a power of two
+		STRING_BLOCK_SIZE = 16 * 1024,
+	};
+
+	struct PooledString_t
+	{
+		const char		*m_pszValue;
+		unsigned int	m_nHash;
+		int				m_nNext;
+	};
+
+	int FindInBucket( const char *pszValue, unsigned int nHash ) const;
+	char *AllocStringMemory( int nLength );
+
+	CUtlVector< PooledString_t >	m_Strings;
+	int								m_Buckets[ NUM_BUCKETS ];
+
+	// Character storage
+	CUtlVector< char * >			m_Blocks;
+	int								m_nBlockUsed;
+};
+
+CGameStringPool::CGameStringPool()
+{
+	m_nBlockUsed = STRING_BLOCK_SIZE;
+	for ( int i = 0; i < NUM_BUCKETS; ++i )
 	{
-		for ( int i = m_Strings.FirstInorder(); i != m_Strings.InvalidIndex(); i = m_Strings.NextInorder(i) )
+		m_Buckets[ i ] = m_Strings.InvalidIndex();
+	}
+}
+
+CGameStringPool::~CGameStringPool()
+{
+	FreeAll();
+}
+
+int CGameStringPool::FindInBucket( const char *pszValue, unsigned int nHash ) const
+{
+	for ( int i = m_Buckets[ nHash & ( NUM_BUCKETS - 1 ) ]; i != m_Strings.InvalidIndex(); i = m_Strings[ i ].m_nNext )
+	{
+		const PooledString_t &entry = m_Strings[ i ];
+		if ( entry.m_nHash == nHash && !Q_stricmp( entry.m_pszValue, pszValue ) )
+			return i;
+	}
+
+	return m_Strings.InvalidIndex();
+}
+
+char *CGameStringPool::AllocStringMemory( int nLength )
+{
+	// Oversized strings get a block of their own so the current block keeps filling
+	if ( nLength > STRING_BLOCK_SIZE / 4 )
+	{
+		char *pBlock = new char[ nLength ];
+		m_Blocks.AddToHead( pBlock );
+		return pBlock;
+	}
+
+	if ( m_nBlockUsed + nLength > STRING_BLOCK_SIZE )
+	{
+		m_Blocks.AddToTail( new char[ STRING_BLOCK_SIZE ] );
+		m_nBlockUsed = 0;
+	}
+
+	char *pMemory = m_Blocks[ m_Blocks.Count() - 1 ] + m_nBlockUsed;
+	m_nBlockUsed += nLength;
+	return pMemory;
+}
+
+const char *CGameStringPool::Find( const char *pszValue )
+{
+	int i = FindInBucket( pszValue, HashStringCaselessConventional( pszValue ) );
+	if ( i == m_Strings.InvalidIndex() )
+		return NULL;
+
+	return m_Strings[ i ].m_pszValue;
+}
+
+const char *CGameStringPool::Allocate( const char *pszValue )
+{
+	unsigned int nHash = HashStringCaselessConventional( pszValue );
+	int i = FindInBucket( pszValue, nHash );
+	if ( i != m_Strings.InvalidIndex() )
+		return m_Strings[ i ].m_pszValue;
+
+	MEM_ALLOC_CREDIT();
+	int nLength = Q_strlen( pszValue ) + 1;
+	char *pszNew = AllocStringMemory( nLength );
+	memcpy( pszNew, pszValue, nLength );
+
+	int nBucket = nHash & ( NUM_BUCKETS - 1 );
+	i = m_Strings.AddToTail();
+	m_Strings[ i ].m_pszValue = pszNew;
+	m_Strings[ i ].m_nHash = nHash;
+	m_Strings[ i ].m_nNext = m_Buckets[ nBucket ];
+	m_Buckets[ nBucket ] = i;
+
+	return pszNew;
+}
+
+void CGameStringPool::FreeAll()
+{
+	for ( int i = 0; i < m_Blocks.Count(); ++i )
+	{
+		delete[] m_Blocks[ i ];
+	}
+	m_Blocks.Purge();
+	m_nBlockUsed = STRING_BLOCK_SIZE;
+
+	m_Strings.Purge();
+	for ( int i = 0; i < NUM_BUCKETS; ++i )
+	{
+		m_Buckets[ i ] = m_Strings.InvalidIndex();
+	}
+}
+
+void CGameStringPool::Dump( void )
+{
+	int nUsedBuckets = 0;
+	int nLongestChain = 0;
+	for ( int i = 0; i < NUM_BUCKETS; ++i )
+	{
+		int nChain = 0;
+		for ( int j = m_Buckets[ i ]; j != m_Strings.InvalidIndex(); j = m_Strings[ j ].m_nNext )
 		{
-			DevMsg( "  %d (0x%x) : %s\n", i, m_Strings[i], m_Strings[i] );
+			++nChain;
+		}
+
+		if ( nChain )
+		{
+			++nUsedBuckets;
+			nLongestChain = max( nLongestChain, nChain );
 		}
-		DevMsg( "\n" );
-		DevMsg( "Size:  %d items\n", m_Strings.Count() );
 	}
-};
+
+	for ( int i = 0; i < m_Strings.Count(); ++i )
+	{
+		DevMsg( "  %d (0x%x) : %s\n", i, m_Strings[i].m_pszValue, m_Strings[i].m_pszValue );
+	}
+	DevMsg( "\n" );
+	DevMsg( "Size:  %d items\n", m_Strings.Count() );
+	DevMsg( "Buckets:  %d of %d used, longest chain %d\n", nUsedBuckets, NUM_BUCKETS, nLongestChain );
+	DevMsg( "Storage:  %d blocks\n", m_Blocks.Count() );
+}
 
 static CGameStringPool g_GameStringPool;
 
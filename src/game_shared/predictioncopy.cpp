@@ -21,6 +21,7 @@
 #include "vstdlib/strtools.h"
 #include "predictioncopy.h"
 #include "engine/ivmodelinfo.h"
+#include "utlmap.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1238,6 +1239,302 @@ void CPredictionCopy::TransferData_R( int chaincount, datamap_t *dmap )
 
 static int g_nChainCount = 1;
 
+static ConVar pcompiledcopy( "pcompiledcopy", "1", 0, "Copy prediction data using flattened per-datamap copy plans." );
+
+//-----------------------------------------------------------------------------
+// Purpose: A datamap flattened into byte runs for one copy type and packing.
+//  Walking the datamap field by field is only needed for error reporting,
+//  describing and watching; plain copies can just memcpy the runs, and an
+//  error check whose runs all match can't find any differences.
+//-----------------------------------------------------------------------------
+class CPredictionCopyPlan
+{
+public:
+	CPredictionCopyPlan( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex );
+
+	bool	IsValid() const { return m_bValid; }
+
+	void	Copy( void *dest, void const *src ) const;
+	bool	Matches( void const *dest, void const *src ) const;
+
+private:
+	struct Run_t
+	{
+		int		m_nDestOffset;
+		int		m_nSrcOffset;
+		int		m_nBytes;		// RUN_STRING for a null terminated string
+	};
+
+	enum
+	{
+		RUN_STRING = -1,
+	};
+
+	void	AddMap_R( int chain_count, datamap_t *dmap );
+	void	AddFields_R( int chain_count, typedescription_t *pFields, int fieldCount, int destBase, int srcBase );
+	void	AddRun( int destOffset, int srcOffset, int bytes );
+	void	Coalesce();
+
+	static bool RunLessFunc( const Run_t &lhs, const Run_t &rhs );
+
+	int		m_nType;
+	int		m_nDestOffsetIndex;
+	int		m_nSrcOffsetIndex;
+	bool	m_bValid;
+
+	CUtlVector< Run_t >	m_Runs;
+};
+
+CPredictionCopyPlan::CPredictionCopyPlan( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	m_nType = type;
+	m_nDestOffsetIndex = destOffsetIndex;
+	m_nSrcOffsetIndex = srcOffsetIndex;
+	m_bValid = true;
+
+	// Overridden fields get skipped the same way CopyFields skips them
+	++g_nChainCount;
+	AddMap_R( g_nChainCount, dmap );
+
+	Coalesce();
+}
+
+void CPredictionCopyPlan::AddMap_R( int chain_count, datamap_t *dmap )
+{
+	AddFields_R( chain_count, dmap->dataDesc, dmap->dataNumFields, 0, 0 );
+
+	if ( dmap->baseMap )
+	{
+		AddMap_R( chain_count, dmap->baseMap );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors the field filtering in CPredictionCopy::CopyFields
+//-----------------------------------------------------------------------------
+void CPredictionCopyPlan::AddFields_R( int chain_count, typedescription_t *pFields, int fieldCount, int destBase, int srcBase )
+{
+	for ( int i = 0; i < fieldCount && m_bValid; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		int flags = pField->flags;
+
+		if ( pField->override_field != NULL )
+		{
+			pField->override_field->override_count = chain_count;
+		}
+
+		if ( pField->override_count == chain_count )
+			continue;
+
+		if ( pField->fieldType != FIELD_EMBEDDED )
+		{
+			if ( flags & FTYPEDESC_PRIVATE )
+				continue;
+
+			if ( m_nType == PC_NON_NETWORKED_ONLY && ( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+
+			if ( m_nType == PC_NETWORKED_ONLY && !( flags & FTYPEDESC_INSENDTABLE ) )
+				continue;
+		}
+
+		int destOffset = destBase + pField->fieldOffset[ m_nDestOffsetIndex ];
+		int srcOffset = srcBase + pField->fieldOffset[ m_nSrcOffsetIndex ];
+		int count = pField->fieldSize;
+
+		switch( pField->fieldType )
+		{
+		case FIELD_EMBEDDED:
+			// Embedded pointers differ per object, so those maps need the field walk
+			if ( ( flags & FTYPEDESC_PTR ) && 
+				( (m_nSrcOffsetIndex == PC_DATA_NORMAL) || (m_nDestOffsetIndex == PC_DATA_NORMAL) ) )
+			{
+				m_bValid = false;
+				break;
+			}
+			AddFields_R( chain_count, pField->td->dataDesc, pField->td->dataNumFields, destOffset, srcOffset );
+			break;
+
+		case FIELD_FLOAT:
+			AddRun( destOffset, srcOffset, sizeof( float ) * count );
+			break;
+		case FIELD_STRING:
+			AddRun( destOffset, srcOffset, RUN_STRING );
+			break;
+		case FIELD_VECTOR:
+			AddRun( destOffset, srcOffset, sizeof( Vector ) * count );
+			break;
+		case FIELD_QUATERNION:
+			AddRun( destOffset, srcOffset, sizeof( Quaternion ) * count );
+			break;
+		case FIELD_COLOR32:
+			AddRun( destOffset, srcOffset, 4 * count );
+			break;
+		case FIELD_BOOLEAN:
+			AddRun( destOffset, srcOffset, sizeof( bool ) * count );
+			break;
+		case FIELD_INTEGER:
+			AddRun( destOffset, srcOffset, sizeof( int ) * count );
+			break;
+		case FIELD_SHORT:
+			AddRun( destOffset, srcOffset, sizeof( short ) * count );
+			break;
+		case FIELD_CHARACTER:
+			AddRun( destOffset, srcOffset, count );
+			break;
+		case FIELD_EHANDLE:
+			AddRun( destOffset, srcOffset, sizeof( EHANDLE ) * count );
+			break;
+
+		default:
+			// Everything else is either empty or unsupported by CopyFields too
+			break;
+		}
+	}
+}
+
+void CPredictionCopyPlan::AddRun( int destOffset, int srcOffset, int bytes )
+{
+	if ( bytes == 0 )
+		return;
+
+	int i = m_Runs.AddToTail();
+	m_Runs[i].m_nDestOffset = destOffset;
+	m_Runs[i].m_nSrcOffset = srcOffset;
+	m_Runs[i].m_nBytes = bytes;
+}
+
+bool CPredictionCopyPlan::RunLessFunc( const Run_t &lhs, const Run_t &rhs )
+{
+	return lhs.m_nDestOffset < rhs.m_nDestOffset;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sorts the runs by destination and merges the ones that are
+//  contiguous on both sides, so neighboring fields become a single memcpy
+//-----------------------------------------------------------------------------
+void CPredictionCopyPlan::Coalesce()
+{
+	if ( !m_bValid || m_Runs.Count() == 0 )
+		return;
+
+	// Insertion sort; the runs are mostly in order already
+	int i, j;
+	for ( i = 1; i < m_Runs.Count(); ++i )
+	{
+		Run_t run = m_Runs[i];
+		for ( j = i; j > 0 && RunLessFunc( run, m_Runs[j-1] ); --j )
+		{
+			m_Runs[j] = m_Runs[j-1];
+		}
+		m_Runs[j] = run;
+	}
+
+	int nOut = 0;
+	for ( i = 1; i < m_Runs.Count(); ++i )
+	{
+		Run_t &prev = m_Runs[nOut];
+		const Run_t &run = m_Runs[i];
+
+		// Fields that alias each other can't be reordered safely
+		if ( prev.m_nBytes != RUN_STRING && prev.m_nDestOffset + prev.m_nBytes > run.m_nDestOffset )
+		{
+			m_bValid = false;
+			return;
+		}
+
+		if ( prev.m_nBytes != RUN_STRING && run.m_nBytes != RUN_STRING &&
+			prev.m_nDestOffset + prev.m_nBytes == run.m_nDestOffset &&
+			prev.m_nSrcOffset + prev.m_nBytes == run.m_nSrcOffset )
+		{
+			prev.m_nBytes += run.m_nBytes;
+			continue;
+		}
+
+		m_Runs[++nOut] = run;
+	}
+	m_Runs.RemoveMultiple( nOut + 1, m_Runs.Count() - nOut - 1 );
+}
+
+void CPredictionCopyPlan::Copy( void *dest, void const *src ) const
+{
+	int nCount = m_Runs.Count();
+	for ( int i = 0; i < nCount; ++i )
+	{
+		const Run_t &run = m_Runs[i];
+		char *pOut = (char *)dest + run.m_nDestOffset;
+		const char *pIn = (const char *)src + run.m_nSrcOffset;
+		if ( run.m_nBytes == RUN_STRING )
+		{
+			memcpy( pOut, pIn, Q_strlen( pIn ) + 1 );
+		}
+		else
+		{
+			memcpy( pOut, pIn, run.m_nBytes );
+		}
+	}
+}
+
+bool CPredictionCopyPlan::Matches( void const *dest, void const *src ) const
+{
+	int nCount = m_Runs.Count();
+	for ( int i = 0; i < nCount; ++i )
+	{
+		const Run_t &run = m_Runs[i];
+		const char *pOut = (const char *)dest + run.m_nDestOffset;
+		const char *pIn = (const char *)src + run.m_nSrcOffset;
+		if ( run.m_nBytes == RUN_STRING )
+		{
+			if ( Q_strcmp( pOut, pIn ) )
+				return false;
+		}
+		else if ( memcmp( pOut, pIn, run.m_nBytes ) )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Plans are built the first time a datamap is transferred with a given
+// copy type and packing, and live as long as the (static) datamaps do
+//-----------------------------------------------------------------------------
+struct PredictionCopyPlans_t
+{
+	CPredictionCopyPlan *m_pPlans[ 3 ][ TD_OFFSET_COUNT ][ TD_OFFSET_COUNT ];	// type, dest, src
+};
+
+static CUtlMap< datamap_t *, PredictionCopyPlans_t > g_PredictionCopyPlans( 0, 0, DefLessFunc( datamap_t * ) );
+
+static const CPredictionCopyPlan *GetPredictionCopyPlan( datamap_t *dmap, int type, int destOffsetIndex, int srcOffsetIndex )
+{
+	Assert( type >= PC_EVERYTHING && type <= PC_NETWORKED_ONLY );
+
+	unsigned short i = g_PredictionCopyPlans.Find( dmap );
+	if ( i == g_PredictionCopyPlans.InvalidIndex() )
+	{
+		PredictionCopyPlans_t plans;
+		memset( &plans, 0, sizeof( plans ) );
+		i = g_PredictionCopyPlans.Insert( dmap, plans );
+	}
+
+	CPredictionCopyPlan *&pPlan = g_PredictionCopyPlans[i].m_pPlans[ type ][ destOffsetIndex ][ srcOffsetIndex ];
+	if ( !pPlan )
+	{
+		MEM_ALLOC_CREDIT();
+		pPlan = new CPredictionCopyPlan( dmap, type, destOffsetIndex, srcOffsetIndex );
+		if ( !pPlan->IsValid() )
+		{
+			DevMsg( "Prediction copy of %s can't be flattened, using the field walk\n", dmap->dataClassName );
+		}
+	}
+
+	return pPlan->IsValid() ? pPlan : NULL;
+}
+
 static typedescription_t *FindFieldByName_R( const char *fieldname, datamap_t *dmap )
 {
 	int c = dmap->dataNumFields;
@@ -1389,11 +1686,44 @@ int CPredictionCopy::TransferData( const char *operation, int entindex, datamap_
 	
 	DetermineWatchField( operation, entindex, dmap );
 
+	if ( TransferCompiled( dmap ) )
+		return m_nErrorCount;
+
 	TransferData_R( g_nChainCount, dmap );
 
 	return m_nErrorCount;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Handles plain copies, and error checks that find nothing, without
+//  walking the datamap. Anything that has to look at individual fields
+//  (reporting differences, describing, watching) returns false.
+//-----------------------------------------------------------------------------
+bool CPredictionCopy::TransferCompiled( datamap_t *dmap )
+{
+	if ( !pcompiledcopy.GetBool() )
+		return false;
+
+	if ( m_bDescribeFields || m_FieldCompareFunc || m_pWatchField )
+		return false;
+
+	const CPredictionCopyPlan *pPlan = GetPredictionCopyPlan( dmap, m_nType, m_nDestOffsetIndex, m_nSrcOffsetIndex );
+	if ( !pPlan )
+		return false;
+
+	if ( m_bErrorCheck )
+	{
+		// If every byte matches, no field can differ, and there's nothing to copy either
+		return pPlan->Matches( m_pDest, m_pSrc );
+	}
+
+	if ( m_bPerformCopy )
+	{
+		pPlan->Copy( m_pDest, m_pSrc );
+	}
+	return true;
+}
+
 /*
 //-----------------------------------------------------------------------------
 // Purpose: Simply dumps all data fields in object
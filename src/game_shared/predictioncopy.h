@@ -84,6 +84,9 @@ public:
 private:
 	void	TransferData_R( int chaincount, datamap_t *dmap );
 
+	// Runs the transfer off the datamap's flattened copy plan if nothing needs per-field work
+	bool	TransferCompiled( datamap_t *dmap );
+
 	void	DetermineWatchField( const char *operation, int entindex,  datamap_t *dmap );
 	void	DumpWatchField( typedescription_t *field );
 	void	WatchMsg( const char *fmt, ... );
@@ -47,12 +47,33 @@ void AddRestoredEntity( C_BaseEntity *pEntity );
 #include "tier0/memdbgon.h"
 
 #define MAX_ENTITYARRAY 1024
+// Entity index lookups made by a CSave before it builds its entity -> index map
+#define ENTITYINDEX_MAP_THRESHOLD 16
 #define ZERO_TIME ((FLT_MAX*-0.5))
 // A bit arbitrary, but unlikely to collide with any saved games...
 #define TICK_NEVER_THINK_ENCODE	( INT_MAX - 3 )
 
 ASSERT_INVARIANT( sizeof(EHandlePlaceholder_t) == sizeof(EHANDLE) );
 
+#if !defined( CLIENT_DLL )
+static ConVar save_usefieldplans( "save_usefieldplans", "1", 0, "Write plain-data fields using per-datamap field plans instead of the generic field writer." );
+#endif
+
+#if !defined( CLIENT_DLL )
+static ConVar save_spewtiming( "save_spewtiming", "0", 0, "Report the time spent and bytes written by each save/restore block when saving." );
+#else
+static ConVar save_spewtiming( "cl_save_spewtiming", "0", FCVAR_CLIENTDLL, "Report the time spent and bytes written by each save/restore block when saving." );
+#endif
+
+static inline bool UseSaveFieldPlans()
+{
+#if !defined( CLIENT_DLL )
+	return save_usefieldplans.GetBool();
+#else
+	return true;
+#endif
+}
+
 //-----------------------------------------------------------------------------
 
 static int gSizes[FIELD_TYPECOUNT] = 
@@ -173,7 +194,11 @@ void *UTIL_FunctionFromName( datamap_t *pMap, const char *pName )
 
 CSave::CSave( CSaveRestoreData *pdata )
  :	m_pData(pdata),
-	m_pGameInfo( pdata )
+	m_pGameInfo( pdata ),
+	m_FieldPlanMap( 0, 0, DefLessFunc( typedescription_t * ) ),
+	m_EntityIndexMap( 0, 0, DefLessFunc( const CBaseEntity * ) ),
+	m_nEntityIndexMapSize( -1 ),
+	m_nEntityIndexScans( 0 )
 {
 	m_BlockStartStack.EnsureCapacity( 32 );
 
@@ -778,11 +803,120 @@ int CSave::CountFieldsToSave( const void *pBaseData, typedescription_t *pFields,
 
 //-------------------------------------
 
+int CSave::FindOrBuildFieldPlan( typedescription_t *pFields, int fieldCount )
+{
+	unsigned short iPlan = m_FieldPlanMap.Find( pFields );
+	if ( iPlan != m_FieldPlanMap.InvalidIndex() )
+		return m_FieldPlanMap[ iPlan ];
+
+	int iFirst = m_FieldPlans.AddMultipleToTail( fieldCount );
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pField = &pFields[ i ];
+		SaveFieldPlan_t &plan = m_FieldPlans[ iFirst + i ];
+
+		// Header symbols are created on first write so unsaved fields don't fill the symbol table
+		plan.symbol = -1;
+		plan.nBytes = 0;
+
+		if ( !(pField->flags & FTYPEDESC_SAVE) )
+			continue;
+
+		// These types are written as raw bytes and skipped when all zero (see WriteBasicField and ShouldSaveField)
+		switch ( pField->fieldType )
+		{
+		case FIELD_FLOAT:
+		case FIELD_VECTOR:
+		case FIELD_QUATERNION:
+		case FIELD_INTEGER:
+		case FIELD_BOOLEAN:
+		case FIELD_SHORT:
+		case FIELD_CHARACTER:
+		case FIELD_COLOR32:
+			{
+				// Mis-declared fields take the slow path so ShouldSaveField() still warns about them
+				int nBytes = pField->fieldSize * gSizes[pField->fieldType];
+				if ( pField->fieldSizeInBytes == nBytes && nBytes <= SHRT_MAX )
+					plan.nBytes = nBytes;
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	m_FieldPlanMap.Insert( pFields, iFirst );
+	return iFirst;
+}
+
+//-------------------------------------
+
+int CSave::WriteFieldsUsingPlan( const char *pname, const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields, int fieldCount )
+{
+	int iPlan = FindOrBuildFieldPlan( pFields, fieldCount );
+
+	// Write a placeholder count and patch it once the fields are out, rather than testing every field twice
+	int countPos = GetWritePos() + sizeof(SaveRestoreRecordHeader_t);
+	int actualCount = 0;
+	WriteInt( pname, &actualCount, 1 );
+
+	for ( int i = 0; i < fieldCount; i++ )
+	{
+		typedescription_t *pTest = &pFields[ i ];
+		void *pOutputData = ( (char *)pBaseData + pTest->fieldOffset[ TD_OFFSET_NORMAL ] );
+
+		// Don't hold a reference into m_FieldPlans, WriteField() can add plans for embedded types
+		int nBytes = m_FieldPlans[ iPlan + i ].nBytes;
+		if ( nBytes )
+		{
+			if ( DataEmpty( (const char *)pOutputData, nBytes ) )
+				continue;
+
+#ifdef _DEBUG
+			Log( pname, (fieldtype_t)pTest->fieldType, pOutputData, pTest->fieldSize );
+#endif
+
+			SaveFieldPlan_t &plan = m_FieldPlans[ iPlan + i ];
+			if ( plan.symbol == -1 )
+			{
+				plan.symbol = m_pData->FindCreateSymbol( pTest->fieldName );
+			}
+
+			short header[2] = { plan.nBytes, plan.symbol };
+			BufferData( (const char *)header, sizeof(header) );
+			BufferData( (const char *)pOutputData, nBytes );
+		}
+		else
+		{
+			if ( !ShouldSaveField( pOutputData, pTest ) )
+				continue;
+
+			if ( !WriteField( pname, pOutputData, pRootMap, pTest ) )
+				break;
+		}
+
+		actualCount++;
+	}
+
+	int endPos = GetWritePos();
+	SetWritePos( countPos );
+	BufferData( (const char *)&actualCount, sizeof(int) );
+	SetWritePos( endPos );
+
+	return 1;
+}
+
+//-------------------------------------
+
 int CSave::WriteFields( const char *pname, const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields, int fieldCount )
 {
 	int				i, actualCount;
 	typedescription_t *pTest;
 
+	if ( fieldCount > 0 && UseSaveFieldPlans() )
+		return WriteFieldsUsingPlan( pname, pBaseData, pRootMap, pFields, fieldCount );
+
 	// Empty fields will not be written, write out the actual number of fields to be written
 	actualCount = CountFieldsToSave( pBaseData, pFields, fieldCount );
 	WriteInt( pname, &actualCount, 1 );
@@ -938,17 +1072,55 @@ int	CSave::EntityIndex( const CBaseEntity *pEntity )
 	int i;
 	entitytable_t *pTable;
 
+	// A few lookups aren't worth building the map for (the engine makes a new CSave per call)
+	if ( m_nEntityIndexMapSize != m_pGameInfo->NumEntities() && ++m_nEntityIndexScans > ENTITYINDEX_MAP_THRESHOLD )
+	{
+		BuildEntityIndexMap();
+	}
+
+	if ( m_nEntityIndexMapSize == m_pGameInfo->NumEntities() )
+	{
+		unsigned short iEntity = m_EntityIndexMap.Find( pEntity );
+		if ( iEntity != m_EntityIndexMap.InvalidIndex() )
+		{
+			pTable = m_pGameInfo->GetEntityInfo( m_EntityIndexMap[ iEntity ] );
+			if ( pTable->hEnt == pEntity )
+				return pTable->id;
+		}
+	}
+
 	for ( i = 0; i < m_pGameInfo->NumEntities(); i++ )
 	{
 		pTable = m_pGameInfo->GetEntityInfo( i );
 		if ( pTable->hEnt == pEntity )
+		{
+			// Missed the map (or there isn't one yet), so have it rebuilt
+			m_nEntityIndexMapSize = -1;
 			return pTable->id;
+		}
 	}
 	return -1;
 }
 
 //-------------------------------------
 
+void CSave::BuildEntityIndexMap()
+{
+	m_EntityIndexMap.RemoveAll();
+	m_nEntityIndexMapSize = m_pGameInfo->NumEntities();
+
+	for ( int i = 0; i < m_nEntityIndexMapSize; i++ )
+	{
+		const CBaseEntity *pEntity = m_pGameInfo->GetEntityInfo( i )->hEnt.Get();
+		if ( pEntity && m_EntityIndexMap.Find( pEntity ) == m_EntityIndexMap.InvalidIndex() )
+		{
+			m_EntityIndexMap.Insert( pEntity, i );
+		}
+	}
+}
+
+//-------------------------------------
+
 int	CSave::EntityFlagsSet( int entityIndex, int flags )
 {
 	if ( !m_pGameInfo || entityIndex < 0 )
@@ -3038,10 +3210,15 @@ public:
 	void PreSave( CSaveRestoreData *pData )
 	{
 		m_BlockHeaders.SetCount( m_Handlers.Count() );
+		m_BlockTimings.SetCount( m_Handlers.Count() );
+		memset( m_BlockTimings.Base(), 0, m_BlockTimings.Count() * sizeof(SaveBlockTiming_t) );
 		for ( int i = 0; i < m_Handlers.Count(); i++ )
 		{
 			Q_strncpy( m_BlockHeaders[i].szName, m_Handlers[i]->GetBlockName(), MAX_BLOCK_NAME_LEN + 1 );
+
+			double flStart = Plat_FloatTime();
 			m_Handlers[i]->PreSave( pData );
+			m_BlockTimings[i].flPreSave = Plat_FloatTime() - flStart;
 		}
 	}
 	
@@ -3051,7 +3228,14 @@ public:
 		for ( int i = 0; i < m_Handlers.Count(); i++ )
 		{
 			m_BlockHeaders[i].locBody = pSave->GetWritePos() - base;
+
+			double flStart = Plat_FloatTime();
 			m_Handlers[i]->Save( pSave );
+			if ( i < m_BlockTimings.Count() )
+			{
+				m_BlockTimings[i].flSave = Plat_FloatTime() - flStart;
+				m_BlockTimings[i].nBodyBytes = pSave->GetWritePos() - base - m_BlockHeaders[i].locBody;
+			}
 		}
 		m_SizeBodies = pSave->GetWritePos() - base;
 	}
@@ -3079,7 +3263,14 @@ public:
 		for ( int i = 0; i < m_Handlers.Count(); i++ )
 		{
 			m_BlockHeaders[i].locHeader = pSave->GetWritePos() - base;
+
+			double flStart = Plat_FloatTime();
 			m_Handlers[i]->WriteSaveHeaders( pSave );
+			if ( i < m_BlockTimings.Count() )
+			{
+				m_BlockTimings[i].flHeaders = Plat_FloatTime() - flStart;
+				m_BlockTimings[i].nHeaderBytes = pSave->GetWritePos() - base - m_BlockHeaders[i].locHeader;
+			}
 		}
 
 		m_SizeHeaders = pSave->GetWritePos() - base;
@@ -3103,7 +3294,14 @@ public:
 		{
 			m_Handlers[i]->PostSave();
 		}
+
+		if ( save_spewtiming.GetBool() )
+		{
+			SpewSaveTimings();
+		}
+
 		m_BlockHeaders.Purge();
+		m_BlockTimings.Purge();
 	}
 	
 	//---------------------------------
@@ -3186,6 +3384,37 @@ public:
 	//---------------------------------
 
 private:
+	struct SaveBlockTiming_t
+	{
+		double	flPreSave;		// Entity OnSave() and table building
+		double	flSave;			// Writing the block body
+		double	flHeaders;		// Writing the block header
+		int		nBodyBytes;
+		int		nHeaderBytes;
+	};
+
+	void SpewSaveTimings()
+	{
+		double flPreSave = 0, flSave = 0, flHeaders = 0;
+		int nBytes = 0;
+
+		Msg( "Save timings for block set \"%s\":\n", m_Name );
+		for ( int i = 0; i < m_BlockTimings.Count() && i < m_Handlers.Count(); i++ )
+		{
+			const SaveBlockTiming_t &timing = m_BlockTimings[i];
+			Msg( "  %-24s presave %7.2fms  save %7.2fms  headers %7.2fms  %8d bytes\n", 
+				m_Handlers[i]->GetBlockName(), timing.flPreSave * 1000.0, timing.flSave * 1000.0, timing.flHeaders * 1000.0,
+				timing.nBodyBytes + timing.nHeaderBytes );
+
+			flPreSave += timing.flPreSave;
+			flSave += timing.flSave;
+			flHeaders += timing.flHeaders;
+			nBytes += timing.nBodyBytes + timing.nHeaderBytes;
+		}
+		Msg( "  %-24s presave %7.2fms  save %7.2fms  headers %7.2fms  %8d bytes\n", 
+			"Total", flPreSave * 1000.0, flSave * 1000.0, flHeaders * 1000.0, nBytes );
+	}
+
 	int GetBlockBodyLoc( const char *pszName )
 	{
 		for ( int i = 0; i < m_BlockHeaders.Count(); i++ )
@@ -3212,6 +3441,7 @@ private:
 	int									   m_SizeHeaders;
 	int									   m_SizeBodies;
 	CUtlVector<SaveRestoreBlockHeader_t>   m_BlockHeaders;
+	CUtlVector<SaveBlockTiming_t>		   m_BlockTimings;
 };
 
 //-------------------------------------
@@ -12,6 +12,7 @@
 
 #include "isaverestore.h"
 #include "utlvector.h"
+#include "utlmap.h"
 #include "filesystem.h"
 
 #ifdef _WIN32
@@ -157,12 +158,26 @@ private:
 	int				CountFieldsToSave( const void *pBaseData, typedescription_t *pFields, int fieldCount );
 	bool			ShouldSaveField( const void *pData, typedescription_t *pField );
 
+	//---------------------------------
+	// Field plans: per-typedescription information computed once per save
+	//
+	
+	struct SaveFieldPlan_t
+	{
+		short			symbol;		// Header symbol, -1 until the field is first written
+		short			nBytes;		// Size of a plain-data field, 0 if it must go through WriteField()
+	};
+
+	int				FindOrBuildFieldPlan( typedescription_t *pFields, int fieldCount );
+	int				WriteFieldsUsingPlan( const char *pname, const void *pBaseData, datamap_t *pRootMap, typedescription_t *pFields, int fieldCount );
+
 	//---------------------------------
 	// Game info methods
 	//
 	
 	bool			WriteGameField( const char *pname, void *pData, datamap_t *pRootMap, typedescription_t *pField );
 	int				EntityIndex( const edict_t *pentLookup );
+	void			BuildEntityIndexMap();
 	
 	//---------------------------------
 	
@@ -175,6 +190,15 @@ private:
 	CGameSaveRestoreInfo *m_pGameInfo;
 
 	FileHandle_t		m_hLogFile;
+
+	// Field plans, indexed by the typedescription array they were built from
+	CUtlMap<typedescription_t *, int> m_FieldPlanMap;
+	CUtlVector<SaveFieldPlan_t> m_FieldPlans;
+
+	// Entity -> table index, built once enough lookups have been made
+	CUtlMap<const CBaseEntity *, int> m_EntityIndexMap;
+	int				m_nEntityIndexMapSize;		// NumEntities() the map was built for, -1 if not built
+	int				m_nEntityIndexScans;
 };
 
 //-----------------------------------------------------------------------------
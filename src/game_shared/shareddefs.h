@@ -687,6 +687,17 @@ struct EmitSound_t
 	mutable HSOUNDSCRIPTHANDLE		m_hSoundScriptHandle;
 };
 
+//-----------------------------------------------------------------------------
+// Purpose: Emits a sound script entry from a call site that always uses the same
+//			name, keeping the script handle so later emits skip the name lookup
+//-----------------------------------------------------------------------------
+#define EMIT_SOUND_CACHED( pEntity, soundname, soundtime )										\
+	do																							\
+	{																							\
+		static HSOUNDSCRIPTHANDLE s_hSoundScript = (HSOUNDSCRIPTHANDLE)-1;						\
+		(pEntity)->EmitSound( soundname, s_hSoundScript, soundtime );							\
+	} while ( 0 )
+
 #define MAX_ACTORS_IN_SCENE 16
 
 #endif // SHAREDDEFS_H
@@ -468,13 +468,22 @@ public:
 		// Pull data from parameters
 		CSoundParameters params;
 
-		// Try to deduce the actor's gender
+		if ( handle == SOUNDEMITTER_INVALID_HANDLE )
+		{
+			handle = (HSOUNDSCRIPTHANDLE)soundemitterbase->GetSoundIndex( ep.m_pSoundName );
+		}
+
+		// Try to deduce the actor's gender, only sounds using $gender care about it
 		gender_t gender = GENDER_NONE;
-		CBaseEntity *ent = CBaseEntity::Instance( entindex );
-		if ( ent )
+		CSoundParametersInternal *pInternal = ( handle != SOUNDEMITTER_INVALID_HANDLE ) ? soundemitterbase->InternalGetParametersForSound( handle ) : NULL;
+		if ( !pInternal || pInternal->UsesGenderToken() )
 		{
-			char const *actorModel = STRING( ent->GetModelName() );
-			gender = soundemitterbase->GetActorGender( actorModel );
+			CBaseEntity *ent = CBaseEntity::Instance( entindex );
+			if ( ent )
+			{
+				char const *actorModel = STRING( ent->GetModelName() );
+				gender = soundemitterbase->GetActorGender( actorModel );
+			}
 		}
 
 		if ( !soundemitterbase->GetParametersForSoundEx( ep.m_pSoundName, handle, params, gender, true ) )
@@ -567,6 +576,14 @@ public:
 	void EmitSound( IRecipientFilter& filter, int entindex, const EmitSound_t & ep )
 	{
 		VPROF( "CSoundEmitterSystem::EmitSound (calls engine)" );
+
+		// A resolved script handle can't be a raw wave, skip the name checks
+		if ( ep.m_hSoundScriptHandle != SOUNDEMITTER_INVALID_HANDLE )
+		{
+			EmitSoundByHandle( filter, entindex, ep, ep.m_hSoundScriptHandle );
+			return;
+		}
+
 		if ( ep.m_pSoundName && 
 			( Q_stristr( ep.m_pSoundName, ".wav" ) || 
 			  Q_stristr( ep.m_pSoundName, ".mp3" ) || 
@@ -1123,13 +1140,16 @@ void CBaseEntity::EmitSound( const char *soundname, float soundtime /*= 0.0f*/,
 	//VPROF( "CBaseEntity::EmitSound" );
 	VPROF_BUDGET( "CBaseEntity::EmitSound", _T( "CBaseEntity::EmitSound" ) );
 
-	CPASAttenuationFilter filter( this, soundname );
+	// Look the script entry up once for both the filter's soundlevel and the emit
+	HSOUNDSCRIPTHANDLE handle = SOUNDEMITTER_INVALID_HANDLE;
+	CPASAttenuationFilter filter( this, soundname, handle );
 
 	EmitSound_t params;
 	params.m_pSoundName = soundname;
 	params.m_flSoundTime = soundtime;
 	params.m_pflSoundDuration = duration;
 	params.m_bWarnOnDirectWaveReference = true;
+	params.m_hSoundScriptHandle = handle;
 
 	EmitSound( filter, entindex(), params );
 }
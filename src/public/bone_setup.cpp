@@ -16,8 +16,10 @@
 #include "tier0/vprof.h"
 #include "bone_accessor.h"
 #include "bitvec.h"
-#include "datamanager.h"
+#include "utlvector.h"
 #include "convar.h"
+#include "tier0/threadtools.h"
+#include <xmmintrin.h>
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -67,6 +69,8 @@ CBoneCache::CBoneCache()
 {
 	m_size = 0;
 	m_cachedBoneCount = 0;
+	m_pNextRetired = NULL;
+	m_nRetiredEpoch = 0;
 }
 
 void CBoneCache::Init( const bonecacheparams_t &params, unsigned int size, short *pStudioToCached, short *pCachedToStudio, int cachedBoneCount ) 
@@ -156,33 +160,365 @@ short *CBoneCache::CachedToStudio()
 	return (short *)( (char *)(this+1) + m_cachedToStudioOffset );
 }
 
+//-----------------------------------------------------------------------------
+// Bone cache manager. A handle is a slot index in the low word and the slot's
+// serial number in the high word. A lookup just checks the serial, so it
+// doesn't take a lock. Freed slots go back on a lock-free stack.
+//
+// When the caches go over budget, a clock sweep evicts ones that haven't been
+// read since the hand last passed them. An evicted (or destroyed) cache is
+// retired rather than freed. It's only freed once the frame epoch has moved on
+// twice, so a thread still holding a pointer from a lookup in the previous
+// frame never reads freed memory.
+//-----------------------------------------------------------------------------
+#define MAX_BONE_CACHES			4096
+#define BONE_CACHE_TARGET_SIZE	(16 * 1024L)
+#define BONE_CACHE_NO_SLOT		0xFFFF
+
+class CBoneCacheManager
+{
+public:
+	CBoneCacheManager()
+	{
+		for ( int i = 0; i < MAX_BONE_CACHES; i++ )
+		{
+			m_Slots[i].m_pCache = NULL;
+			m_Slots[i].m_nSerial = 1;
+			m_Slots[i].m_bReferenced = 0;
+			m_Slots[i].m_nNextFree = ( i + 1 < MAX_BONE_CACHES ) ? i + 1 : BONE_CACHE_NO_SLOT;
+		}
+		m_nFreeHead = 0;
+		m_nClockHand = 0;
+		m_nHighWater = 0;
+		m_nUsedSize = 0;
+		m_nEpoch = 0;
+		m_bEpochsStarted = false;
+		m_pRetired = NULL;
+		ResetStats();
+	}
+
+	~CBoneCacheManager()
+	{
+		for ( int i = 0; i < MAX_BONE_CACHES; i++ )
+		{
+			if ( m_Slots[i].m_pCache )
+			{
+				m_Slots[i].m_pCache->DestroyResource();
+			}
+		}
+		ReclaimRetired( true );
+	}
+
+	CBoneCache *Get( memhandle_t hCache )
+	{
+		int nSlot, nSerial;
+		if ( !FromHandle( hCache, nSlot, nSerial ) )
+			return NULL;
+
+		BoneCacheSlot_t &slot = m_Slots[nSlot];
+		CBoneCache *pCache = slot.m_pCache;
+
+		// Re-check the serial after reading the pointer, in case the slot was
+		// evicted and reused in between
+		if ( !pCache || slot.m_nSerial != nSerial )
+		{
+			ThreadInterlockedIncrement( &m_nMisses );
+			return NULL;
+		}
+
+		slot.m_bReferenced = 1;
+		ThreadInterlockedIncrement( &m_nHits );
+		return pCache;
+	}
+
+	memhandle_t Create( const bonecacheparams_t &params )
+	{
+		long nEstimatedSize = CBoneCache::EstimatedSize( params );
+		if ( m_nUsedSize + nEstimatedSize > BONE_CACHE_TARGET_SIZE )
+		{
+			Evict( nEstimatedSize, false );
+		}
+
+		int nSlot = PopFreeSlot();
+		if ( nSlot == BONE_CACHE_NO_SLOT )
+		{
+			// Every slot is in use; take one that hasn't been read lately
+			Evict( 0, true );
+			nSlot = PopFreeSlot();
+			if ( nSlot == BONE_CACHE_NO_SLOT )
+				return 0;
+		}
+
+		// Keep the clock sweep to the part of the table that has ever been used
+		for ( ;; )
+		{
+			long nHighWater = m_nHighWater;
+			if ( nSlot < nHighWater || ThreadInterlockedCompareExchange( &m_nHighWater, nSlot + 1, nHighWater ) == nHighWater )
+				break;
+		}
+
+		CBoneCache *pCache = CBoneCache::CreateResource( params );
+		ThreadInterlockedExchangeAdd( &m_nUsedSize, pCache->Size() );
+		ThreadInterlockedIncrement( &m_nCreates );
+
+		BoneCacheSlot_t &slot = m_Slots[nSlot];
+		slot.m_bReferenced = 1;
+		ThreadInterlockedExchangePointer( (void * volatile *)&slot.m_pCache, pCache );
+		return ToHandle( nSlot, slot.m_nSerial );
+	}
+
+	void Destroy( memhandle_t hCache )
+	{
+		int nSlot, nSerial;
+		if ( !FromHandle( hCache, nSlot, nSerial ) )
+			return;
+
+		if ( m_Slots[nSlot].m_nSerial != nSerial )
+			return;
+
+		FreeSlot( nSlot, m_Slots[nSlot].m_pCache );
+	}
+
+	// Called once a frame, when no bone setup is in flight
+	void NewFrame()
+	{
+		m_bEpochsStarted = true;
+		++m_nEpoch;
+		ReclaimRetired( false );
+	}
+
+	void ReportStats()
+	{
+		int nInUse = 0;
+		for ( int i = 0; i < MAX_BONE_CACHES; i++ )
+		{
+			if ( m_Slots[i].m_pCache )
+			{
+				++nInUse;
+			}
+		}
+
+		Msg( "Bone caches: %d in use, %d of %d bytes\n", nInUse, m_nUsedSize, BONE_CACHE_TARGET_SIZE );
+		Msg( "  %d hits, %d misses, %d created, %d evicted\n", m_nHits, m_nMisses, m_nCreates, m_nEvictions );
+	}
+
+	void ResetStats()
+	{
+		m_nHits = 0;
+		m_nMisses = 0;
+		m_nCreates = 0;
+		m_nEvictions = 0;
+	}
+
+private:
+	struct BoneCacheSlot_t
+	{
+		CBoneCache * volatile	m_pCache;
+		volatile long			m_nSerial;
+		volatile long			m_bReferenced;	// Second chance for the clock sweep
+		volatile long			m_nNextFree;
+	};
+
+	static memhandle_t ToHandle( int nSlot, int nSerial )
+	{
+		return (memhandle_t)(uintp)( ( (unsigned int)nSerial << 16 ) | (unsigned int)nSlot );
+	}
+
+	static bool FromHandle( memhandle_t hCache, int &nSlot, int &nSerial )
+	{
+		unsigned int nHandle = (unsigned int)(uintp)hCache;
+		nSlot = nHandle & 0xFFFF;
+		nSerial = nHandle >> 16;
+		return ( nSerial != 0 && nSlot < MAX_BONE_CACHES );
+	}
+
+	// The free list head carries a tag in the high word so a pop can't be fooled by
+	// the same slot being popped and pushed back in between (ABA)
+	int PopFreeSlot()
+	{
+		for ( ;; )
+		{
+			long nHead = m_nFreeHead;
+			int nSlot = nHead & 0xFFFF;
+			if ( nSlot == BONE_CACHE_NO_SLOT )
+				return BONE_CACHE_NO_SLOT;
+
+			long nNewHead = ( ( nHead + 0x10000 ) & 0xFFFF0000 ) | m_Slots[nSlot].m_nNextFree;
+			if ( ThreadInterlockedCompareExchange( &m_nFreeHead, nNewHead, nHead ) == nHead )
+				return nSlot;
+		}
+	}
+
+	void PushFreeSlot( int nSlot )
+	{
+		for ( ;; )
+		{
+			long nHead = m_nFreeHead;
+			m_Slots[nSlot].m_nNextFree = nHead & 0xFFFF;
+
+			long nNewHead = ( ( nHead + 0x10000 ) & 0xFFFF0000 ) | nSlot;
+			if ( ThreadInterlockedCompareExchange( &m_nFreeHead, nNewHead, nHead ) == nHead )
+				return;
+		}
+	}
+
+	// Whoever swaps the pointer out owns the cache and releases the slot
+	bool FreeSlot( int nSlot, CBoneCache *pCache )
+	{
+		BoneCacheSlot_t &slot = m_Slots[nSlot];
+		if ( !pCache || ThreadInterlockedCompareExchangePointer( (void * volatile *)&slot.m_pCache, NULL, pCache ) != pCache )
+			return false;
+
+		// Serial 0 is never valid, so a zeroed handle never matches
+		long nSerial = ( slot.m_nSerial + 1 ) & 0xFFFF;
+		if ( nSerial == 0 )
+		{
+			nSerial = 1;
+		}
+		slot.m_nSerial = nSerial;
+
+		ThreadInterlockedExchangeAdd( &m_nUsedSize, -(long)pCache->Size() );
+		Retire( pCache );
+		PushFreeSlot( nSlot );
+		return true;
+	}
+
+	// Evicts until nBytesNeeded fits in the budget, or until one slot is freed
+	void Evict( long nBytesNeeded, bool bNeedSlot )
+	{
+		long nSlotCount = max( m_nHighWater, 1L );
+
+		// Two full turns of the clock clears every referenced bit at least once
+		for ( int nVisited = 0; nVisited < 2 * nSlotCount; nVisited++ )
+		{
+			if ( !bNeedSlot && m_nUsedSize + nBytesNeeded <= BONE_CACHE_TARGET_SIZE )
+				break;
+
+			int nSlot = ( ThreadInterlockedIncrement( &m_nClockHand ) & 0x7FFFFFFF ) % nSlotCount;
+			BoneCacheSlot_t &slot = m_Slots[nSlot];
+			CBoneCache *pCache = slot.m_pCache;
+			if ( !pCache )
+				continue;
+
+			if ( slot.m_bReferenced )
+			{
+				slot.m_bReferenced = 0;
+				continue;
+			}
+
+			if ( FreeSlot( nSlot, pCache ) )
+			{
+				ThreadInterlockedIncrement( &m_nEvictions );
+				if ( bNeedSlot )
+					break;
+			}
+		}
+	}
+
+	void Retire( CBoneCache *pCache )
+	{
+		// Tools that never tick frames are single threaded; free right away
+		if ( !m_bEpochsStarted )
+		{
+			pCache->DestroyResource();
+			return;
+		}
+
+		pCache->m_nRetiredEpoch = m_nEpoch;
+		PushRetired( pCache );
+	}
+
+	void PushRetired( CBoneCache *pCache )
+	{
+		for ( ;; )
+		{
+			CBoneCache *pHead = m_pRetired;
+			pCache->m_pNextRetired = pHead;
+			if ( ThreadInterlockedCompareExchangePointer( (void * volatile *)&m_pRetired, pCache, pHead ) == pHead )
+				return;
+		}
+	}
+
+	void ReclaimRetired( bool bAll )
+	{
+		CBoneCache *pList = (CBoneCache *)ThreadInterlockedExchangePointer( (void * volatile *)&m_pRetired, NULL );
+		while ( pList )
+		{
+			CBoneCache *pNext = pList->m_pNextRetired;
+			if ( bAll || m_nEpoch - pList->m_nRetiredEpoch >= 2 )
+			{
+				pList->DestroyResource();
+			}
+			else
+			{
+				PushRetired( pList );
+			}
+			pList = pNext;
+		}
+	}
+
+	BoneCacheSlot_t			m_Slots[MAX_BONE_CACHES];
+	volatile long			m_nFreeHead;
+	volatile long			m_nClockHand;
+	volatile long			m_nHighWater;		// One past the highest slot ever handed out
+	volatile long			m_nUsedSize;
+	long					m_nEpoch;
+	bool					m_bEpochsStarted;
+	CBoneCache * volatile	m_pRetired;
+
+	// Stats
+	volatile long			m_nHits;
+	volatile long			m_nMisses;
+	volatile long			m_nCreates;
+	volatile long			m_nEvictions;
+};
+
 // Construct a singleton
-static CDataManager<CBoneCache, bonecacheparams_t> g_StudioBoneCache( 16 * 1024L );
+static CBoneCacheManager g_StudioBoneCache;
 
 CBoneCache *Studio_GetBoneCache( memhandle_t cacheHandle )
 {
-	return g_StudioBoneCache.GetResource_NoLock( cacheHandle );
+	return g_StudioBoneCache.Get( cacheHandle );
 }
 
 memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params )
 {
-	return g_StudioBoneCache.CreateResource( params );
+	return g_StudioBoneCache.Create( params );
 }
 
 void Studio_DestroyBoneCache( memhandle_t cacheHandle )
 {
-	g_StudioBoneCache.DestroyResource( cacheHandle );
+	g_StudioBoneCache.Destroy( cacheHandle );
 }
 
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle )
 {
-	CBoneCache *pCache = g_StudioBoneCache.GetResource_NoLock( cacheHandle );
+	CBoneCache *pCache = g_StudioBoneCache.Get( cacheHandle );
 	if ( pCache )
 	{
 		pCache->m_timeValid = -1.0f;
 	}
 }
 
+void Studio_BoneCacheNewFrame()
+{
+	g_StudioBoneCache.NewFrame();
+}
+
+#if defined( CLIENT_DLL ) || defined( GAME_DLL )
+static void ReportBoneCacheStats()
+{
+	g_StudioBoneCache.ReportStats();
+	g_StudioBoneCache.ResetStats();
+}
+
+#ifdef CLIENT_DLL
+static ConCommand cl_bonecache_stats( "cl_bonecache_stats", ReportBoneCacheStats, "Report bone cache hits, misses and evictions since the last report" );
+#else
+static ConCommand sv_bonecache_stats( "sv_bonecache_stats", ReportBoneCacheStats, "Report bone cache hits, misses and evictions since the last report" );
+#endif
+#endif // CLIENT_DLL || GAME_DLL
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -202,6 +538,265 @@ void BuildBoneChain(
 
 
 
+//-----------------------------------------------------------------------------
+// Seek tables for long compressed animation tracks.
+//
+// A track is a list of runs. Each run header says how many frames the run
+// covers (total) and how many values it stores (valid), so finding frame k
+// means walking the headers from the start of the track, and late frames of
+// long sequences cost more than early ones. Once a lookup has walked
+// ANIM_SEEK_MIN_RUNS runs, we keep a table of the run holding every
+// ANIM_SEEK_STRIDE'th frame, so later lookups walk at most ANIM_SEEK_STRIDE
+// runs. Tables are keyed by track pointer, which is unique per model,
+// animation, bone and channel, and are extended as later frames are asked for.
+//
+// Anim blocks can be unloaded and their memory reused, so every seek point
+// remembers the run header it found and is dropped if that no longer matches.
+//-----------------------------------------------------------------------------
+#define ANIM_SEEK_STRIDE		8
+#define ANIM_SEEK_MIN_RUNS		8
+#define ANIM_SEEK_TABLE_SIZE	2048
+
+// hlmv and studiomdl also build this file; they have no console and use the defaults
+#if defined( CLIENT_DLL ) || defined( GAME_DLL )
+static ConVar anim_seekcache( "anim_seekcache", "1", 0, "Keep seek tables for long compressed animation tracks" );
+static ConVar anim_seekcache_budget( "anim_seekcache_budget", "256", 0, "Memory budget for animation seek tables, in KB" );
+
+static inline bool UseAnimSeekCache()		{ return anim_seekcache.GetBool(); }
+static inline int AnimSeekCacheBudget()		{ return anim_seekcache_budget.GetInt() * 1024; }
+#else
+static inline bool UseAnimSeekCache()		{ return true; }
+static inline int AnimSeekCacheBudget()		{ return 256 * 1024; }		// anim_seekcache_budget's default
+#endif
+
+struct AnimSeekPoint_t
+{
+	int		m_nOffset;			// Index of the run header from the start of the track
+	int		m_nStartFrame;		// First frame the run covers
+	short	m_nHeader;			// The run header when the point was made
+};
+
+class CAnimSeekCache
+{
+public:
+	CAnimSeekCache()
+	{
+		for ( int i = 0; i < ANIM_SEEK_TABLE_SIZE; i++ )
+		{
+			m_Entries[i].m_pTrack = NULL;
+			m_Entries[i].m_bReferenced = false;
+			m_Entries[i].m_bEnded = false;
+		}
+		m_nClockHand = 0;
+		m_nUsedBytes = 0;
+		ResetStats();
+	}
+
+	// Moves panimvalue/k to a run at most ANIM_SEEK_STRIDE runs before the one
+	// holding frame. Leaves them alone and returns false if it can't help.
+	bool Seek( mstudioanimvalue_t *pTrack, int frame, mstudioanimvalue_t *&panimvalue, int &k )
+	{
+		if ( !UseAnimSeekCache() )
+			return false;
+
+		// Another thread is using the table; just walk the track
+		if ( !m_Mutex.TryLock() )
+			return false;
+
+		bool bFound = false;
+		Entry_t &entry = m_Entries[ HashTrack( pTrack ) ];
+		if ( entry.m_pTrack != pTrack || entry.m_nFirstHeader != pTrack->value )
+		{
+			if ( entry.m_pTrack )
+			{
+				++m_nEvictions;
+			}
+			FreeEntry( entry );
+			entry.m_pTrack = pTrack;
+			entry.m_nFirstHeader = pTrack->value;
+			++m_nBuilds;
+		}
+
+		entry.m_bReferenced = true;
+
+		int iPoint = frame / ANIM_SEEK_STRIDE;
+		if ( iPoint >= entry.m_Points.Count() )
+		{
+			Extend( entry, iPoint );
+		}
+
+		if ( iPoint < entry.m_Points.Count() )
+		{
+			const AnimSeekPoint_t &point = entry.m_Points[iPoint];
+			mstudioanimvalue_t *pRun = pTrack + point.m_nOffset;
+			if ( pRun->value == point.m_nHeader )
+			{
+				panimvalue = pRun;
+				k = frame - point.m_nStartFrame;
+				++m_nHits;
+				bFound = true;
+			}
+			else
+			{
+				// The anim data under this pointer changed
+				++m_nInvalidations;
+				FreeEntry( entry );
+			}
+		}
+
+		m_Mutex.Unlock();
+		return bFound;
+	}
+
+	void ReportStats()
+	{
+		int nTracks = 0;
+		for ( int i = 0; i < ANIM_SEEK_TABLE_SIZE; i++ )
+		{
+			if ( m_Entries[i].m_pTrack )
+			{
+				++nTracks;
+			}
+		}
+
+		Msg( "Animation seek tables: %d tracks, %d of %d bytes\n", nTracks, m_nUsedBytes, AnimSeekCacheBudget() );
+		Msg( "  %d seeks, %d tables built, %d evicted, %d invalidated\n", m_nHits, m_nBuilds, m_nEvictions, m_nInvalidations );
+	}
+
+	void ResetStats()
+	{
+		m_nHits = 0;
+		m_nBuilds = 0;
+		m_nEvictions = 0;
+		m_nInvalidations = 0;
+	}
+
+private:
+	struct Entry_t
+	{
+		mstudioanimvalue_t			*m_pTrack;
+		short						m_nFirstHeader;
+		bool						m_bReferenced;
+		bool						m_bEnded;		// Walked off the end of the track
+		CUtlVector<AnimSeekPoint_t>	m_Points;		// m_Points[i] is the run holding frame i * ANIM_SEEK_STRIDE
+	};
+
+	static int HashTrack( const mstudioanimvalue_t *pTrack )
+	{
+		unsigned int n = (unsigned int)(size_t)pTrack;
+		n = ( n >> 1 ) ^ ( n >> 12 );
+		return n & ( ANIM_SEEK_TABLE_SIZE - 1 );
+	}
+
+	// Adds seek points up to and including iPoint, starting from the last one
+	void Extend( Entry_t &entry, int iPoint )
+	{
+		if ( entry.m_bEnded )
+			return;
+
+		int nOffset = 0;
+		int nStartFrame = 0;
+		int nPoints = entry.m_Points.Count();
+		if ( nPoints > 0 )
+		{
+			nOffset = entry.m_Points[nPoints - 1].m_nOffset;
+			nStartFrame = entry.m_Points[nPoints - 1].m_nStartFrame;
+		}
+
+		// Never keep a table that wouldn't fit in the budget on its own
+		int nBudget = AnimSeekCacheBudget();
+		if ( ( iPoint + 1 ) * (int)sizeof( AnimSeekPoint_t ) > nBudget )
+			return;
+
+		int nNewBytes = ( iPoint + 1 - nPoints ) * sizeof( AnimSeekPoint_t );
+		MakeRoom( nNewBytes, &entry );
+		if ( m_nUsedBytes + nNewBytes > nBudget )
+			return;
+
+		mstudioanimvalue_t *pTrack = entry.m_pTrack;
+		for ( int i = nPoints; i <= iPoint; i++ )
+		{
+			int nFrame = i * ANIM_SEEK_STRIDE;
+			while ( nStartFrame + pTrack[nOffset].num.total <= nFrame )
+			{
+				nStartFrame += pTrack[nOffset].num.total;
+				nOffset += pTrack[nOffset].num.valid + 1;
+				if ( pTrack[nOffset].num.total == 0 )
+				{
+					entry.m_bEnded = true;
+					return;
+				}
+			}
+
+			AnimSeekPoint_t &point = entry.m_Points[ entry.m_Points.AddToTail() ];
+			point.m_nOffset = nOffset;
+			point.m_nStartFrame = nStartFrame;
+			point.m_nHeader = pTrack[nOffset].value;
+			m_nUsedBytes += sizeof( AnimSeekPoint_t );
+		}
+	}
+
+	// Clock sweep over the table, dropping tables that haven't been used since
+	// the hand last passed them, until nBytes more fit in the budget
+	void MakeRoom( int nBytes, const Entry_t *pKeep )
+	{
+		int nBudget = AnimSeekCacheBudget();
+		for ( int nVisited = 0; m_nUsedBytes + nBytes > nBudget && nVisited < 2 * ANIM_SEEK_TABLE_SIZE; nVisited++ )
+		{
+			Entry_t &entry = m_Entries[m_nClockHand];
+			m_nClockHand = ( m_nClockHand + 1 ) & ( ANIM_SEEK_TABLE_SIZE - 1 );
+
+			if ( !entry.m_pTrack || &entry == pKeep )
+				continue;
+
+			if ( entry.m_bReferenced )
+			{
+				entry.m_bReferenced = false;
+				continue;
+			}
+
+			FreeEntry( entry );
+			++m_nEvictions;
+		}
+	}
+
+	void FreeEntry( Entry_t &entry )
+	{
+		m_nUsedBytes -= entry.m_Points.Count() * sizeof( AnimSeekPoint_t );
+		entry.m_Points.Purge();
+		entry.m_pTrack = NULL;
+		entry.m_bReferenced = false;
+		entry.m_bEnded = false;
+	}
+
+	Entry_t				m_Entries[ANIM_SEEK_TABLE_SIZE];
+	CThreadFastMutex	m_Mutex;
+	int					m_nClockHand;
+	int					m_nUsedBytes;
+
+	// Stats
+	int					m_nHits;
+	int					m_nBuilds;
+	int					m_nEvictions;
+	int					m_nInvalidations;
+};
+
+static CAnimSeekCache g_AnimSeekCache;
+
+#if defined( CLIENT_DLL ) || defined( GAME_DLL )
+static void ReportAnimSeekStats()
+{
+	g_AnimSeekCache.ReportStats();
+	g_AnimSeekCache.ResetStats();
+}
+
+#ifdef CLIENT_DLL
+static ConCommand cl_animseek_stats( "cl_animseek_stats", ReportAnimSeekStats, "Report animation seek table use since the last report" );
+#else
+static ConCommand sv_animseek_stats( "sv_animseek_stats", ReportAnimSeekStats, "Report animation seek table use since the last report" );
+#endif
+#endif // CLIENT_DLL || GAME_DLL
+
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
@@ -218,10 +813,16 @@ void ExtractAnimValue( int frame,
 		return;
 	}
 
+	mstudioanimvalue_t *pTrack = panimvalue;
 	int k = frame;
+	int nRuns = 0;
 
 	while (panimvalue->num.total <= k)
 	{
+		// Long track; jump to a run near the frame instead of walking from the start
+		if ( nRuns++ == ANIM_SEEK_MIN_RUNS && g_AnimSeekCache.Seek( pTrack, frame, panimvalue, k ) )
+			continue;
+
 		k -= panimvalue->num.total;
 		panimvalue += panimvalue->num.valid + 1;
 		if ( panimvalue->num.total == 0 )
@@ -679,6 +1280,217 @@ void QuaternionAccumulate( const Quaternion &p, float s, const Quaternion &q, Qu
 }
 
 
+// hlmv and studiomdl also build this file; they have no console and use the defaults
+#if defined( CLIENT_DLL ) || defined( GAME_DLL )
+static ConVar anim_batchblend( "anim_batchblend", "1", 0, "Blend bone quaternions four at a time with SSE" );
+static ConVar anim_batchblend_verify( "anim_batchblend_verify", "0", 0, "Check batched bone blends against the scalar blend and report bones that differ" );
+
+static inline bool UseBatchBlend()		{ return anim_batchblend.GetBool(); }
+static inline bool VerifyBatchBlend()	{ return anim_batchblend_verify.GetBool(); }
+#else
+static inline bool UseBatchBlend()		{ return true; }
+static inline bool VerifyBatchBlend()	{ return false; }
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: Collect the bones a blend applies to and the weight q2,pos2 gets on
+//			each, so the blend loops don't branch on bone masks and bone maps
+//-----------------------------------------------------------------------------
+static int GatherBlendBones(
+	const CStudioHdr *pStudioHdr,
+	mstudioseqdesc_t &seqdesc,
+	int sequence,
+	float s,
+	bool bScaleBySeqWeight,
+	int boneMask,
+	int *pBones,
+	float *pWeights )
+{
+	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
+	const virtualgroup_t *pSeqGroup = NULL;
+	if (pVModel)
+	{
+		pSeqGroup = pVModel->pSeqGroup( sequence );
+	}
+
+	mstudiobone_t *pbone = pStudioHdr->pBone( 0 );
+
+	int nCount = 0;
+	for (int i = 0; i < pStudioHdr->numbones(); i++)
+	{
+		// skip unused bones
+		if (!(pbone[i].flags & boneMask))
+		{
+			continue;
+		}
+
+		int j = pSeqGroup ? pSeqGroup->boneMap[i] : i;
+		if (j < 0)
+		{
+			continue;
+		}
+
+		float flSeqWeight = seqdesc.weight( j );
+		float flWeight = bScaleBySeqWeight ? s * flSeqWeight : s;
+		if (flSeqWeight > 0.0 && flWeight > 0.0)
+		{
+			pBones[nCount] = i;
+			pWeights[nCount] = flWeight;
+			nCount++;
+		}
+	}
+	return nCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Same as QuaternionBlend( q2[i], q1[i], 1 - w, q1[i] ) for each gathered
+//			bone (no align for BONE_FIXED_ALIGNMENT), four bones per SSE op.
+//			The quaternions are transposed so each register holds one component
+//			of four bones.
+//-----------------------------------------------------------------------------
+static void BlendQuaternionsBatched(
+	const mstudiobone_t *pbone,
+	Quaternion q1[],
+	const Quaternion q2[],
+	const int *pBones,
+	const float *pWeights,
+	int nCount )
+{
+	int n = 0;
+
+	if (UseBatchBlend() && MathLib_SSEEnabled())
+	{
+		bool bVerify = VerifyBatchBlend();
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps( 1.0f );
+
+		for ( ; n + 4 <= nCount; n += 4)
+		{
+			const int *b = &pBones[n];
+
+			Quaternion expected[4];
+			if (bVerify)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					if (pbone[b[k]].flags & BONE_FIXED_ALIGNMENT)
+					{
+						QuaternionBlendNoAlign( q2[b[k]], q1[b[k]], 1.0f - pWeights[n+k], expected[k] );
+					}
+					else
+					{
+						QuaternionBlend( q2[b[k]], q1[b[k]], 1.0f - pWeights[n+k], expected[k] );
+					}
+				}
+			}
+
+			__m128 px = _mm_loadu_ps( &q2[b[0]].x );
+			__m128 py = _mm_loadu_ps( &q2[b[1]].x );
+			__m128 pz = _mm_loadu_ps( &q2[b[2]].x );
+			__m128 pw = _mm_loadu_ps( &q2[b[3]].x );
+			_MM_TRANSPOSE4_PS( px, py, pz, pw );
+
+			__m128 qx = _mm_loadu_ps( &q1[b[0]].x );
+			__m128 qy = _mm_loadu_ps( &q1[b[1]].x );
+			__m128 qz = _mm_loadu_ps( &q1[b[2]].x );
+			__m128 qw = _mm_loadu_ps( &q1[b[3]].x );
+			_MM_TRANSPOSE4_PS( qx, qy, qz, qw );
+
+			// QuaternionAlign: q1 is backwards when the dot product is negative.
+			// Flip the sign bit in those lanes, unless the bone's alignment is fixed.
+			__m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, qx ), _mm_mul_ps( py, qy ) ),
+									 _mm_add_ps( _mm_mul_ps( pz, qz ), _mm_mul_ps( pw, qw ) ) );
+			__m128 alignSign = _mm_set_ps( 
+				(pbone[b[3]].flags & BONE_FIXED_ALIGNMENT) ? 0.0f : -0.0f,
+				(pbone[b[2]].flags & BONE_FIXED_ALIGNMENT) ? 0.0f : -0.0f,
+				(pbone[b[1]].flags & BONE_FIXED_ALIGNMENT) ? 0.0f : -0.0f,
+				(pbone[b[0]].flags & BONE_FIXED_ALIGNMENT) ? 0.0f : -0.0f );
+			__m128 flip = _mm_and_ps( _mm_cmplt_ps( dot, zero ), alignSign );
+			qx = _mm_xor_ps( qx, flip );
+			qy = _mm_xor_ps( qy, flip );
+			qz = _mm_xor_ps( qz, flip );
+			qw = _mm_xor_ps( qw, flip );
+
+			__m128 s2 = _mm_loadu_ps( &pWeights[n] );
+			__m128 s1 = _mm_sub_ps( one, s2 );
+			__m128 rx = _mm_add_ps( _mm_mul_ps( s2, px ), _mm_mul_ps( s1, qx ) );
+			__m128 ry = _mm_add_ps( _mm_mul_ps( s2, py ), _mm_mul_ps( s1, qy ) );
+			__m128 rz = _mm_add_ps( _mm_mul_ps( s2, pz ), _mm_mul_ps( s1, qz ) );
+			__m128 rw = _mm_add_ps( _mm_mul_ps( s2, pw ), _mm_mul_ps( s1, qw ) );
+
+			// QuaternionNormalize, leaving zero length quaternions alone
+			__m128 radius = _mm_add_ps( _mm_add_ps( _mm_mul_ps( rx, rx ), _mm_mul_ps( ry, ry ) ),
+										_mm_add_ps( _mm_mul_ps( rz, rz ), _mm_mul_ps( rw, rw ) ) );
+			__m128 nonzero = _mm_cmpneq_ps( radius, zero );
+			__m128 iradius = _mm_div_ps( one, _mm_sqrt_ps( radius ) );
+			iradius = _mm_or_ps( _mm_and_ps( nonzero, iradius ), _mm_andnot_ps( nonzero, one ) );
+			rx = _mm_mul_ps( rx, iradius );
+			ry = _mm_mul_ps( ry, iradius );
+			rz = _mm_mul_ps( rz, iradius );
+			rw = _mm_mul_ps( rw, iradius );
+
+			_MM_TRANSPOSE4_PS( rx, ry, rz, rw );
+			_mm_storeu_ps( &q1[b[0]].x, rx );
+			_mm_storeu_ps( &q1[b[1]].x, ry );
+			_mm_storeu_ps( &q1[b[2]].x, rz );
+			_mm_storeu_ps( &q1[b[3]].x, rw );
+
+			if (bVerify)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					float flDiff = QuaternionAngleDiff( expected[k], q1[b[k]] );
+					if (flDiff > 0.01f)
+					{
+						Warning( "Batched blend of bone %d is off by %.4f degrees\n", b[k], flDiff );
+					}
+				}
+			}
+		}
+	}
+
+	// Whatever's left over
+	for ( ; n < nCount; n++)
+	{
+		int i = pBones[n];
+		Quaternion q3;
+		if (pbone[i].flags & BONE_FIXED_ALIGNMENT)
+		{
+			QuaternionBlendNoAlign( q2[i], q1[i], 1.0f - pWeights[n], q3 );
+		}
+		else
+		{
+			QuaternionBlend( q2[i], q1[i], 1.0f - pWeights[n], q3 );
+		}
+		q1[i] = q3;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: pos1[i] = pos1[i] * (1 - w) + pos2[i] * w for each gathered bone
+//-----------------------------------------------------------------------------
+static void BlendPositionsBatched(
+	Vector pos1[],
+	const Vector pos2[],
+	const int *pBones,
+	const float *pWeights,
+	int nCount )
+{
+	for (int n = 0; n < nCount; n++)
+	{
+		int i = pBones[n];
+		float s2 = pWeights[n];
+		float s1 = 1.0f - s2;
+		pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+		pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+		pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+	}
+}
+
+
+
 
 //-----------------------------------------------------------------------------
 // Purpose: blend together in world space q1,pos1 with q2,pos2.  Return result in q1,pos1.  
@@ -898,51 +1710,30 @@ void SlerpBones(
 	}
 	else
 	{
-		for (i = 0; i < pStudioHdr->numbones(); i++)
+		int bones[MAXSTUDIOBONES];
+		float weights[MAXSTUDIOBONES];
+		int nCount = GatherBlendBones( pStudioHdr, seqdesc, sequence, s, true, boneMask, bones, weights );
+
+		for (int n = 0; n < nCount; n++)
 		{
-			// skip unused bones
-			if (!(pbone[i].flags & boneMask))
-			{
-				continue;
-			}
+			i = bones[n];
+			s1 = 1.0 - weights[n];
 
-			if (pSeqGroup)
+			if (pbone[i].flags & BONE_FIXED_ALIGNMENT)
 			{
-				j = pSeqGroup->boneMap[i];
-				if (j >= 0)
-				{
-					s2 = s * seqdesc.weight( j );	// blend in based on this bones weight
-				}
-				else
-				{
-					s2 = 0.0;
-				}
+				QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
 			}
 			else
 			{
-				s2 = s * seqdesc.weight( i );	// blend in based on this animations weights
-			}
-			if (s2 > 0.0)
-			{
-				s1 = 1.0 - s2;
-
-				if (pbone[i].flags & BONE_FIXED_ALIGNMENT)
-				{
-					QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
-				}
-				else
-				{
-					QuaternionSlerp( q2[i], q1[i], s1, q3 );
-				}
-				q1[i][0] = q3[0];
-				q1[i][1] = q3[1];
-				q1[i][2] = q3[2];
-				q1[i][3] = q3[3];
-				pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+				QuaternionSlerp( q2[i], q1[i], s1, q3 );
 			}
+			q1[i][0] = q3[0];
+			q1[i][1] = q3[1];
+			q1[i][2] = q3[2];
+			q1[i][3] = q3[3];
 		}
+
+		BlendPositionsBatched( pos1, pos2, bones, weights, nCount );
 	}
 }
 
@@ -965,7 +1756,6 @@ void BlendBones(
 	int boneMask )
 {
 	int			i, j;
-	Quaternion		q3;
 
 	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
 	const virtualgroup_t *pSeqGroup = NULL;
@@ -1010,45 +1800,12 @@ void BlendBones(
 		return;
 	}
 
-	float s2 = s;
-	float s1 = 1.0 - s2;
+	int bones[MAXSTUDIOBONES];
+	float weights[MAXSTUDIOBONES];
+	int nCount = GatherBlendBones( pStudioHdr, seqdesc, sequence, s, false, boneMask, bones, weights );
 
-	for (i = 0; i < pStudioHdr->numbones(); i++)
-	{
-		// skip unused bones
-		if (!(pbone[i].flags & boneMask))
-		{
-			continue;
-		}
-
-		if (pSeqGroup)
-		{
-			j = pSeqGroup->boneMap[i];
-		}
-		else
-		{
-			j = i;
-		}
-
-		if (j >= 0 && seqdesc.weight( j ) > 0.0)
-		{
-			if (pbone[i].flags & BONE_FIXED_ALIGNMENT)
-			{
-				QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
-			}
-			else
-			{
-				QuaternionBlend( q2[i], q1[i], s1, q3 );
-			}
-			q1[i][0] = q3[0];
-			q1[i][1] = q3[1];
-			q1[i][2] = q3[2];
-			q1[i][3] = q3[3];
-			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
-		}
-	}
+	BlendQuaternionsBatched( pbone, q1, q2, bones, weights, nCount );
+	BlendPositionsBatched( pos1, pos2, bones, weights, nCount );
 }
 
 
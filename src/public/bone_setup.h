@@ -425,12 +425,12 @@ class CBoneCache
 {
 public:
 
-	// you must implement these static functions for the ResourceManager
+	// you must implement these static functions for the bone cache manager
 	// -----------------------------------------------------------
 	static CBoneCache *CreateResource( const bonecacheparams_t &params );
 	static unsigned int EstimatedSize( const bonecacheparams_t &params );
 	// -----------------------------------------------------------
-	// member functions that must be present for the ResourceManager
+	// member functions that must be present for the bone cache manager
 	void			DestroyResource();
 	CBoneCache		*GetData() { return this; }
 	unsigned int	Size() { return m_size; }
@@ -452,6 +452,10 @@ public:
 	float			m_timeValid;
 	int				m_boneMask;
 
+	// Link and frame epoch while waiting to be freed after eviction
+	CBoneCache		*m_pNextRetired;
+	long			m_nRetiredEpoch;
+
 private:
 	matrix3x4_t		*BoneArray();
 	short			*StudioToCached();
@@ -469,6 +473,9 @@ memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params );
 void Studio_DestroyBoneCache( memhandle_t cacheHandle );
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle );
 
+// Call once a frame when no bone setup is running, so evicted caches can be freed
+void Studio_BoneCacheNewFrame();
+
 // Given a ray, trace for an intersection with this studiomodel.  Get the array of bones from StudioSetupHitboxBones
 bool TraceToStudio( const Ray_t& ray, CStudioHdr *pStudioHdr, mstudiohitboxset_t *set, matrix3x4_t **hitboxbones, int fContentsMask, trace_t &trace );
 
@@ -0,0 +1,35 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Sorting float keys (view depths and the like) with payload indices,
+//			without allocating.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#if defined( _WIN32 )
+#pragma once
+#endif
+
+// Number of unsigned ints of scratch space the sorts below need for nCount keys.
+#define RADIXSORT_SCRATCH_SIZE( nCount )	( 2 * (nCount) )
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills pIndices with 0..nCount-1 ordered by ascending pKeys[i].
+//			The sort is stable. pScratch must hold RADIXSORT_SCRATCH_SIZE( nCount )
+//			unsigned ints.
+//-----------------------------------------------------------------------------
+void RadixSortFloats( const float *pKeys, int nCount, unsigned int *pIndices, unsigned int *pScratch );
+
+//-----------------------------------------------------------------------------
+// Purpose: Like RadixSortFloats, but pIndices holds a starting order on input,
+//			usually last frame's. If that order is nearly right, an insertion
+//			sort fixes it up; if the insertion sort has to move too much, it
+//			gives up and radix sorts instead.
+//			Returns true if the insertion sort was enough.
+//-----------------------------------------------------------------------------
+bool SortFloatsCoherent( const float *pKeys, int nCount, unsigned int *pIndices, unsigned int *pScratch );
+
+#endif // RADIXSORT_H
@@ -0,0 +1,132 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Sorting float keys with payload indices, without allocating.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "radixsort.h"
+#include <string.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Insertion sort gives up once it has moved this many keys per key sorted.
+#define COHERENT_SORT_MAX_MOVES		4
+
+//-----------------------------------------------------------------------------
+// Maps a float to an unsigned int that sorts the same way: flip every bit of
+// negatives, and just the sign bit of positives.
+//-----------------------------------------------------------------------------
+static inline unsigned int FloatToSortableBits( float f )
+{
+	unsigned int n = *(unsigned int *)&f;
+	unsigned int nMask = -(int)( n >> 31 ) | 0x80000000;
+	return n ^ nMask;
+}
+
+//-----------------------------------------------------------------------------
+// Least significant byte first radix sort of pIndices by pBits[pIndices[i]].
+// Passes where every key has the same byte are skipped.
+//-----------------------------------------------------------------------------
+static void RadixSortIndices( const unsigned int *pBits, int nCount, unsigned int *pIndices, unsigned int *pTemp )
+{
+	int histograms[4][256];
+	memset( histograms, 0, sizeof( histograms ) );
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		unsigned int n = pBits[i];
+		histograms[0][ n & 0xFF ]++;
+		histograms[1][ ( n >> 8 ) & 0xFF ]++;
+		histograms[2][ ( n >> 16 ) & 0xFF ]++;
+		histograms[3][ n >> 24 ]++;
+	}
+
+	unsigned int *pSrc = pIndices;
+	unsigned int *pDst = pTemp;
+	for ( int nPass = 0; nPass < 4; nPass++ )
+	{
+		int *pHistogram = histograms[nPass];
+		int nShift = nPass * 8;
+
+		if ( pHistogram[ ( pBits[0] >> nShift ) & 0xFF ] == nCount )
+			continue;
+
+		// Turn counts into starting offsets
+		int nOffset = 0;
+		for ( int i = 0; i < 256; i++ )
+		{
+			int n = pHistogram[i];
+			pHistogram[i] = nOffset;
+			nOffset += n;
+		}
+
+		for ( int i = 0; i < nCount; i++ )
+		{
+			unsigned int nIndex = pSrc[i];
+			pDst[ pHistogram[ ( pBits[nIndex] >> nShift ) & 0xFF ]++ ] = nIndex;
+		}
+
+		unsigned int *pSwap = pSrc;
+		pSrc = pDst;
+		pDst = pSwap;
+	}
+
+	if ( pSrc != pIndices )
+	{
+		memcpy( pIndices, pSrc, nCount * sizeof( unsigned int ) );
+	}
+}
+
+void RadixSortFloats( const float *pKeys, int nCount, unsigned int *pIndices, unsigned int *pScratch )
+{
+	if ( nCount <= 0 )
+		return;
+
+	unsigned int *pBits = pScratch;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		pBits[i] = FloatToSortableBits( pKeys[i] );
+		pIndices[i] = i;
+	}
+
+	RadixSortIndices( pBits, nCount, pIndices, pScratch + nCount );
+}
+
+bool SortFloatsCoherent( const float *pKeys, int nCount, unsigned int *pIndices, unsigned int *pScratch )
+{
+	if ( nCount <= 1 )
+		return true;
+
+	int nMovesLeft = COHERENT_SORT_MAX_MOVES * nCount;
+	for ( int i = 1; i < nCount; i++ )
+	{
+		unsigned int nIndex = pIndices[i];
+		float flKey = pKeys[nIndex];
+
+		int j = i;
+		while ( j > 0 && pKeys[ pIndices[j - 1] ] > flKey )
+		{
+			pIndices[j] = pIndices[j - 1];
+			--j;
+			--nMovesLeft;
+		}
+		pIndices[j] = nIndex;
+
+		if ( nMovesLeft < 0 )
+		{
+			// Too far out of order; radix sort what's left, keeping the order we have
+			unsigned int *pBits = pScratch;
+			for ( int k = 0; k < nCount; k++ )
+			{
+				pBits[k] = FloatToSortableBits( pKeys[k] );
+			}
+			RadixSortIndices( pBits, nCount, pIndices, pScratch + nCount );
+			return false;
+		}
+	}
+
+	return true;
+}